@@ -0,0 +1,268 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include <errno.h>
+
+#include "bufferpool.h"
+#include "comm.h"
+
+#if defined(HAVE_MMAP) && !defined(WIN32)
+#include <sys/mman.h>
+#endif
+
+/*! Huge page size assumed to round the arena. */
+#define BP_HUGE_PAGE (2 * 1024 * 1024)
+/*! Segments of the current class the arena is sized for. */
+#define BP_ARENA_SEGS 4
+/*! Page size assumed to prefault memory. */
+#define BP_PAGE 4096
+
+/* touches every page so that recvfrom never faults on a fresh slot */
+static void bpprefault(char *mem, int bytes)
+{
+        int i;
+
+        for (i = 0; i < bytes; i += BP_PAGE)
+                ((volatile char *) mem)[i] = 0;
+}
+
+/* locks memory if asked to, a failure is not fatal */
+static void bplock(buffer_pool * bp, char *mem, int bytes)
+{
+#ifdef HAVE_MLOCK
+        if ((bp->mem_flags & BP_MEM_MLOCK) && mlock(mem, bytes))
+                nms_printf(NMSML_WARN,
+                           "Cannot lock bufferpool memory: %s\n",
+                           strerror(errno));
+#endif
+}
+
+/*!
+* \brief Maps the slot arena of a Buffer Pool.
+*
+* With \c BP_MEM_HUGEPAGES the arena is mapped with \c MAP_HUGETLB, falling
+* back to transparent huge pages and then to normal pages, and prefaulted.
+* Segments are carved from it by <tt>\ref bpsegalloc</tt>, which uses plain
+* \c malloc once the arena is exhausted or if it could not be mapped.
+* The whole arena counts in \c bytes and is charged to the shared budget:
+* it is not mapped if the budget cannot grant it.
+*
+* \param bp The Buffer Pool, \c slot_size, \c mem_flags and \c shared
+* already set.
+* \return 0
+* \see bparena_kill
+* \see bufferpool.h
+* */
+int bparena_init(buffer_pool * bp)
+{
+        bp->arena = NULL;
+        bp->arena_size = bp->arena_used = 0;
+        memset(bp->arena_free, 0, sizeof(bp->arena_free));
+
+#if defined(HAVE_MMAP) && !defined(WIN32)
+        if (bp->mem_flags & BP_MEM_HUGEPAGES) {
+                int size = BP_ARENA_SEGS * BP_SLOT_NUM * (bp->slot_size +
+                           (bp->mem_flags & BP_MEM_HEADROOM ? BP_HEADROOM : 0));
+                int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+                void *mem = MAP_FAILED;
+
+                size = (size + BP_HUGE_PAGE - 1) / BP_HUGE_PAGE * BP_HUGE_PAGE;
+                if (bp->shared ? bpshared_alloc(bp, size)
+                                : bp->bytes + size > BP_MAX_BYTES) {
+                        nms_printf(NMSML_WARN,
+                                   "No budget for the bufferpool arena, using malloc\n");
+                        return 0;
+                }
+#ifdef MAP_POPULATE
+                flags |= MAP_POPULATE;
+#endif
+#ifdef MAP_HUGETLB
+                mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           flags | MAP_HUGETLB, -1, 0);
+                if (mem == MAP_FAILED)
+                        nms_printf(NMSML_DBG1,
+                                   "No hugetlb pages for the bufferpool: %s\n",
+                                   strerror(errno));
+#endif
+                if (mem == MAP_FAILED) {
+                        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, flags,
+                                   -1, 0);
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+                        if (mem != MAP_FAILED)
+                                madvise(mem, size, MADV_HUGEPAGE);
+#endif
+                }
+                if (mem == MAP_FAILED) {
+                        nms_printf(NMSML_WARN,
+                                   "Cannot map the bufferpool arena, using malloc\n");
+                        if (bp->shared)
+                                bpshared_release(bp, size);
+                        return 0;
+                }
+
+                bp->arena = mem;
+                bp->arena_size = size;
+                bp->bytes += size;
+                bpprefault(bp->arena, size);
+                bplock(bp, bp->arena, size);
+        }
+#endif
+
+        return 0;
+}
+
+/*!
+* \brief Unmaps the slot arena of a Buffer Pool.
+*
+* All the segments must have been released.
+*
+* \param bp The Buffer Pool.
+* \return 0
+* \see bparena_init
+* */
+int bparena_kill(buffer_pool * bp)
+{
+#if defined(HAVE_MMAP) && !defined(WIN32)
+        if (bp->arena) {
+                munmap(bp->arena, bp->arena_size);
+                if (bp->shared)
+                        bpshared_release(bp, bp->arena_size);
+                bp->bytes -= bp->arena_size;
+        }
+#endif
+        bp->arena = NULL;
+        bp->arena_size = bp->arena_used = 0;
+
+        return 0;
+}
+
+/* gives an extent back to the arena, merged with the free ones around it */
+static void bparena_give(buffer_pool * bp, char *mem, int bytes)
+{
+        int i, empty = -1;
+
+        for (i = 0; i < BP_MAX_SEGMENTS; i++) {
+                if (!bp->arena_free[i].mem) {
+                        if (empty < 0)
+                                empty = i;
+                        continue;
+                }
+                if (bp->arena_free[i].mem + bp->arena_free[i].bytes == mem)
+                        mem = bp->arena_free[i].mem;
+                else if (mem + bytes != bp->arena_free[i].mem)
+                        continue;
+                bytes += bp->arena_free[i].bytes;
+                bp->arena_free[i].mem = NULL;
+                if (empty < 0)
+                        empty = i;
+        }
+
+        if (mem + bytes == bp->arena + bp->arena_used)
+                bp->arena_used -= bytes;
+        else if (empty >= 0) {
+                bp->arena_free[empty].mem = mem;
+                bp->arena_free[empty].bytes = bytes;
+        }
+}
+
+/*!
+* \brief Allocates the memory of a segment.
+*
+* Extents released to the arena are reused first, the part not needed
+* staying free, then the arena is carved, then \c malloc is used. Only
+* \c malloc memory is added to \c bytes and charged to the shared budget,
+* since the arena already is.
+*
+* \param bp The Buffer Pool.
+* \param bytes Size of the segment.
+* \return The segment memory, NULL if memory, \c BP_MAX_BYTES or the
+* quota of the shared budget is exhausted.
+* \see bpsegrelease
+* */
+char *bpsegalloc(buffer_pool * bp, int bytes)
+{
+        char *mem;
+        int i;
+
+        for (i = 0; i < BP_MAX_SEGMENTS; i++)
+                if (bp->arena_free[i].mem && bp->arena_free[i].bytes >= bytes) {
+                        mem = bp->arena_free[i].mem;
+                        bp->arena_free[i].bytes -= bytes;
+                        bp->arena_free[i].mem = bp->arena_free[i].bytes ?
+                                                mem + bytes : NULL;
+                        return mem;
+                }
+
+        if (bp->arena && bp->arena_size - bp->arena_used >= bytes) {
+                mem = bp->arena + bp->arena_used;
+                bp->arena_used += bytes;
+                return mem;
+        }
+
+        if (bp->shared ? bpshared_alloc(bp, bytes)
+                        : bp->bytes + bytes > BP_MAX_BYTES)
+                return NULL;
+
+        if (!(mem = malloc(bytes))) {
+                if (bp->shared)
+                        bpshared_release(bp, bytes);
+                return NULL;
+        }
+        if (bp->mem_flags & BP_MEM_MLOCK) {
+                bpprefault(mem, bytes);
+                bplock(bp, mem, bytes);
+        }
+        bp->bytes += bytes;
+
+        return mem;
+}
+
+/*!
+* \brief Releases the memory of a segment.
+*
+* Arena memory is kept for the next segments of the same pool, \c malloc
+* memory is freed and given back to the shared budget.
+*
+* \param bp The Buffer Pool.
+* \param mem The segment memory.
+* \param bytes Size of the segment.
+* \return 0
+* \see bpsegalloc
+* */
+int bpsegrelease(buffer_pool * bp, char *mem, int bytes)
+{
+        if (BP_IN_ARENA(bp, mem)) {
+                bparena_give(bp, mem, bytes);
+                return 0;
+        }
+
+#ifdef HAVE_MLOCK
+        if (bp->mem_flags & BP_MEM_MLOCK)
+                munlock(mem, bytes);
+#endif
+        free(mem);
+        if (bp->shared)
+                bpshared_release(bp, bytes);
+        bp->bytes -= bytes;
+
+        return 0;
+}
@@ -22,12 +22,48 @@
 
 #include "bufferpool.h"
 
+/* pushes a slot on the Free List, fl_mutex held */
+static void bpgive(buffer_pool * bp, int index)
+{
+        bp_segment *seg = &bp->segments[index / BP_SLOT_NUM];
+
+#ifdef BP_CLEAR_SLOTS
+        memset(BP_SLOT(bp, index), 0, seg->slot_size);
+#endif
+        seg->used--;
+        bp->flcount--;
+        if (seg->slot_size == bp->slot_size) {
+                bp->freelist[index] = bp->flhead;
+                bp->flprev[index] = -1;
+                if (bp->flhead != -1)
+                        bp->flprev[bp->flhead] = index;
+                bp->flhead = index;
+                /* give idle memory back to the shared budget, keeping a
+                 * spare segment to avoid thrashing; the arena is charged
+                 * as a whole */
+                if (!seg->used && bpshared_over(bp)
+                                && !BP_IN_ARENA(bp, seg->mem)
+                                && bp->size - bp->flcount >= 2 * BP_SLOT_NUM)
+                        bpsegdrop(bp, index / BP_SLOT_NUM);
+        } else if (!seg->used) {
+                /* last slot of a class dropped by bpresize */
+                bpsegfree(bp, index / BP_SLOT_NUM);
+        }
+}
+
 /*!
 * \brief Restituisce uno slot alla Free List.
 *
 * Dopo aver rimosso un elemento dal Buffer di Playout, tramite la bpdel,
 * inserisce in testa alla Free List l'indice dell'elemento liberato.
 *
+* The slot content is left as it is: only the first \c pktlen bytes
+* written by the receiver are meaningful. Configure with
+* \c --enable-bp-clear to zero it for debugging.
+*
+* A pool above its soft quota of the shared budget releases a segment as
+* soon as it is unused, if it still has another segment worth of free slots.
+*
 * \param bp Il puntatore al Buffer Pool corrente.
 * \param index L'indice dello slot da liberare.
 * \return 0
@@ -37,10 +73,37 @@
 int bpfree(buffer_pool * bp, int index)
 {
         pthread_mutex_lock(&(bp->fl_mutex));
-        bp->freelist[index] = bp->flhead;
-        bp->flhead = index;
-        bp->flcount--;
-        memset(bp->bufferpool + index, 0, sizeof(bp_slot));
+        bpgive(bp, index);
+        pthread_cond_signal(&(bp->cond_full));
+        pthread_mutex_unlock(&(bp->fl_mutex));
+
+        return 0;
+}
+
+/*!
+* \brief Gives several slots back to the Buffer Pool at once.
+*
+* Like <tt>\ref bpfree</tt>, with a single acquisition of the Free List
+* mutex for the whole batch.
+*
+* \param bp The current Buffer Pool.
+* \param slots The slot indexes.
+* \param n Number of slots.
+* \return 0
+* \see bpgetn
+* \see bufferpool.h
+* */
+int bpfreen(buffer_pool * bp, int *slots, int n)
+{
+        int i;
+
+        if (n <= 0)
+                return 0;
+
+        pthread_mutex_lock(&(bp->fl_mutex));
+        for (i = 0; i < n; i++)
+                bpgive(bp, slots[i]);
+        pthread_cond_broadcast(&(bp->cond_full));
         pthread_mutex_unlock(&(bp->fl_mutex));
 
         return 0;
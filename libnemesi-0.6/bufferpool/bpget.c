@@ -22,9 +22,28 @@
 
 #include "bufferpool.h"
 #include "comm.h"
-#include <syslog.h>
 
-FILE* logfp;
+/* pops the Free List head, fl_mutex held */
+static int bptake(buffer_pool * bp)
+{
+        int offset;
+
+        if (bp->flhead == -1) {
+                if (bpenlarge(bp))
+                        return -1;
+                nms_printf(NMSML_DBG1, "Bufferpool enlarged\n");
+        }
+
+        offset = bp->flhead;
+        if ((bp->flhead = bp->freelist[offset]) != -1)
+                bp->flprev[bp->flhead] = -1;
+        bp->segments[offset / BP_SLOT_NUM].used++;
+        bp->flcount++;
+        if (bp->flcount > bp->stats.high_water)
+                bp->stats.high_water = bp->flcount;
+
+        return offset;
+}
 
 /*!
 * \brief Restituisce uno slot di memoria libero dal Buffer Pool.
@@ -33,70 +52,48 @@ FILE* logfp;
 * dal quale si puo' ricavare il puntatore all'area di memoria
 * da utilizzare.
 *
+* It never blocks: when the pool cannot grow any more the caller applies
+* its own overflow policy, see \c rtp_overflow and <tt>\ref bpwait</tt>.
+*
 * \param bp Il puntatore al Buffer Pool corrente.
-* \return L'indice dello slot libero nel vettore del Buffer Pool.
+* \return L'indice dello slot libero nel vettore del Buffer Pool, -1 if
+* the pool is full.
 * \see bprmv
 * \see bufferpool.h
 * */
-static char gbploc[32] = {0};
-
-void bp_setloc(char* location)
-{
-	if (location != NULL)
-		strcpy(gbploc, location);
-	else 
-		sprintf(gbploc, "NOT SET");
-}
-
 int bpget(buffer_pool * bp)
 {
         int offset;
-#ifdef BPSTAT
-		static int bpgetcnt = 0;
-		char bplog[64] = {0};
-		char bplogcmd[64] = "date >> ";
-		sprintf(bplog, "/var/ftp/Bpstat%s.log", gbploc);
-		strcat(bplogcmd, bplog);
-#endif
-		pthread_mutex_lock(&(bp->fl_mutex));
-        while (bp->flhead == -1) {
-                if (bpenlarge(bp)) {
-                        nms_printf(NMSML_WARN, "Bufferpool reached maximum size!\n");
-//						syslog(LOG_ERR, "%s Bufferpool reached maximum size, reboot!\n");
-						if ( (logfp = fopen("/var/ftp/reboot.log", "a")) != NULL )
-						{
-							fprintf(logfp, "esdump: Bufferpool reached maximum size, location %s, reboot!\n", gbploc);
-							fclose(logfp);
-							system("date >> /var/ftp/reboot.log");
-	 						//system("echo 'nvd close reboot' >> /var/ftp/reboot.log");
-						}
-						system("/root/nvd_app/mcuhb.out off");
-						system("reboot");
-                        pthread_cond_wait(&(bp->cond_full), &(bp->fl_mutex));
-                } else {
-                        nms_printf(NMSML_DBG1, "Bufferpool enlarged\n");
-                }
-        }
 
-        offset = bp->flhead;
-        bp->flhead = bp->freelist[bp->flhead];
-        bp->flcount++;
-#ifdef BPSTAT
-		if(bpgetcnt == 500){
-						if ( (logfp = fopen(bplog, "a")) != NULL )
-						{
-							fprintf(logfp, "Bufferpool[%s]: Freeslotcnt:%d, Used size:%dKB, Alloacted bpsize:%dKB\n", gbploc, bp->flcount, bp->flcount*BP_SLOT_SIZE/1024, bp->size*BP_SLOT_SIZE/1024);
-							fclose(logfp);
-							system(bplogcmd);
-	 						//system("echo 'nvd close reboot' >> /var/ftp/reboot.log");
-						}
-						bpgetcnt = 0;
-		}						
-						bpgetcnt++;
-#endif
+        pthread_mutex_lock(&(bp->fl_mutex));
+        offset = bptake(bp);
         pthread_mutex_unlock(&(bp->fl_mutex));
-		
+
         return offset;
 }
 
+/*!
+* \brief Takes several free slots from the Buffer Pool at once.
+*
+* Like <tt>\ref bpget</tt>, with a single acquisition of the Free List
+* mutex for the whole batch.
+*
+* \param bp The current Buffer Pool.
+* \param slots Where to store the slot indexes.
+* \param n Slots wanted.
+* \return The number of slots taken, less than \c n if the pool is full.
+* \see bpfreen
+* \see bufferpool.h
+* */
+int bpgetn(buffer_pool * bp, int *slots, int n)
+{
+        int i;
+
+        pthread_mutex_lock(&(bp->fl_mutex));
+        for (i = 0; i < n && (slots[i] = bptake(bp)) >= 0; i++);
+        pthread_mutex_unlock(&(bp->fl_mutex));
+
+        return i;
+}
+
 
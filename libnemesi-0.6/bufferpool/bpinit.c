@@ -23,39 +23,76 @@
 #include "bufferpool.h"
 
 #define RET_ERR(x)    do {\
-                free(bp->bufferpool); \
+                bpkill(bp); \
                 return x; \
             } while (0)
 
+/*!
+* \brief Returns the smallest slot size class holding \c len bytes.
+*
+* \param len Packet size in bytes.
+* \return The class size, 0 if \c len is over \c BP_MAX_SLOT_SIZE.
+* \see bufferpool.h
+* */
+int bpclass(int len)
+{
+        if (len <= BP_CLASS_AUDIO)
+                return BP_CLASS_AUDIO;
+        if (len <= BP_CLASS_SMALL)
+                return BP_CLASS_SMALL;
+        if (len <= BP_CLASS_MTU)
+                return BP_CLASS_MTU;
+        if (len <= BP_CLASS_JUMBO)
+                return BP_CLASS_JUMBO;
+        return 0;
+}
+
 /*!
 * \brief Inizializza il Buffer Pool.
 *
 * Alloca la memoria per il Buffer di Playout e inizializza la Free List per la gestione interna della memoria.
 * Inizializza la variabile di accesso in Mutua Esclusione alla Free List.
 *
+* Only the first segment of \c BP_SLOT_NUM slots is allocated here, the
+* others are added on demand by <tt>\ref bpenlarge</tt>. The Free List is
+* sized for \c BP_MAX_SIZE slots from the start, so it never moves either.
+* Slots are not zeroed unless \c BP_CLEAR_SLOTS is defined.
+*
 * \param bp Il puntatore al Buffer Pool corrente.
+* \param pktlen Expected packet size, the slot class is the smallest
+* holding it.
+* \param mem_flags \c BP_MEM_HUGEPAGES and/or \c BP_MEM_MLOCK, 0 for plain
+* \c malloc memory, plus \c BP_MEM_HEADROOM to keep room in front of
+* the slots.
+* A pool on the shared budget starts empty when the budget cannot give it
+* a first segment: \c bpget fails until memory is released elsewhere.
+*
 * \return 1 in caso di errore, 0 altrimenti.
 * \see bpkill
+* \see bpresize
 * \see bufferpool.h
 * */
-int bpinit(buffer_pool * bp)
+int bpinit(buffer_pool * bp, int pktlen, int mem_flags)
 {
         pthread_mutexattr_t mutex_attr;
         int i;
 
-        if (((bp->bufferpool) =
-                                (bp_slot *) malloc(BP_SLOT_NUM * sizeof(bp_slot))) == NULL) {
-                return 1;
-        }
-        memset(bp->bufferpool, 0, BP_SLOT_NUM * sizeof(bp_slot));
+        memset(bp->segments, 0, sizeof(bp->segments));
+        bp->size = 0;
+        bp->bytes = 0;
+        bp->flhead = -1;
+        bp->flprev = NULL;
+        bp->flcount = 0;
+        bp->shared = 0;
+        bp->mem_flags = mem_flags;
+        memset(&bp->stats, 0, sizeof(bp->stats));
 
-        bp->freelist = calloc(BP_SLOT_NUM, sizeof(int));
+        if (!(bp->slot_size = bpclass(pktlen)))
+                bp->slot_size = BP_MAX_SLOT_SIZE;
 
-        for (i = 0; i < BP_SLOT_NUM; bp->freelist[i] = i + 1, i++);
-        bp->freelist[BP_SLOT_NUM - 1] = -1;
-        bp->flhead = 0;
-        bp->flcount = 0;
-        bp->size = BP_SLOT_NUM;
+        if ((bp->freelist = calloc(BP_MAX_SIZE, sizeof(int))) == NULL
+                        || (bp->flprev = calloc(BP_MAX_SIZE, sizeof(int))) == NULL)
+                RET_ERR(1);
 
         if ((i = pthread_mutexattr_init(&mutex_attr)) > 0)
                 RET_ERR(i);
@@ -66,27 +103,65 @@ int bpinit(buffer_pool * bp)
         if ((i = pthread_cond_init(&(bp->cond_full), NULL)) > 0)
                 RET_ERR(i);
 
+        bpshared_register(bp);
+        bparena_init(bp);
+
+        /* the shared budget may be lent out to the other pools */
+        if (bpenlarge(bp) && !bp->shared)
+                RET_ERR(1);
+
         return 0;
 }
 
+/*!
+* \brief Adds a segment of \c BP_SLOT_NUM slots to the Buffer Pool.
+*
+* The segment takes the current slot size class. Existing slots are never
+* moved, so pointers to packets still held by the application stay valid.
+* It MUST be called with \c fl_mutex held.
+*
+* \param bp The current Buffer Pool.
+* \return 0, 1 if the pool reached \c BP_MAX_SIZE slots, \c BP_MAX_BYTES
+* (or its quota of the shared budget) or memory is exhausted.
+* \see bpget
+* \see bufferpool.h
+* */
 int bpenlarge(buffer_pool * bp)
 {
-        int i;
-        int old_size = bp->size;
+        int i, first, seg;
+        int headroom = bp->mem_flags & BP_MEM_HEADROOM ? BP_HEADROOM : 0;
+        int seg_bytes = BP_SLOT_NUM * (bp->slot_size + headroom);
+        char *mem;
 
         if (bp->size >= BP_MAX_SIZE)
                 return 1;
 
-        bp->size += BP_SLOT_NUM;
-
-        bp->bufferpool = realloc(bp->bufferpool, bp->size * sizeof(bp_slot));
-        memset(bp->bufferpool + old_size, 0, (bp->size - old_size) * sizeof(bp_slot));
-        bp->freelist = realloc(bp->freelist, bp->size * sizeof(int));
+        /* segments released by bpresize leave holes in the table */
+        for (seg = 0; seg < BP_MAX_SEGMENTS && bp->segments[seg].mem; seg++);
 
-        for (i = old_size; i < bp->size; bp->freelist[i] = i + 1, i++);
-        bp->freelist[bp->size - 1] = -1;
-        bp->flhead = old_size;
+        if (seg == BP_MAX_SEGMENTS || (mem = bpsegalloc(bp, seg_bytes)) == NULL)
+                return 1;
+#ifdef BP_CLEAR_SLOTS
+        memset(mem, 0, seg_bytes);
+#endif
+
+        bp->segments[seg].mem = mem;
+        bp->segments[seg].slot_size = bp->slot_size;
+        bp->segments[seg].headroom = headroom;
+        bp->segments[seg].used = 0;
+        bp->size += BP_SLOT_NUM;
+        bp->stats.enlarged++;
 
+        first = seg * BP_SLOT_NUM;
+        for (i = first; i < first + BP_SLOT_NUM; i++) {
+                bp->freelist[i] = i + 1;
+                bp->flprev[i] = i - 1;
+        }
+        bp->freelist[first + BP_SLOT_NUM - 1] = bp->flhead;
+        bp->flprev[first] = -1;
+        if (bp->flhead != -1)
+                bp->flprev[bp->flhead] = first + BP_SLOT_NUM - 1;
+        bp->flhead = first;
 
         return 0;
 }
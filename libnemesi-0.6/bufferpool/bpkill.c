@@ -35,7 +35,16 @@
 * */
 int bpkill(buffer_pool * bp)
 {
-        free(bp->bufferpool);
-        bp->bufferpool = NULL;
+        int i;
+
+        for (i = 0; i < BP_MAX_SEGMENTS; i++)
+                if (bp->segments[i].mem)
+                        bpsegfree(bp, i);
+        bparena_kill(bp);
+        bpshared_unregister(bp);
+        free(bp->freelist);
+        bp->freelist = NULL;
+        free(bp->flprev);
+        bp->flprev = NULL;
         return 0;
 }
@@ -0,0 +1,112 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include "bufferpool.h"
+
+/*!
+* \brief Raises the slot size class of the Buffer Pool.
+*
+* Called when a packet bigger than the current class is received. The free
+* slots of the smaller class are dropped from the Free List and their
+* segments released as soon as none of their slots is in use, so new slots
+* come from segments of the new class. Slots still held keep their
+* address and index.
+*
+* \param bp The current Buffer Pool.
+* \param pktlen Size of the packet that did not fit.
+* \return 0, 1 if \c pktlen is over \c BP_MAX_SLOT_SIZE.
+* \see bpfree
+* \see bpenlarge
+* \see bufferpool.h
+* */
+int bpresize(buffer_pool * bp, int pktlen)
+{
+        int slot_size, i;
+
+        if (!(slot_size = bpclass(pktlen)))
+                return 1;
+
+        pthread_mutex_lock(&(bp->fl_mutex));
+        if (slot_size > bp->slot_size) {
+                bp->slot_size = slot_size;
+                bp->flhead = -1;
+                for (i = 0; i < BP_MAX_SEGMENTS; i++)
+                        if (bp->segments[i].mem && !bp->segments[i].used)
+                                bpsegfree(bp, i);
+        }
+        pthread_mutex_unlock(&(bp->fl_mutex));
+
+        return 0;
+}
+
+/*!
+* \brief Releases an unused segment of the Buffer Pool.
+*
+* It MUST be called with \c fl_mutex held.
+*
+* \param bp The current Buffer Pool.
+* \param seg The segment index.
+* \return 0
+* \see bpresize
+* \see bufferpool.h
+* */
+int bpsegfree(buffer_pool * bp, int seg)
+{
+        int seg_bytes = BP_SLOT_NUM * BP_SEG_STRIDE(bp->segments[seg]);
+
+        bpsegrelease(bp, bp->segments[seg].mem, seg_bytes);
+        bp->segments[seg].mem = NULL;
+        bp->size -= BP_SLOT_NUM;
+
+        return 0;
+}
+
+/*!
+* \brief Releases an unused segment whose slots are in the Free List.
+*
+* The slots are unlinked through \c flprev, so the cost does not depend
+* on the length of the Free List.
+* It MUST be called with \c fl_mutex held.
+*
+* \param bp The current Buffer Pool.
+* \param seg The segment index.
+* \return 0
+* \see bpfree
+* \see bufferpool.h
+* */
+int bpsegdrop(buffer_pool * bp, int seg)
+{
+        int i, prev, next;
+
+        for (i = seg * BP_SLOT_NUM; i < (seg + 1) * BP_SLOT_NUM; i++) {
+                prev = bp->flprev[i];
+                next = bp->freelist[i];
+                if (prev == -1)
+                        bp->flhead = next;
+                else
+                        bp->freelist[prev] = next;
+                if (next != -1)
+                        bp->flprev[next] = prev;
+        }
+
+        return bpsegfree(bp, seg);
+}
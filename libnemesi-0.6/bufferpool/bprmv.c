@@ -20,7 +20,10 @@
  *
  * */
 
+#include <sys/time.h>
+
 #include "bufferpool.h"
+#include "utils.h"
 
 /*!
  * \brief Rimuove uno slot dalla coda del Buffer di Plaout di Rete.
@@ -28,43 +31,55 @@
  * Si occupa di chiamare la funzione \c podel per la cancellazione dell'elemento dalla coda di playout
  * e la funzione \c bpfree per l'eliminazione dal vettore del Bufferpool.
  *
+ * When the timing telemetry is enabled, the time the packet spent queued
+ * is accounted in the time in buffer histogram of the Buffer Pool.
+ *
  * \param bp puntatore al vettore del Buffer Pool corrente
  * \param po puntatore alla lista del Buffer di Playout.
  * \param index indice dell'elemento da rimuovere.
- * \return 0
+ * \return 0, 1 if \c index is not the oldest element of the playout buffer.
  * \see podel
  * \see bpfree
  * \see bufferpool.h
  * */
 int bprmv(buffer_pool * bp, playout_buff * po, int index)
 {
-        //podel(po, index);
-        //bpfree(bp, index);
+        if (bpdetach(bp, po, index))
+                return 1;
 
-        pthread_mutex_lock(&(po->po_mutex));
-        pthread_mutex_lock(&(bp->fl_mutex));
+        return bpfree(bp, index);
+}
 
-        if (po->pobuff[index].next != -1)
-                po->pobuff[po->pobuff[index].next].prev =
-                        po->pobuff[index].prev;
-        else
-                po->potail = po->pobuff[index].prev;
-        if (po->pobuff[index].prev != -1)
-                po->pobuff[po->pobuff[index].prev].next =
-                        po->pobuff[index].next;
-        else
-                po->pohead = po->pobuff[index].next;
+/*!
+ * \brief Removes a slot from the Playout Buffer, keeping it in use.
+ *
+ * Like <tt>\ref bprmv</tt>, but the slot is not given back to the Buffer
+ * Pool: the consumer keeps reading it and frees it later with
+ * <tt>\ref bpfree</tt>.
+ *
+ * \param bp The current Buffer Pool.
+ * \param po The Playout Buffer.
+ * \param index The slot to remove.
+ * \return 0, 1 if \c index is not the oldest element of the playout buffer.
+ * \see bprmv
+ * */
+int bpdetach(buffer_pool * bp, playout_buff * po, int index)
+{
+        struct timeval now;
+        uint32_t wait;
+        int i;
 
-        po->pocount--;
+        if (podel(po, index))
+                return 1;
 
-        bp->freelist[index] = bp->flhead;
-        bp->flhead = index;
-        bp->flcount--;
-        memset(bp->bufferpool + index, 0, sizeof(bp_slot));
+        if (!bp->stats.timing)
+                return 0;
 
-        pthread_cond_signal(&(bp->cond_full));
-        pthread_mutex_unlock(&(bp->fl_mutex));
-        pthread_mutex_unlock(&(po->po_mutex));
+        gettimeofday(&now, NULL);
+        wait = (uint32_t) now.tv_sec * 1000 + now.tv_usec / 1000
+                - po->pobuff[index].arrival;
+        for (i = 0; i < BP_HIST_BUCKETS - 1 && wait >= (1U << i); i++);
+        nms_atomic_add(&bp->stats.hist[i], 1);
 
         return 0;
 }
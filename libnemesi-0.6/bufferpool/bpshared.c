@@ -0,0 +1,186 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include "bufferpool.h"
+
+/*!
+ * \brief Shared Buffer Pool memory budget.
+ *
+ * When enabled, every Buffer Pool of the process takes its segments from a
+ * single budget of \c limit bytes. A pool can always grow up to the \c soft
+ * quota (as long as the budget is not exhausted), and up to the \c hard
+ * quota only while the memory left is not needed to honour the soft quota
+ * of the other pools: the part of their soft quota idle pools are not
+ * using is lent to the bursty ones.
+ * */
+static struct {
+        pthread_mutex_t mutex;
+        int enabled;
+        int pools;          /*!< Registered Buffer Pools. */
+        long limit;         /*!< Budget for all the pools. */
+        long soft;          /*!< Memory a pool can always get. */
+        long hard;          /*!< Memory a pool can never exceed. */
+        long used;          /*!< Memory allocated by all the pools. */
+        long reserved;      /*!< Soft quota not yet used by the pools. */
+} bpshared = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0, 0 };
+
+/* soft quota left to a pool holding bytes */
+#define BPSHARED_UNMET(bytes) \
+        ((bytes) < bpshared.soft ? bpshared.soft - (bytes) : 0)
+
+/*!
+ * \brief Enables the shared Buffer Pool budget for the whole process.
+ *
+ * It must be called before any RTSP session is set up: Buffer Pools
+ * initialized afterwards take their memory from the budget instead of
+ * growing up to \c BP_MAX_BYTES each.
+ *
+ * \param limit Total memory for all the Buffer Pools, in bytes.
+ * \param soft Memory each Buffer Pool is granted, in bytes.
+ * \param hard Memory no Buffer Pool can exceed, in bytes.
+ * \return 0, 1 if the quotas are not consistent or pools are already
+ * registered.
+ * \see bpinit
+ * \see bufferpool.h
+ * */
+int bpshared_init(long limit, long soft, long hard)
+{
+        int ret = 1;
+
+        if (soft < 0 || hard < soft || limit < hard)
+                return 1;
+
+        pthread_mutex_lock(&bpshared.mutex);
+        if (!bpshared.pools) {
+                bpshared.limit = limit;
+                bpshared.soft = soft;
+                bpshared.hard = hard;
+                bpshared.used = bpshared.reserved = 0;
+                bpshared.enabled = 1;
+                ret = 0;
+        }
+        pthread_mutex_unlock(&bpshared.mutex);
+
+        return ret;
+}
+
+/*!
+ * \brief Attaches a Buffer Pool to the shared budget, if enabled.
+ *
+ * \param bp The Buffer Pool, still empty.
+ * \return 0
+ * \see bpshared_unregister
+ * */
+int bpshared_register(buffer_pool * bp)
+{
+        pthread_mutex_lock(&bpshared.mutex);
+        if ((bp->shared = bpshared.enabled)) {
+                bpshared.pools++;
+                bpshared.reserved += bpshared.soft;
+        }
+        pthread_mutex_unlock(&bpshared.mutex);
+
+        return 0;
+}
+
+/*!
+ * \brief Detaches a Buffer Pool from the shared budget.
+ *
+ * All its segments must have been released.
+ *
+ * \param bp The Buffer Pool.
+ * \return 0
+ * \see bpshared_register
+ * */
+int bpshared_unregister(buffer_pool * bp)
+{
+        if (!bp->shared)
+                return 0;
+
+        pthread_mutex_lock(&bpshared.mutex);
+        bpshared.reserved -= BPSHARED_UNMET(bp->bytes);
+        bpshared.pools--;
+        pthread_mutex_unlock(&bpshared.mutex);
+        bp->shared = 0;
+
+        return 0;
+}
+
+/*!
+ * \brief Asks the shared budget for more memory.
+ *
+ * \param bp The Buffer Pool, \c bytes still holding the old size.
+ * \param len Memory requested, in bytes.
+ * \return 0 if granted, 1 otherwise.
+ * \see bpshared_release
+ * */
+int bpshared_alloc(buffer_pool * bp, long len)
+{
+        long bytes = bp->bytes + len;
+        long reserved;
+        int ret = 1;
+
+        pthread_mutex_lock(&bpshared.mutex);
+        reserved = bpshared.reserved - BPSHARED_UNMET(bp->bytes) +
+                BPSHARED_UNMET(bytes);
+        if (bytes <= bpshared.hard
+                        && (bpshared.used + len + reserved <= bpshared.limit
+                            || (bytes <= bpshared.soft
+                                && bpshared.used + len <= bpshared.limit))) {
+                bpshared.used += len;
+                bpshared.reserved = reserved;
+                ret = 0;
+        }
+        pthread_mutex_unlock(&bpshared.mutex);
+
+        return ret;
+}
+
+/*!
+ * \brief Gives memory back to the shared budget.
+ *
+ * \param bp The Buffer Pool, \c bytes still holding the old size.
+ * \param len Memory released, in bytes.
+ * \return 0
+ * \see bpshared_alloc
+ * */
+int bpshared_release(buffer_pool * bp, long len)
+{
+        pthread_mutex_lock(&bpshared.mutex);
+        bpshared.used -= len;
+        bpshared.reserved += BPSHARED_UNMET(bp->bytes - len) -
+                BPSHARED_UNMET(bp->bytes);
+        pthread_mutex_unlock(&bpshared.mutex);
+
+        return 0;
+}
+
+/*!
+ * \brief Tells whether a Buffer Pool holds more than its soft quota.
+ *
+ * \param bp The Buffer Pool.
+ * \return 1 if the pool is shared and above the soft quota, 0 otherwise.
+ * */
+int bpshared_over(buffer_pool * bp)
+{
+        return bp->shared && bp->bytes > bpshared.soft;
+}
@@ -0,0 +1,60 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include <errno.h>
+#include <sys/time.h>
+
+#include "bufferpool.h"
+
+/*!
+* \brief Waits for a slot to be given back to the Buffer Pool.
+*
+* \param bp The current Buffer Pool.
+* \param timeout Longest wait, in milliseconds.
+* \return 0 if a free slot is available, 1 on timeout.
+* \see bpget
+* \see bpfree
+* \see bufferpool.h
+* */
+int bpwait(buffer_pool * bp, int timeout)
+{
+        struct timeval now;
+        struct timespec ts;
+        int ret = 0;
+
+        gettimeofday(&now, NULL);
+        ts.tv_sec = now.tv_sec + timeout / 1000;
+        ts.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&(bp->fl_mutex));
+        while (bp->flhead == -1 && ret != ETIMEDOUT)
+                ret = pthread_cond_timedwait(&(bp->cond_full), &(bp->fl_mutex),
+                                             &ts);
+        ret = (bp->flhead == -1);
+        pthread_mutex_unlock(&(bp->fl_mutex));
+
+        return ret;
+}
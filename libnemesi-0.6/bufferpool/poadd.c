@@ -20,79 +20,108 @@
  *
  * */
 
-#include "rtp.h"
 #include "bufferpool.h"
+#include "utils.h"
+
+/* drops the queued packets the consumer is not using */
+static void poflush(playout_buff * po)
+{
+        uint32_t pos, head = po->head;
+        int cell;
+
+        nms_barrier();
+        for (pos = po->tail; pos != head; pos++) {
+                cell = po->ring[pos & po->mask];
+                if (cell < 0 || (cell & PO_HELD))
+                        continue;
+                if (nms_cas(&po->ring[pos & po->mask], cell, PO_DONE(pos))) {
+                        nms_atomic_sub(&po->pocount, 1);
+                        bpfree(po->bp, cell);
+                }
+        }
+}
 
 /*!
-* \brief Inserisce un elemento nel Buffer di Playout.
+* \brief Inserts an element in the Playout Buffer.
+*
+* Producer side of the playout buffer, called only by the RTP thread.
+* The packet is stored in the ring cell matching its extended sequence
+* number, so insertion, duplicate detection and reordering take constant
+* time and no lock is shared with the consumer.
+*
+* A sequence number that lands more than half the ring away from the newest
+* packet is considered a jump (source restart, seek, long loss). It is
+* refused as \c PKT_OVERRUN, unless the packet before was the previous one
+* of the new sequence: then the packets queued are flushed, since their
+* positions cannot be compared with the new ones, and the position is
+* re-anchored right after the newest packet. A lone stray packet does not
+* flush the queue.
 *
-* L'inserimento e' ordinato secondo il numero di sequenza del pacchetto RTP.
-* Si tratta di un normale inserimento in una lista doppio linkata con i
-* collegameti effettuati tramite gli indici del vettore.
+* The slot content and its \c pktlen MUST be set before calling it, since
+* the packet becomes visible to the consumer as soon as it is queued.
 *
-* \param po Il Buffer Pool corrente.
-* \param index L'indice dello slot allocato dalla poget.
-* \param cycles I cicli del campo \c SEQ dei pacchetti RTP.
-* \return 0
+* \param po The current Playout Buffer.
+* \param index The index of the slot obtained from bpget.
+* \param extseq The extended sequence number of the packet, as computed by
+* \c rtp_ext_seq.
+* \return 0, \c PKT_MISORDERED if the packet was reordered,
+* \c PKT_DUPLICATED, \c PKT_LATE if the consumer already went past it or
+* \c PKT_OVERRUN if it does not fit the ring or is a jump not confirmed
+* yet. In the last three
+* cases the slot is not queued and must be freed by the caller.
 * \see bpget
 * \see podel
 * \see bufferpool.h
 * */
-int poadd(playout_buff * po, int index, uint32_t cycles)
+int poadd(playout_buff * po, int index, uint64_t extseq)
 {
-        int i;
-        uint32_t cseq;
+        uint32_t cseq = (uint32_t) extseq, pos, tail;
+        int32_t delta;
+        int cell;
 
-        pthread_mutex_lock(&(po->po_mutex));
-
-        i = po->pohead;
-
-        cseq =
-                (uint32_t) ntohs(((rtp_pkt *) (*(po->bufferpool) + index))->seq) +
-                cycles;
-        while ((i != -1)
-                        && ((uint32_t) ntohs(((rtp_pkt *) (*(po->bufferpool) + i))->seq) +
-                            po->cycles > cseq)) {
-                i = po->pobuff[i].next;
+        if (!po->started) {
+                po->offset = po->head - cseq;
+                po->started = 1;
         }
-        if ((i != -1)
-                        && (cseq ==
-                            ((uint32_t) ntohs(((rtp_pkt *) (*(po->bufferpool) + i))->seq) +
-                             po->cycles))) {
-                pthread_mutex_unlock(&(po->po_mutex));
-                return PKT_DUPLICATED;
+
+        pos = cseq + po->offset;
+        delta = (int32_t) (pos - po->head);
+        if (delta > (int32_t) (po->size / 2)
+                        || delta < -(int32_t) (po->size / 2)) {
+                if (!po->jumped || cseq != po->jump_seq + 1) {
+                        po->jumped = 1;
+                        po->jump_seq = cseq;
+                        return PKT_OVERRUN;
+                }
+                poflush(po);
+                po->offset = po->head - cseq;
+                pos = po->head;
         }
-        if (i == po->pohead) {    /* inserimento in testa */
-                po->pobuff[index].next = i;
-                po->pohead = index;
-                if (i == -1)
-                        po->potail = index;
-                else
-                        po->pobuff[i].prev = index;
-                po->pobuff[index].prev = -1;
-                po->cycles = cycles;
+        po->jumped = 0;
 
-                po->pocount++;
-        } else {
-                if (i == -1) {    /* inserimento in coda */
-                        i = po->potail;
-                        po->potail = index;
-                } else        /* inserimento */
-                        po->pobuff[po->pobuff[i].next].prev = index;
+        nms_barrier();
+        tail = po->tail;
 
-                po->pobuff[index].next = po->pobuff[i].next;
-                po->pobuff[i].next = index;
-                po->pobuff[index].prev = i;
+        if ((int32_t) (pos - tail) < 0)
+                return PKT_LATE;
+        if (pos - tail >= po->size)
+                return PKT_OVERRUN;
 
-                po->pocount++;
+        do {
+                cell = po->ring[pos & po->mask];
+                if (cell >= 0)
+                        return PKT_DUPLICATED;
+                if (cell == PO_DONE(pos))
+                        return PKT_LATE;
+        } while (!nms_cas(&po->ring[pos & po->mask], cell, index));
 
-                pthread_mutex_unlock(&(po->po_mutex));
-                return PKT_MISORDERED;
-        }
+        nms_atomic_add(&po->pocount, 1);
 
-//      pthread_cond_signal(&(po->cond_empty));
+        if ((int32_t) (pos - po->head) < 0)
+                return PKT_MISORDERED;
 
-        pthread_mutex_unlock(&(po->po_mutex));
+        nms_barrier();
+        po->head = pos + 1;
 
         return 0;
 }
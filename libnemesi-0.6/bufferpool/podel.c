@@ -21,40 +21,42 @@
  * */
 
 #include "bufferpool.h"
+#include "utils.h"
 
 /*!
 * \brief Rimuove un elemento dal Buffer di Playout.
 *
-* La funzione gestisce solo la rimozione dal vettore del Buffer di Playout, ma
+* La funzione gestisce solo la rimozione dal Buffer di Playout, ma
 * non si occupa di reinserire l'elemento liberato nella free list.  Questa
 * azione compete al Buffer Pool e non al Buffer di Playout, quindi dovr essere
 * effettuata tramite la funzione <tt>\ref bpfree</tt>.  La \c podel non sar
 * mai chiamata direttamente all'interno di \em NeMeSI, ma solo attraverso la
 * <tt>\ref bprmv</tt>.
 *
+* Consumer side: only the oldest queued element, as returned by
+* <tt>\ref popeek</tt>, can be removed.
+*
 * \param po Il puntatore al Buffer di Playout corrente.
 * \param index L'indice dell'elemento da rimuovere.
-* \return 0
+* \return 0, 1 if \c index is not the oldest queued element.
 * \see bpfree
 * \see bprmv
 * \see bufferpool.h
 * */
 int podel(playout_buff * po, int index)
 {
-        pthread_mutex_lock(&(po->po_mutex));
+        uint32_t tail = po->tail;
+        int cell = po->ring[tail & po->mask];
 
-        if (po->pobuff[index].next != -1)
-                po->pobuff[po->pobuff[index].next].prev = po->pobuff[index].prev;
-        else
-                po->potail = po->pobuff[index].prev;
-        if (po->pobuff[index].prev != -1)
-                po->pobuff[po->pobuff[index].prev].next = po->pobuff[index].next;
-        else
-                po->pohead = po->pobuff[index].next;
+        if (cell < 0 || PO_INDEX(cell) != index
+                        || !nms_cas(&po->ring[tail & po->mask], cell,
+                                    PO_DONE(tail)))
+                return 1;
 
-        po->pocount--;
+        nms_atomic_sub(&po->pocount, 1);
 
-        pthread_mutex_unlock(&(po->po_mutex));
+        nms_barrier();
+        po->tail = tail + 1;
 
         return 0;
 }
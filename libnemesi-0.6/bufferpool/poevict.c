@@ -0,0 +1,56 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include "bufferpool.h"
+#include "utils.h"
+
+/*!
+* \brief Evicts the oldest packet the consumer is not using.
+*
+* Producer side of the playout buffer, used when the Buffer Pool is full.
+* Packets handed to the application by <tt>\ref popeek</tt> are held and
+* never evicted, so the pointers it got stay valid.
+*
+* \param po The current Playout Buffer.
+* \return The slot index of the evicted packet, to be given back with
+* <tt>\ref bpfree</tt>, or -1 if there is none.
+* \see popeek
+* \see bufferpool.h
+* */
+int poevict(playout_buff * po)
+{
+        uint32_t pos, head = po->head;
+        int cell;
+
+        nms_barrier();
+        for (pos = po->tail; pos != head; pos++) {
+                cell = po->ring[pos & po->mask];
+                if (cell < 0 || (cell & PO_HELD))
+                        continue;
+                if (nms_cas(&po->ring[pos & po->mask], cell, PO_DONE(pos))) {
+                        nms_atomic_sub(&po->pocount, 1);
+                        return cell;
+                }
+        }
+
+        return -1;
+}
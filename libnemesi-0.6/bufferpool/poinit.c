@@ -25,42 +25,46 @@
 /*!
  * \brief Inizializza il Buffer di Playout.
  *
+ * The ring has \c PO_RING_SIZE cells whatever the reorder window, which
+ * only tells how late a misordered packet can be: it does not bound the
+ * packets queued.
+ *
  * \param po Il puntatore al Buffer di Playout.
  * \param bp Il puntatore il Buffer Pool.
- * \return 0
+ * \param window Reorder window in packets, 0 for \c PO_DEFAULT_WINDOW,
+ * at most \c PO_MAX_WINDOW.
+ * \return 0, 1 if the ring could not be allocated.
+ * \see pokill
  * \see poadd
  * \see podel
  * \see bufferpool.h
  * */
-int poinit(playout_buff * po, buffer_pool * bp)
+int poinit(playout_buff * po, buffer_pool * bp, unsigned window)
 {
-        pthread_mutexattr_t mutex_attr;
-        pthread_condattr_t cond_attr;
-        int i;
+        uint32_t i;
 
-        po->bufferpool = &(bp->bufferpool);
-        po->pohead = po->potail = -1;
-        po->cycles = 0;
-        po->pocount = 0;
+        if (!window)
+                window = PO_DEFAULT_WINDOW;
+        else if (window > PO_MAX_WINDOW)
+                window = PO_MAX_WINDOW;
+
+        po->window = window;
+        po->size = PO_RING_SIZE;
+        po->mask = po->size - 1;
 
-        if ((i = pthread_mutexattr_init(&mutex_attr)) > 0)
-                return i;
-#if 0
-#ifdef    _POSIX_THREAD_PROCESS_SHARED
-        if ((i =
-                                pthread_mutexattr_setpshared(&mutex_attr,
-                                                             PTHREAD_PROCESS_SHARED)) > 0)
-                return i;
-#endif
-#endif
-        if ((i = pthread_mutex_init(&(po->po_mutex), &mutex_attr)) > 0)
-                return i;
+        if (!(po->ring = malloc(po->size * sizeof(int))))
+                return 1;
+
+        po->segments = bp->segments;
+        po->bp = bp;
+        po->head = po->tail = 0;
+        po->offset = 0;
+        po->started = 0;
+        po->jumped = 0;
+        po->pocount = 0;
 
-        // cond initialization
-        if ((i = pthread_condattr_init(&cond_attr)) > 0)
-                return i;
-//      if ( (i = pthread_cond_init(&(po->cond_empty), &cond_attr) ) > 0)
-//              return i;
+        for (i = 0; i < po->size; i++)
+                po->ring[i] = PO_EMPTY;
 
         return 0;
 }
@@ -0,0 +1,42 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include "bufferpool.h"
+
+/*!
+* \brief Releases the Playout Buffer.
+*
+* Frees the ring allocated by <tt>\ref poinit</tt>. The slots still queued
+* are not given back to the Buffer Pool: use it only when the Buffer Pool is
+* going to be destroyed too, or after the queue has been drained.
+*
+* \param po The Playout Buffer to release.
+* \return 0
+* \see poinit
+* \see bufferpool.h
+* */
+int pokill(playout_buff * po)
+{
+        free((void *) po->ring);
+        po->ring = NULL;
+        return 0;
+}
@@ -0,0 +1,115 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include <sys/time.h>
+
+#include "bufferpool.h"
+#include "utils.h"
+
+/* tells if the packet missing at tail is not worth waiting for anymore:
+ * more packets than the reorder window came after it, or the first one
+ * of them waited for longer than PO_HOLE_WAIT */
+static int pohole_expired(playout_buff * po, uint32_t tail, uint32_t head)
+{
+        struct timeval now;
+        uint32_t pos;
+        int cell = -1;
+
+        if (head - tail - 1 > po->window)
+                return 1;
+
+        for (pos = tail + 1; pos != head; pos++)
+                if ((cell = po->ring[pos & po->mask]) >= 0)
+                        break;
+        if (cell < 0)
+                return 0;
+
+        gettimeofday(&now, NULL);
+
+        return (uint32_t) now.tv_sec * 1000 + now.tv_usec / 1000
+                - po->pobuff[PO_INDEX(cell)].arrival >= PO_HOLE_WAIT;
+}
+
+/*!
+* \brief Returns the n-th oldest element of the Playout Buffer.
+*
+* Consumer side of the playout buffer. A position still missing in front
+* of the oldest queued packet is waited for, as long as no more packets
+* than the reorder window are queued after it and the first of them did
+* not wait for \c PO_HOLE_WAIT msec: nothing is returned meanwhile. Then
+* it is given up, and a misordered packet arriving later is reported as
+* late by <tt>\ref poadd</tt>. Packets evicted leave no hole.
+*
+* The element returned is marked as held, so that <tt>\ref poevict</tt>
+* leaves it alone until it is removed with <tt>\ref podel</tt>.
+*
+* \param po The current Playout Buffer.
+* \param n How many queued elements to skip, 0 for the oldest one.
+* \return The slot index of the element or -1 if there is none.
+* \see poadd
+* \see podel
+* \see bufferpool.h
+* */
+int popeek(playout_buff * po, unsigned n)
+{
+        uint32_t tail, head, pos;
+        int cell;
+
+        for (;;) {
+                tail = po->tail;
+                head = po->head;
+                nms_barrier();
+
+                if (tail == head)
+                        return -1;
+
+                cell = po->ring[tail & po->mask];
+                if (cell >= 0)
+                        break;
+
+                /* hole: the producer may still be filling it */
+                if (cell != PO_DONE(tail) && !pohole_expired(po, tail, head))
+                        return -1;
+                if (nms_cas(&po->ring[tail & po->mask], cell,
+                            PO_DONE(tail))) {
+                        nms_barrier();
+                        po->tail = tail + 1;
+                }
+        }
+
+        for (pos = tail; pos != head; pos++) {
+                cell = po->ring[pos & po->mask];
+                if (cell < 0)
+                        continue;
+                if (n) {
+                        n--;
+                        continue;
+                }
+                /* on failure it has just been evicted, look further */
+                if ((cell & PO_HELD)
+                                || nms_cas(&po->ring[pos & po->mask], cell,
+                                           cell | PO_HELD))
+                        return PO_INDEX(cell);
+        }
+
+        return -1;
+}
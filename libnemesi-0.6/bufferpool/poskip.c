@@ -0,0 +1,55 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include "bufferpool.h"
+#include "utils.h"
+
+/*!
+* \brief Gives up the packet missing at the front of the Playout Buffer.
+*
+* Consumer side of the playout buffer, for when the queue must be drained
+* at once: <tt>\ref popeek</tt> would wait for the missing packet.
+*
+* \param po The current Playout Buffer.
+* \return 0, 1 if the front of the buffer is not missing.
+* \see popeek
+* \see bufferpool.h
+* */
+int poskip(playout_buff * po)
+{
+        uint32_t tail = po->tail;
+        int cell;
+
+        nms_barrier();
+        if (tail == po->head)
+                return 1;
+
+        cell = po->ring[tail & po->mask];
+        if (cell >= 0 || !nms_cas(&po->ring[tail & po->mask], cell,
+                                  PO_DONE(tail)))
+                return 1;
+
+        nms_barrier();
+        po->tail = tail + 1;
+
+        return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Bufferpool microbenchmark: per packet cost of a bpget/bpfree cycle with
+ * the packet written like the RTP receiver does, compared with the same
+ * cycle plus the full slot clear bpfree used to do.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "bufferpool.h"
+
+/* slots kept queued, like a playout buffer in steady state */
+#define BENCH_QUEUED (BP_SLOT_NUM / 2)
+
+static double bench(buffer_pool * bp, long iterations, int pktlen, int clear)
+{
+        int queued[BENCH_QUEUED];
+        struct timeval start, stop;
+        long i;
+        int slot;
+
+        for (i = 0; i < BENCH_QUEUED; i++)
+                queued[i] = bpget(bp);
+
+        gettimeofday(&start, NULL);
+        for (i = 0; i < iterations; i++) {
+                slot = bpget(bp);
+                memset(BP_SLOT(bp, slot), (int) i, pktlen);
+
+                bpfree(bp, queued[i % BENCH_QUEUED]);
+                if (clear)
+                        memset(BP_SLOT(bp, queued[i % BENCH_QUEUED]), 0,
+                               bp->slot_size);
+                queued[i % BENCH_QUEUED] = slot;
+        }
+        gettimeofday(&stop, NULL);
+
+        for (i = 0; i < BENCH_QUEUED; i++)
+                bpfree(bp, queued[i]);
+
+        return ((stop.tv_sec - start.tv_sec) * 1e9 +
+                (stop.tv_usec - start.tv_usec) * 1e3) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+        int opt;
+        long iterations = 1000000;
+        int pktlen = 1400;
+        int mem_flags = 0;
+        buffer_pool bp;
+
+        while ((opt = getopt(argc, argv, "n:s:hl")) != -1) {
+                switch (opt) {
+                        /*  Set number of packets  */
+                case 'n':
+                        iterations = atol(optarg);
+                        break;
+                        /*  Set packet size  */
+                case 's':
+                        pktlen = atoi(optarg);
+                        break;
+                        /*  Back the slots with huge pages  */
+                case 'h':
+                        mem_flags |= BP_MEM_HUGEPAGES;
+                        break;
+                        /*  Lock the slots in memory  */
+                case 'l':
+                        mem_flags |= BP_MEM_MLOCK;
+                        break;
+                        /* Unknown option  */
+                case '?':
+                        fprintf(stderr,
+                                "\tUsage: %s [-n packets] [-s packet_size] [-h] [-l]\n",
+                                argv[0]);
+                        return 1;
+                }
+        }
+
+        if (iterations <= 0 || pktlen <= 0 || pktlen > BP_MAX_SLOT_SIZE) {
+                fprintf(stderr, "\tPacket size must be in 1..%d\n",
+                        BP_MAX_SLOT_SIZE);
+                return 1;
+        }
+
+        if (bpinit(&bp, pktlen, mem_flags)) {
+                fprintf(stderr, "\tCannot initialize the bufferpool\n");
+                return 1;
+        }
+
+        /* warm up */
+        bench(&bp, iterations / 10 + 1, pktlen, 0);
+
+        printf("%ld packets of %d bytes, %d slots of %d bytes%s%s\n",
+               iterations, pktlen, bp.size, bp.slot_size,
+               bp.arena ? ", huge page arena" : "",
+               (mem_flags & BP_MEM_MLOCK) ? ", mlocked" : "");
+#ifdef BP_CLEAR_SLOTS
+        printf("NOTE: built with BP_CLEAR_SLOTS, bpfree clears slots itself\n");
+#endif
+        printf("dirty slots: %8.1f ns/packet\n",
+               bench(&bp, iterations, pktlen, 0));
+        printf("slot clear:  %8.1f ns/packet\n",
+               bench(&bp, iterations, pktlen, 1));
+
+        bpkill(&bp);
+
+        return 0;
+}
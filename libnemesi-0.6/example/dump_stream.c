@@ -25,11 +25,26 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "rtsp.h"
 #include "rtp.h"
 #include "sdp.h"
 
+/* writes a frame described in place, IOV_MAX pieces at a time */
+static int write_iov(int fd, rtp_frame_iov * fr)
+{
+        int i, n;
+
+        for (i = 0; i < fr->iovcnt; i += n) {
+                n = fr->iovcnt - i < IOV_MAX ? fr->iovcnt - i : IOV_MAX;
+                if (writev(fd, fr->iov + i, n) < 0)
+                        return 1;
+        }
+
+        return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -43,16 +58,18 @@ int main(int argc, char **argv)
         rtp_ssrc *ssrc;
         rtp_buff conf;
         rtp_frame fr;
+        rtp_frame_iov fri;
+        int zerocopy = 0;
         nms_rtsp_hints rtsp_hints = { -1 };
 
         if (argc < 2) {
                 fprintf(stderr, "\tPlease specify at least an url.\n");
-                fprintf(stderr, "\tUsage: %s [-f basename ][-p port][-t][-s][-b prebuf] url\n",
+                fprintf(stderr, "\tUsage: %s [-f basename ][-p port][-t][-s][-z][-b prebuf] url\n",
                         argv[0]);
                 exit(1);
         }
 
-        while ((opt = getopt(argc, argv, "f:p:b:ts")) != -1) {
+        while ((opt = getopt(argc, argv, "f:p:b:tsz")) != -1) {
                 switch (opt) {
 				case 'f':  /*  Set output file  */
                         base = strdup(optarg);
@@ -69,7 +86,10 @@ int main(int argc, char **argv)
                         rtsp_hints.pref_rtsp_proto = SCTP;
                         rtsp_hints.pref_rtp_proto = SCTP;
                         break;
-				case 'b': /* Prebuffer size */
+		                case 'z': /* Write the frames from the bufferpool */
+                        zerocopy = 1;
+                        break;
+		case 'b': /* Prebuffer size */
                         rtsp_hints.prebuffer_size = atoi(optarg);
                         break;
                 case '?': /* Unknown option */
@@ -83,6 +103,7 @@ int main(int argc, char **argv)
         }
 
         memset(outfd, 0, sizeof(outfd));
+        memset(&fri, 0, sizeof(fri));
 
         url = argv[argc - 1];
 
@@ -114,8 +135,22 @@ int main(int argc, char **argv)
 
         rtp_th = rtsp_get_rtp_th(ctl);
         while (!rtp_fill_buffers(rtp_th)) {  // Till there is something to parse
-        	// Foreach ssrc active
-                for (ssrc=rtp_active_ssrc_queue(rtsp_get_rtp_queue(ctl)); ssrc; ssrc=rtp_next_active_ssrc(ssrc)) {
+        	// Sleep until an active ssrc has a frame
+                if ((ssrc = rtp_wait_frames(rtp_th, 100)) && zerocopy) {
+                        memset(&conf, 0, sizeof(conf));
+                        if (!rtp_fill_buffer_iov(ssrc, &fri, &conf)) {
+                                if (!outfd[fri.pt]) {
+                                        sprintf(out, "%s.%d", base, fri.pt);
+                                        if ((outfd[fri.pt] = creat(out, 00644)) < 0
+                                                        || write(outfd[fri.pt], conf.data,
+                                                                 conf.len) < conf.len)
+                                                return 1;
+                                }
+                                if (write_iov(outfd[fri.pt], &fri))
+                                        return 1;
+                                rtp_frame_iov_release(&fri);
+                        }
+                } else if (ssrc) {
                         if (!rtp_fill_buffer(ssrc, &fr, &conf)) {    // Parse the stream
                                 if (outfd[fr.pt] ||    // Write it to a file
                                                 sprintf(out, "%s.%d", base, fr.pt)
@@ -149,6 +184,7 @@ int main(int argc, char **argv)
 
         fprintf(stderr, " Complete\n");
 
+        rtp_frame_iov_free(&fri);
         free(out);
 
         rtsp_close(ctl);
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Depacketizer benchmark: per packet cost of the parser of an encoding,
+ * copying and in place, over the RTP packets of an rtpdump capture
+ * (rtptools format) replayed from memory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "rtp.h"
+#include "rtpptdefs.h"
+#include "bufferpool.h"
+#include "parsers/rtpparsers.h"
+
+#define RTPDUMP_MAGIC "#!rtpplay1.0 "
+#define RTPDUMP_HDR_LEN 16      /* start time, source address and port */
+#define RTPDUMP_PKT_HDR_LEN 8   /* length, packet length and offset */
+
+typedef struct {
+        uint8_t *data;
+        int len;
+} bench_pkt;
+
+static bench_pkt *pkts;
+static int npkts;
+static long nbytes;
+static int max_len;
+static uint64_t seq;    /* extended sequence number of the next packet queued */
+
+/**
+ * Loads the RTP packets of an rtpdump capture, skipping the RTCP ones.
+ *
+ * @return 0 on success, 1 on errors
+ */
+static int load_rtpdump(const char *path)
+{
+        char line[256];
+        uint8_t hdr[RTPDUMP_PKT_HDR_LEN];
+        bench_pkt *p;
+        int size = 0, len, plen;
+        FILE *f;
+
+        if (!(f = fopen(path, "rb")))
+                return 1;
+
+        if (!fgets(line, sizeof(line), f)
+                        || strncmp(line, RTPDUMP_MAGIC, strlen(RTPDUMP_MAGIC))
+                        || fseek(f, RTPDUMP_HDR_LEN, SEEK_CUR))
+                goto err;
+
+        while (fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr)) {
+                len = ((hdr[0] << 8) | hdr[1]) - RTPDUMP_PKT_HDR_LEN;
+                plen = (hdr[2] << 8) | hdr[3];
+                if (len < 0)
+                        goto err;
+                if (!plen || plen > len) {      // RTCP
+                        if (fseek(f, len, SEEK_CUR))
+                                goto err;
+                        continue;
+                }
+                if (npkts == size) {
+                        size = size ? size * 2 : 1024;
+                        if (!(p = realloc(pkts, size * sizeof(bench_pkt))))
+                                goto err;
+                        pkts = p;
+                }
+                if (!(pkts[npkts].data = malloc(len))
+                                || fread(pkts[npkts].data, 1, len, f) != len)
+                        goto err;
+                pkts[npkts].len = plen;
+                nbytes += plen;
+                if (plen > max_len)
+                        max_len = plen;
+                npkts++;
+        }
+        fclose(f);
+
+        return !npkts;
+
+err:
+        fclose(f);
+        return 1;
+}
+
+/**
+ * Queues a packet of the capture like the RTP receiver does.
+ */
+static void bench_queue(rtp_ssrc * stm_src, bench_pkt * p)
+{
+        buffer_pool *bp = stm_src->rtp_sess->bp;
+        int slot, err;
+
+        if ((slot = bpget(bp)) < 0)
+                return;
+        memcpy(BP_SLOT(bp, slot), p->data, p->len);
+        stm_src->po->pobuff[slot].pktlen = p->len;
+        if ((err = poadd(stm_src->po, slot, seq++)) && err != PKT_MISORDERED)
+                bpfree(bp, slot);
+}
+
+/**
+ * Replays the capture through the parser, the copying one or the one
+ * describing the frames in place.
+ *
+ * @return the cost in ns per packet
+ */
+static double bench(rtp_ssrc * stm_src, unsigned pt, int passes, int iov,
+                    long *frames)
+{
+        rtp_session *rtp_sess = stm_src->rtp_sess;
+        struct timeval start, stop;
+        rtp_frame fr;
+        rtp_frame_iov fr_iov;
+        rtp_buff config;
+        int i, n, err;
+
+        memset(&fr_iov, 0, sizeof(fr_iov));
+        fr_iov.pt = pt;
+        *frames = 0;
+
+        gettimeofday(&start, NULL);
+        for (n = 0; n < passes; n++) {
+                for (i = 0; i < npkts; i++) {
+                        bench_queue(stm_src, &pkts[i]);
+                        do {
+                                memset(&config, 0, sizeof(config));
+                                if (iov) {
+                                        err = rtp_sess->parsers_iov[pt] (stm_src, &fr_iov,
+                                                                         &config);
+                                        if (err == RTP_FILL_OK)
+                                                rtp_frame_iov_release(&fr_iov);
+                                } else {
+                                        memset(&fr, 0, sizeof(fr));
+                                        fr.pt = pt;
+                                        err = rtp_sess->parsers[pt] (stm_src, &fr, &config);
+                                }
+                                if (err == RTP_FILL_OK)
+                                        (*frames)++;
+                        } while (err != RTP_BUFF_EMPTY);
+                }
+        }
+        gettimeofday(&stop, NULL);
+
+        rtp_frame_iov_free(&fr_iov);
+
+        return ((stop.tv_sec - start.tv_sec) * 1e9 +
+                (stop.tv_usec - start.tv_usec) * 1e3) / ((double) passes * npkts);
+}
+
+static void report(const char *name, double ns, long frames, int passes)
+{
+        printf("%s %8.1f ns/packet %8.1f MB/s, %ld frames\n", name, ns,
+               nbytes / (double) npkts / ns * 1e3, frames / passes);
+}
+
+int main(int argc, char **argv)
+{
+        int opt, passes = 100, access_units = 0;
+        int pt = -1;
+        char *enc = "H265", *fmtp = NULL;
+        rtp_session *rtp_sess;
+        rtp_ssrc *stm_src;
+        long frames;
+        double ns;
+
+        while ((opt = getopt(argc, argv, "e:p:n:a:u")) != -1) {
+                switch (opt) {
+                        /*  Set encoding name  */
+                case 'e':
+                        enc = optarg;
+                        break;
+                        /*  Set payload type  */
+                case 'p':
+                        pt = atoi(optarg);
+                        break;
+                        /*  Set number of passes  */
+                case 'n':
+                        passes = atoi(optarg);
+                        break;
+                        /*  Set fmtp attribute, as in the sdp  */
+                case 'a':
+                        fmtp = optarg;
+                        break;
+                        /*  Hand out whole access units  */
+                case 'u':
+                        access_units = 1;
+                        break;
+                        /* Unknown option  */
+                case '?':
+                        optind = argc;
+                        break;
+                }
+        }
+
+        if (optind >= argc || passes <= 0) {
+                fprintf(stderr,
+                        "\tUsage: %s [-e encoding] [-p payload_type] [-n passes] "
+                        "[-a fmtp] [-u] capture.rtp\n", argv[0]);
+                return 1;
+        }
+
+        if (load_rtpdump(argv[optind])) {
+                fprintf(stderr, "\tCannot load rtpdump capture %s\n", argv[optind]);
+                return 1;
+        }
+        if (pt < 0)
+                pt = pkts[0].data[1] & 0x7f;
+        if (pt < 96 || pt > 127 || max_len > BP_MAX_SLOT_SIZE) {
+                fprintf(stderr, "\tPayload type must be dynamic, packets "
+                        "at most %d bytes\n", BP_MAX_SLOT_SIZE);
+                return 1;
+        }
+
+        rtp_sess = calloc(1, sizeof(rtp_session));
+        stm_src = calloc(1, sizeof(rtp_ssrc));
+        if (!rtp_sess || !stm_src
+                        || !(rtp_sess->bp = calloc(1, sizeof(buffer_pool)))
+                        || !(stm_src->po = calloc(1, sizeof(playout_buff)))
+                        || bpinit(rtp_sess->bp, max_len, 0)
+                        || poinit(stm_src->po, rtp_sess->bp, PO_DEFAULT_WINDOW)) {
+                fprintf(stderr, "\tCannot allocate memory\n");
+                return 1;
+        }
+        stm_src->rtp_sess = rtp_sess;
+        rtp_set_access_units(rtp_sess, access_units);
+
+        rtp_parsers_init();
+        rtpptdefs_new(rtp_sess->ptdefs);
+        rtp_parsers_new(rtp_sess->parsers, rtp_sess->parsers_inits,
+                        rtp_sess->parsers_uninits, rtp_sess->parsers_frees);
+        if (rtp_announce_pt(rtp_sess, pt, VI) || rtp_dynpt_reg(rtp_sess, pt, enc)
+                        || (fmtp && rtp_pt_attr_add(rtp_sess->ptdefs, pt, fmtp))
+                        || (rtp_sess->parsers_inits[pt]
+                            && rtp_sess->parsers_inits[pt] (rtp_sess, pt))) {
+                fprintf(stderr, "\tCannot set up the %s parser\n", enc);
+                return 1;
+        }
+
+        printf("%d packets, %ld bytes of %s, %d passes\n", npkts, nbytes,
+               enc, passes);
+
+        /* warm up */
+        bench(stm_src, pt, 1, 0, &frames);
+
+        ns = bench(stm_src, pt, passes, 0, &frames);
+        report("copy:    ", ns, frames, passes);
+        if (rtp_sess->parsers_iov[pt]) {
+                ns = bench(stm_src, pt, passes, 1, &frames);
+                report("in place:", ns, frames, passes);
+        } else
+                printf("in place: not supported by the %s parser\n", enc);
+
+        if (rtp_sess->parsers_uninits[pt])
+                rtp_sess->parsers_uninits[pt] (stm_src, pt);
+        if (rtp_sess->parsers_frees[pt])
+                rtp_sess->parsers_frees[pt] (rtp_sess, pt);
+        bpkill(rtp_sess->bp);
+
+        return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Records every stream of an url to files, like dump_stream, but with
+ * the frames pushed by the RTP thread. The callback must not block, so
+ * it only queues a copy of each frame: the main thread writes them out.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "rtsp.h"
+#include "rtp.h"
+
+typedef struct rec_frame {
+        struct rec_frame *next;
+        int pt;
+        long conf_len;          /* config to write before the first frame */
+        long len;
+        char data[1];           /* conf_len bytes of config, len of frame */
+} rec_frame;
+
+static char *base = "record_nms";
+static int outfd[128];
+static int seen[128];           /* RTP thread only */
+
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rec_cond = PTHREAD_COND_INITIALIZER;
+static rec_frame *rec_head, **rec_tail = &rec_head;
+
+/* runs on the RTP thread: the frame is only valid until we return */
+static void queue_frame(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * conf,
+                        void *arg)
+{
+        long conf_len = seen[fr->pt] ? 0 : conf->len;
+        rec_frame *rf;
+
+        if (!(rf = malloc(sizeof(rec_frame) + conf_len + fr->len)))
+                return;
+        seen[fr->pt] = 1;
+        rf->next = NULL;
+        rf->pt = fr->pt;
+        rf->conf_len = conf_len;
+        rf->len = fr->len;
+        memcpy(rf->data, conf->data, conf_len);
+        memcpy(rf->data + conf_len, fr->data, fr->len);
+
+        pthread_mutex_lock(&rec_lock);
+        *rec_tail = rf;
+        rec_tail = &rf->next;
+        pthread_cond_signal(&rec_cond);
+        pthread_mutex_unlock(&rec_lock);
+}
+
+static void write_frame(rec_frame * rf)
+{
+        char out[256];
+
+        snprintf(out, sizeof(out), "%s.%d", base, rf->pt);
+        if (!outfd[rf->pt] && (outfd[rf->pt] = creat(out, 00644)) < 0) {
+                outfd[rf->pt] = 0;
+                return;
+        }
+
+        if (write(outfd[rf->pt], rf->data, rf->conf_len + rf->len)
+                        < rf->conf_len + rf->len)
+                fprintf(stderr, "Cannot write %s\n", out);
+}
+
+/* takes the queued frames, waiting up to a second for some */
+static rec_frame *take_frames(void)
+{
+        struct timeval now;
+        struct timespec ts;
+        rec_frame *rf;
+
+        gettimeofday(&now, NULL);
+        ts.tv_sec = now.tv_sec + 1;
+        ts.tv_nsec = now.tv_usec * 1000;
+
+        pthread_mutex_lock(&rec_lock);
+        if (!rec_head)
+                pthread_cond_timedwait(&rec_cond, &rec_lock, &ts);
+        rf = rec_head;
+        rec_head = NULL;
+        rec_tail = &rec_head;
+        pthread_mutex_unlock(&rec_lock);
+
+        return rf;
+}
+
+static void write_frames(rec_frame * rf)
+{
+        rec_frame *next;
+
+        for (; rf; rf = next) {
+                next = rf->next;
+                write_frame(rf);
+                free(rf);
+        }
+}
+
+int main(int argc, char **argv)
+{
+        int opt, i;
+        char *url;
+        rtsp_ctrl *ctl;
+        rtp_thread *rtp_th;
+        rtp_session *rtp_sess;
+        nms_rtsp_hints rtsp_hints = { -1 };
+
+        while ((opt = getopt(argc, argv, "f:p:t")) != -1) {
+                switch (opt) {
+                case 'f':  /*  Set output file  */
+                        base = strdup(optarg);
+                        break;
+                case 'p': /* Set rtp port */
+                        rtsp_hints.first_rtp_port = atoi(optarg);
+                        break;
+                case 't': /* Force TCP interleaved */
+                        rtsp_hints.pref_rtsp_proto = TCP;
+                        rtsp_hints.pref_rtp_proto = TCP;
+                        break;
+                default:
+                        optind = argc;
+                        break;
+                }
+        }
+
+        if (optind >= argc) {
+                fprintf(stderr, "\tUsage: %s [-f basename ][-p port][-t] url\n",
+                        argv[0]);
+                return 1;
+        }
+        url = argv[argc - 1];
+
+        if ((ctl = rtsp_init(&rtsp_hints)) == NULL) {
+                fprintf(stderr, "Cannot init rtsp.\n");
+                return 1;
+        }
+
+        if (rtsp_open(ctl, url)) {
+                fprintf(stderr, "rtsp_open failed.\n");
+                return 1;
+        }
+        rtsp_wait(ctl);
+
+        // Push the frames of every medium, before they start flowing
+        for (rtp_sess = rtsp_get_rtp_queue(ctl); rtp_sess; rtp_sess = rtp_sess->next)
+                rtp_set_frame_cb(rtp_sess, queue_frame, NULL);
+
+        rtsp_play(ctl, 0.0, 0.0);
+        rtsp_wait(ctl);
+
+        fprintf(stderr, "\nRecording...");
+
+        // Write what the RTP thread queues till the end of the stream
+        rtp_th = rtsp_get_rtp_th(ctl);
+        while (!rtp_fill_buffers(rtp_th))
+                write_frames(take_frames());
+
+        fprintf(stderr, " Complete\n");
+
+        rtsp_close(ctl);
+        rtsp_wait(ctl);
+
+        rtsp_uninit(ctl);
+        write_frames(rec_head);
+
+        for (i = 0; i < 128; i++)
+                if (outfd[i])
+                        close(outfd[i]);
+
+        return 0;
+}
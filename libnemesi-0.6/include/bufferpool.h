@@ -28,8 +28,8 @@
  *
  * \brief Memory handling.
  *
- * \b bufferpool consists in functions to manipulate statically allocated
- * fixed size slots of memory.
+ * \b bufferpool consists in functions to manipulate preallocated
+ * slots of memory, grouped in segments of a single size class.
  *
  * It also contains the high level functions to manage the playout buffer and
  * the RTP packets queue.
@@ -50,73 +50,180 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include "nmsatomic.h"
+
 /*! The number of slots consisting the Playout Buffer. */            /* #define BP_SLOT_NUM 50 */
 /* 1000ms / 20ms = Playout Buffer Size (in seconds) / Required RTP payload size (in seconds) */
 #define BP_SLOT_NUM 150        // Bigger buffer. For video needs.
 
-/*! Slot size.  Derived from <em>"Minimum Reassembly Buffer Size"</em> IPv4: the maximal dimension of non fragmented packets */
+/*! Slot size classes, in bytes.
+ * A Buffer Pool uses the smallest class that fits its stream, chosen from
+ * the media type announced in the SDP and raised when a bigger packet is
+ * received. Sizes are multiples of 64 bytes to keep the slots cache line
+ * aligned. */
+#define BP_CLASS_AUDIO  256     /* G.711 20ms, small AMR/Speex frames */
+#define BP_CLASS_SMALL  512     /* G.711 up to 60ms, AAC at low rates */
+#define BP_CLASS_MTU    1536    /* anything fitting a 1500 bytes MTU */
+#define BP_CLASS_JUMBO  9216    /* 9000 bytes MTU jumbo frames */
 
-/*#define BP_SLOT_SIZE 548 *//* 576 - 20 - 8 = Minimum Reassembly Buffer Size - IP datagram header -  UDP hedaer */
-#define BP_SLOT_SIZE 2048    /* bigger slot */
+/*! Biggest packet a Buffer Pool can hold. */
+#define BP_MAX_SLOT_SIZE BP_CLASS_JUMBO
 
-/*! Buffer Pool size */
-#define BP_SIZE BP_SLOT_NUM*BP_SLOT_SIZE    /* 1 sec G.711 - 8kHz * 8bit
-per sample */
+/*! Old fixed slot size, still used as memory budget unit. */
+#define BP_SLOT_SIZE 2048
 
 #define BP_MAX_SIZE BP_SLOT_NUM*50
 
+/*! Most memory a Buffer Pool may allocate: the same as \c BP_MAX_SIZE
+ * slots of \c BP_SLOT_SIZE bytes. */
+#define BP_MAX_BYTES (BP_MAX_SIZE * BP_SLOT_SIZE)
+
+/*! The Buffer Pool grows by segments of \c BP_SLOT_NUM slots, never moved
+ * once allocated. */
+#define BP_MAX_SEGMENTS (BP_MAX_SIZE / BP_SLOT_NUM)
+
+/*! Back the slots with huge pages, prefaulted. */
+#define BP_MEM_HUGEPAGES 0x1
+/*! Lock the slots in memory. */
+#define BP_MEM_MLOCK     0x2
+/*! Keep \c BP_HEADROOM bytes in front of every slot, for the receive
+ * engines writing a header before the packet. */
+#define BP_MEM_HEADROOM  0x4
 
-/*! \brief Network Playout Buffer Slots.
+/*! Bytes kept in front of the slots with \c BP_MEM_HEADROOM, a multiple
+ * of 64 so that the packets stay cache line aligned. */
+#define BP_HEADROOM 192
+
+/*! \brief Buffer Pool Segment.
  *
- * It represents the memory used to hold the RTP packet received.
+ * \c BP_SLOT_NUM slots of the same size class.
  *
- * Never use it directly.
+ * Never use it directly, use \c BP_SLOT.
  * */
 typedef struct {
-        char x[BP_SLOT_SIZE];    /*!< Memory used to hold the packets
-                                     received from the network,
-                                     NEVER ACCESS IT DIRECTLY! */
-} bp_slot;
+        char *mem;          /*!< Slots memory, NULL if the segment is
+                                 not allocated. */
+        int slot_size;      /*!< Size class of the slots. */
+        int headroom;       /*!< Bytes in front of each slot. */
+        int used;           /*!< Slots currently handed out. */
+} bp_segment;
+
+/*! Buckets of the time in buffer histogram: bucket \c i counts packets
+ * removed less than 2^i msec after their arrival, the last one also all
+ * the slower ones. */
+#define BP_HIST_BUCKETS 12
+
+/*! Why a received packet never reached the Playout Buffer. */
+enum bp_drop_reason {
+        BP_DROP_FULL = 0,   /*!< no free slot, after the overflow policy */
+        BP_DROP_EVICTED,    /*!< queued, then evicted by the overflow policy */
+        BP_DROP_LATE,       /*!< behind the consumer */
+        BP_DROP_DUPLICATED, /*!< already queued */
+        BP_DROP_OVERRUN,    /*!< beyond the ring, or a sequence jump */
+        BP_DROP_TRUNCATED,  /*!< bigger than the slot */
+        BP_DROP_INVALID,    /*!< bad RTP header */
+        BP_DROP_KEYFRAME,   /*!< waiting for a keyframe */
+        BP_DROP_REASONS
+};
+
+/*! \brief Buffer Pool Telemetry.
+ *
+ * Counters only ever grow. They are updated under \c fl_mutex or with
+ * atomic operations, and can be read at any time without taking
+ * \c fl_mutex: the slots in use are \c flcount.
+ * */
+typedef struct {
+        volatile int high_water;                  /*!< Most slots in use. */
+        volatile unsigned long enlarged;          /*!< Segments added. */
+        volatile unsigned long drops[BP_DROP_REASONS];
+        volatile unsigned long hist[BP_HIST_BUCKETS]; /*!< Time in buffer,
+                                               only while \c timing is set. */
+        volatile int timing;                      /*!< Read the clock when
+                                                       a packet leaves the
+                                                       Playout Buffer. */
+} bp_stats;
+
+/*! Counts a packet dropped for \c reason, see \c bp_drop_reason. */
+#define BP_STAT_DROP(bp, reason) \
+        nms_atomic_add(&(bp)->stats.drops[reason], 1)
 
 /*!
 * \brief Network Playout Element
 *
-* The elements are part of a indexed double linked list.
-*
-* \note the list delimiter is \c -1
+* Per slot informations about the packet held, indexed like the Bufferpool.
+* Slots are recycled without being cleared: \c pktlen is the only
+* authority about how many bytes of a slot are valid.
 * */
 typedef struct {
         int pktlen; /*!< Lenght of the packet held */
-        int prev;   /*!< Index of the previous element */
-        int next;   /*!< index of the next element */
+        uint32_t arrival; /*!< Reception time of the packet, in msec,
+                               wrapping. */
 } poitem;
 
+/*! Cells of the playout buffer ring, a power of two. It is kept bigger
+ * than twice \c BP_MAX_SIZE so that a full bufferpool plus a sequence
+ * number jump still fit in it, and \c PO_DONE keeps enough bits of
+ * position for it. */
+#define PO_RING_SIZE 16384
+/*! Default reorder window of the playout buffer, in packets. */
+#define PO_DEFAULT_WINDOW 64
+/*! Biggest reorder window allowed. */
+#define PO_MAX_WINDOW (PO_RING_SIZE / 2)
+/*! Longest wait for a missing packet once the next one is queued, in
+ * msec, when the reorder window is not exceeded yet. */
+#define PO_HOLE_WAIT 50
+
+/*! Ring cell never used. */
+#define PO_EMPTY -1
+/*! Ring cell already consumed (or given up) at position \c pos.
+ * The low bits of the position are kept so that a marker left from the
+ * previous lap is never mistaken for the current one. */
+#define PO_DONE(pos) (-2 - (int) ((pos) & 0xffff))
+/*! Flag of a ring cell whose slot is in use by the consumer. */
+#define PO_HELD 0x40000000
+/*! Slot index held by a ring cell. */
+#define PO_INDEX(cell) ((cell) & ~PO_HELD)
+
 /*!
  * \brief Network Playout Buffer.
  *
+ * Lock-free single producer (RTP thread), single consumer (application)
+ * queue. Packets are placed in \c ring at the position derived from their
+ * extended sequence number modulo the ring size, so misordered
+ * packets are reordered as long as the consumer did not pass their
+ * position yet.
+ *
+ * Each cell holds a bufferpool slot index, \c PO_EMPTY or \c PO_DONE.
+ * The producer claims a cell with a compare and swap and then publishes
+ * \c head, the consumer marks cells \c PO_DONE and then publishes \c tail.
+ * Cells handed to the consumer carry \c PO_HELD, the producer may evict
+ * any other one when the Buffer Pool is full.
+ *
  * \see poinit
+ * \see pokill
  * \see poadd
+ * \see popeek
  * \see podel
  * */
 typedef struct playout_buff_t {
-        bp_slot **bufferpool;        /*!< Pointer to memory space allocated for
-                                         Bufferpool and defined elsewhere.
+        bp_segment *segments;        /*!< Segments table of the Bufferpool,
+                                         defined elsewhere.
                                          \see bpinit */
-        poitem pobuff[BP_MAX_SIZE]; /*!< Array that will keep the sorted
-                                         list of slots containing arrived
-                                         packets. */
-        pthread_mutex_t po_mutex;   /*!< Mutex variable used for access control
-                                         to shared structures of playout
-                                         buffer. */
-        /* pthread_cond_t cond_empty; *//*!< Conditional variable used for
-                                                signaling in case of playout buffer
-                                                empty */
-        int pocount;            /*!< List members count. */
-        int pohead;            /*!< List head. */
-        int potail;            /*!< List tail. */
-        uint32_t cycles;            /*!< Counts how many times the RTP
-                                         \c timestamp rolls over */
-        // shawill: probably to be moved.
+        struct buffer_pool_t *bp;    /*!< The Bufferpool itself. */
+        poitem pobuff[BP_MAX_SIZE]; /*!< Per slot packet informations. */
+        /* producer side */
+        volatile uint32_t head;     /*!< One past the newest position. */
+        uint32_t offset;            /*!< Sequence number to position offset. */
+        int started;                /*!< Set once the first packet arrived. */
+        int jumped;                 /*!< Set if the last packet was a jump. */
+        uint32_t jump_seq;          /*!< Its sequence number. */
+        volatile int *ring;         /*!< Position indexed slots. */
+        uint32_t size;              /*!< Cells in \c ring, \c PO_RING_SIZE. */
+        uint32_t mask;              /*!< \c size - 1 */
+        uint32_t window;            /*!< Reorder window, in packets. */
+        /* consumer side */
+        volatile uint32_t tail;     /*!< Next position to deliver. */
+        volatile int pocount;       /*!< Packets queued. */
 } playout_buff;
 
 /*!
@@ -127,30 +234,93 @@ typedef struct playout_buff_t {
 * \see bpget
 * \see bpfree
 * \see bprmv
+* \see bpresize
 * */
 typedef struct buffer_pool_t {
-        bp_slot *bufferpool;       /*!< Pointer to the Bufferpool memory.
-                                            \see bpinit */
+        bp_segment segments[BP_MAX_SEGMENTS]; /*!< Bufferpool memory.
+                                            \see bpinit
+                                            \see bpenlarge */
         pthread_mutex_t fl_mutex;  /*!< Mutex to access the Bufferpool internals. */
         pthread_cond_t cond_full;  /*!< Advertise availability of free slots. */
         int *freelist;             /*!< Free slot indexes vector. */
+        int *flprev;               /*!< Previous slot in the Free List,
+                                        -1 for the head. */
         int flhead;                /*!< Free List head. */
-        int flcount;               /*!< Free List count. */
-        int size;
+        int flcount;               /*!< Slots in use. */
+        int size;                  /*!< Slots allocated. */
+        int bytes;                 /*!< Memory allocated for the slots,
+                                        the whole arena included. */
+        int slot_size;             /*!< Current size class, only segments
+                                        of this class feed the Free List. */
+        int shared;                /*!< Set if the memory is accounted to
+                                        the shared budget.
+                                        \see bpshared_init */
+        int mem_flags;             /*!< \c BP_MEM_* allocation mode. */
+        char *arena;               /*!< Huge pages mapped for the segments.
+                                        \see bparena_init */
+        int arena_size;
+        int arena_used;            /*!< Arena bytes carved so far. */
+        struct {
+                char *mem;
+                int bytes;
+        } arena_free[BP_MAX_SEGMENTS]; /*!< Arena extents released. */
+        bp_stats stats;            /*!< Telemetry, read without locking. */
 } buffer_pool;
 
+/*! Bytes taken by each slot of the segment \c seg. */
+#define BP_SEG_STRIDE(seg) ((seg).slot_size + (seg).headroom)
+/*! Address of the slot \c index in a segments table. */
+#define BP_SEG_SLOT(segments, index) \
+        ((segments)[(index) / BP_SLOT_NUM].mem + \
+         (segments)[(index) / BP_SLOT_NUM].headroom + \
+         ((index) % BP_SLOT_NUM) * BP_SEG_STRIDE((segments)[(index) / BP_SLOT_NUM]))
+/*! Address of the slot \c index of the Buffer Pool \c bp. */
+#define BP_SLOT(bp, index) BP_SEG_SLOT((bp)->segments, index)
+/*! Size of the slot \c index of the Buffer Pool \c bp. */
+#define BP_SLOT_LEN(bp, index) ((bp)->segments[(index) / BP_SLOT_NUM].slot_size)
+/*! Tells if \c mem was carved from the arena of the Buffer Pool \c bp. */
+#define BP_IN_ARENA(bp, mem) \
+        ((bp)->arena && (mem) >= (bp)->arena && \
+         (mem) < (bp)->arena + (bp)->arena_size)
+/*! Address of the slot \c index queued in the Playout Buffer \c po. */
+#define PO_SLOT(po, index) BP_SEG_SLOT((po)->segments, index)
+
 #define PKT_DUPLICATED    1
 #define PKT_MISORDERED    2
+#define PKT_LATE          3
+#define PKT_OVERRUN       4
 
-int poinit(playout_buff *, buffer_pool *);
-int poadd(playout_buff *, int, uint32_t);
+int poinit(playout_buff *, buffer_pool *, unsigned);
+int pokill(playout_buff *);
+int poadd(playout_buff *, int, uint64_t);
+int popeek(playout_buff *, unsigned);
+int poskip(playout_buff *);
 int podel(playout_buff *, int);
-int bpinit(buffer_pool *);
+int poevict(playout_buff *);
+int bpinit(buffer_pool *, int, int);
 int bpkill(buffer_pool *);
 int bpget(buffer_pool *);
+int bpgetn(buffer_pool *, int *, int);
 int bpfree(buffer_pool *, int);
+int bpfreen(buffer_pool *, int *, int);
+int bpwait(buffer_pool *, int);
 int bprmv(buffer_pool *, playout_buff *, int);
+int bpdetach(buffer_pool *, playout_buff *, int);
 int bpenlarge(buffer_pool * bp);
+int bpresize(buffer_pool *, int);
+int bpsegfree(buffer_pool *, int);
+int bpsegdrop(buffer_pool *, int);
+int bpclass(int);
+int bparena_init(buffer_pool *);
+int bparena_kill(buffer_pool *);
+char *bpsegalloc(buffer_pool *, int);
+int bpsegrelease(buffer_pool *, char *, int);
+int bpshared_init(long, long, long);
+int bpshared_register(buffer_pool *);
+int bpshared_unregister(buffer_pool *);
+int bpshared_alloc(buffer_pool *, long);
+int bpshared_release(buffer_pool *, long);
+int bpshared_over(buffer_pool *);
 
 #endif /* NEMESI_BUFFERPOOL_H */
 /* @} */
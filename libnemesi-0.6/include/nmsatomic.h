@@ -0,0 +1,46 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+
+/**
+ * @file nmsatomic.h
+ * Atomic operations, shared by the library and the installed headers.
+ */
+
+#ifndef NEMESI_ATOMIC_H
+#define NEMESI_ATOMIC_H
+
+/**
+ * @defgroup atomic Atomic operations
+ * Thin wrappers around the GCC builtins, used by the lock-free paths
+ * shared between the RTP thread and the application.
+ * @{
+ */
+#define nms_barrier()                 __sync_synchronize()
+#define nms_cas(ptr, oldval, newval)  __sync_bool_compare_and_swap(ptr, oldval, newval)
+#define nms_atomic_add(ptr, val)      __sync_fetch_and_add(ptr, val)
+#define nms_atomic_sub(ptr, val)      __sync_fetch_and_sub(ptr, val)
+/**
+ * @}
+ */
+
+#endif /* NEMESI_ATOMIC_H */
@@ -168,6 +168,9 @@ typedef struct rtcp_sdes rtcp_sdes_t;
 
 int rtcp_thread_create(rtp_thread *th);
 int rtcp_recv(rtp_session *sess);
+int rtcp_recv_pkt(rtp_session *, void *, int, nms_sockaddr *);
+struct rtcp_event *rtcp_schedule_sessions(rtp_session *);
+void rtcp_timer_set(int, struct timeval *);
 
 /**
  * RTCP Packets Handling
@@ -42,6 +42,7 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #endif
 
 #include <time.h>
@@ -126,8 +127,34 @@ typedef struct {
         int fps;
         uint8_t pt;
         uint8_t *data;
+        long *nals;                     //!< offsets in data of its NAL units, valid like data
+        int nal_count;                  //!< 0 if the parser does not tell them
 } rtp_frame;
 
+/**
+ * A frame described in place, see rtp_fill_buffer_iov: the pieces point
+ * into the bufferpool slots of its packets, which the frame holds until
+ * rtp_frame_iov_release, and to the start codes or headers the parser
+ * adds. It can be written with writev, iovcnt pieces at a time up to
+ * IOV_MAX.
+ */
+typedef struct {
+        long len;                       //!< bytes of all the pieces
+        uint32_t timestamp;
+        double time_sec;
+        int fps;
+        uint8_t pt;
+        struct iovec *iov;              //!< the pieces of the frame
+        int iovcnt;
+        int iov_size;                   //!< pieces allocated
+        int *slots;                     //!< bufferpool slots held
+        int nslots;
+        int slots_size;                 //!< slot indexes allocated
+        struct buffer_pool_t *bp;       //!< bufferpool of the slots
+        long *nals;                     //!< offsets of its NAL units, see rtp_frame
+        int nal_count;
+} rtp_frame_iov;
+
 #define RTP_PKT_CC(pkt)     (pkt->cc)
 #define RTP_PKT_EXT(pkt)	(pkt->ext)
 #define RTP_PKT_MARK(pkt)   (pkt->mark)
@@ -193,7 +220,7 @@ typedef struct {
 
 struct rtp_ssrc_stats {
         uint16_t max_seq;         //!< highest seq number seen
-        uint32_t cycles;          //!< shifted count of seq number cycles
+        uint64_t ext_max_seq;     //!< highest seq number seen, extended with the count of cycles
         uint32_t base_seq;        //!< base seq number
         uint32_t bad_seq;         //!< last 'bad' seq number + 1
         uint32_t probation;       //!< sequ. pkts till source is valid
@@ -201,7 +228,7 @@ struct rtp_ssrc_stats {
         uint32_t expected_prior;  //!< pkt expected at last interval
         uint32_t received_prior;  //!< pkt received al last interval
         uint32_t transit;         //!< relative trans time for prev pkt
-        double jitter;          //!< extimated jitter
+        uint32_t jitter;          //!< extimated jitter, in timestamp units scaled by 16 (RFC 3550 A.8)
         struct timeval lastrtp; //!< last RTP pkt reception time
         struct timeval lastsr;  //!< last RTCP SR pkt reception time
         uint32_t ntplastsr[2];    //!< last RTCP SR pkt NTP reception time
@@ -210,6 +237,80 @@ struct rtp_ssrc_stats {
         struct timeval firsttv; //!< first pkt timeval
 };
 
+/**
+ * What rtp_recv does with a packet when the bufferpool of the session
+ * cannot grow any more.
+ */
+enum rtp_overflow_policy {
+        RTP_OVF_DROP_NEWEST = 0,        //!< discard the packet just received
+        RTP_OVF_DROP_OLDEST,            //!< evict the oldest queued packet not in use by the application
+        RTP_OVF_DROP_TO_KEYFRAME,       //!< flush the queues and discard packets until the next keyframe
+        RTP_OVF_BLOCK                   //!< wait for a free slot up to a timeout, then discard the packet
+};
+
+#define RTP_OVF_DEF_TIMEOUT 100        //!< msec
+
+#define RTP_RECV_BATCH_MAX 64          //!< most packets read by a single rtp_recv
+#define RTP_RECV_AGAIN 2               //!< rtp_recv and rtcp_recv found no datagram queued (non blocking sockets)
+
+#ifdef SO_TIMESTAMPNS
+/**
+ * Room for the control message carrying the kernel reception time of
+ * a datagram, see rtp_recv_stamp.
+ */
+typedef union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+} rtp_recv_cmsg;
+#endif
+
+struct rtp_overflow_stats {
+        unsigned long overflows;        //!< packets received with a full bufferpool
+        unsigned long dropped;          //!< received packets discarded
+        unsigned long evicted;          //!< queued packets discarded
+        unsigned long waits;            //!< waits for a free slot
+        unsigned long timeouts;         //!< waits that expired
+};
+
+#define RTP_PLAYOUT_JITTER_MUL 4       //!< playout delay target, in jitters
+
+//! Tells if the packets of an rtp_session wait for their playout time
+#define RTP_PLAYOUT_ON(rtp_sess) \
+        ((rtp_sess)->playout_delay_min || (rtp_sess)->playout_delay_max)
+
+/**
+ * Adaptive playout delay of a source, see rtp_playout_update.
+ * Written by the RTP thread, read by the application.
+ */
+struct rtp_playout {
+        volatile uint32_t transit_min;  //!< smallest transit time seen, in timestamp units
+        volatile uint32_t delay_ts;     //!< playout delay, in timestamp units
+        volatile unsigned rate;         //!< clock rate of the timestamps, 0 before the first packet
+        double delay;                   //!< playout delay, in msec
+};
+
+#define RTP_BP_HIST_BUCKETS 12        //!< same as BP_HIST_BUCKETS
+
+/**
+ * Snapshot of the bufferpool telemetry of a session, see rtp_get_bp_stats.
+ */
+typedef struct {
+        int slots_in_use;               //!< slots holding packets
+        int slots_allocated;            //!< slots the bufferpool grew to
+        int slots_max;                  //!< most slots the bufferpool may grow to
+        int high_water;                 //!< most slots ever in use
+        unsigned long enlarged;         //!< segments of slots added
+        unsigned long dropped_full;     //!< packets discarded, bufferpool full
+        unsigned long dropped_evicted;  //!< queued packets evicted by the overflow policy
+        unsigned long dropped_late;     //!< packets arrived after their turn
+        unsigned long dropped_duplicated;       //!< packets already queued
+        unsigned long dropped_overrun;  //!< packets beyond the playout ring, or sequence jumps
+        unsigned long dropped_truncated;        //!< packets bigger than a slot
+        unsigned long dropped_invalid;  //!< packets with a bad RTP header
+        unsigned long dropped_keyframe; //!< packets skipped waiting for a keyframe
+        unsigned long time_in_buffer[RTP_BP_HIST_BUCKETS];      //!< packets removed less than 2^i msec after arrival, the last bucket takes the slower ones too, see rtp_set_bp_timing
+} rtp_bp_stats;
+
 struct rtp_ssrc_descr {
         char *end;
         char *cname;
@@ -250,10 +351,17 @@ typedef struct rtp_ssrc_s {
         struct rtp_ssrc_descr ssrc_sdes;
         struct playout_buff_t * po;
         struct rtp_session_s *rtp_sess;     //!< RTP session SSRC belogns to.
-        void *privs[128];                   //!< I would like to keep rtp able to manage dynamic payload changes at its best.
+        void *privs[128];                   //!< parser state of the source per payload type, allocated on its first packet
         struct rtp_ssrc_s *next;            //!< next known SSRC
         struct rtp_ssrc_s *next_active;     //!< next active SSRC
         int done_seek;
+        int wait_keyframe;                  //!< if set, packets are discarded until a keyframe starts
+        struct rtp_playout playout;         //!< adaptive playout delay
+        unsigned rate;                      //!< clock rate of rate_pt, 0 until the first packet
+        unsigned rate_pt;                   //!< payload type of the last packet
+        volatile uint32_t frame_ts;         //!< timestamp of the last frame received
+        volatile int frame_open;            //!< set while the last frame received is not complete, see rtp_wait_frame
+        unsigned parsed_pt;                 //!< payload type + 1 of the last packet parsed, 0 before the first
         void *park;                         //!< private pointer used by the application (e.g. to hold decoder state variables)
 } rtp_ssrc;
 
@@ -271,7 +379,46 @@ struct rtp_conflict {
 typedef int (*rtp_parser_init) (struct rtp_session_s * rtp_sess, unsigned pt);
 typedef int (*rtp_parser) (rtp_ssrc * stm_src, rtp_frame * fr,
                            rtp_buff * conf);
+/**
+ * the <tt>rtp_parser_uninit</tt> function is called at rtp thread end for
+ * every source, to free the state the parser keeps in its <tt>privs</tt>
+ */
 typedef int (*rtp_parser_uninit) (rtp_ssrc * stm_src, unsigned pt);
+/**
+ * the <tt>rtp_parser_free</tt> function is called at rtp thread end, after
+ * the sources, to free what <tt>rtp_parser_init</tt> left in the payload type
+ */
+typedef void (*rtp_parser_free) (struct rtp_session_s * rtp_sess, unsigned pt);
+typedef int (*rtp_parser_iov) (rtp_ssrc * stm_src, rtp_frame_iov * fr,
+                               rtp_buff * conf);
+
+/**
+ * Frame delivery callback of a session, see rtp_set_frame_cb.
+ *
+ * It is called on the thread receiving the packets, the RTP thread or
+ * a worker, as soon as a frame is complete. The frame, the config and
+ * the memory they point to are only valid until the callback returns:
+ * copy what must outlive it. The callback must not block, since it
+ * holds up the reception of the other sessions of the thread, and it
+ * must not call rtp_fill_buffer or rtp_wait_frame on the session. Nor
+ * must any other thread: rtp_wait_frame(s) never report its frames.
+ * stm_src->park is there for the state the application keeps per source.
+ */
+typedef void (*rtp_frame_cb) (rtp_ssrc * stm_src, rtp_frame * fr,
+                              rtp_buff * conf, void *arg);
+
+/**
+ * Wakes the application threads waiting for the frames of the sessions
+ * of an rtp_thread, see rtp_wait_frames.
+ */
+typedef struct {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        unsigned seq;                   //!< bumped for every frame completed
+        volatile int waiters;           //!< threads blocked in rtp_wait_frame(s)
+        volatile int done;              //!< set at the end of the stream
+        rtp_ssrc *next;                 //!< source rtp_wait_frames looks at first
+} rtp_wait;
 
 typedef struct rtp_session_s {
         void * owner; 				//!< rtsp_thread owning this rtp session
@@ -279,10 +426,14 @@ typedef struct rtp_session_s {
         rtp_transport transport;
         struct rtp_session_stats sess_stats;
         rtp_ssrc *ssrc_queue;                   //!< queue of all known SSRCs
+        struct rtp_ssrc_table *volatile ssrc_table; //!< hash index of ssrc_queue, see rtp_ssrc_find
+        rtp_ssrc *volatile ssrc_last;           //!< last source found by rtp_ssrc_find
         rtp_ssrc *active_ssrc_queue;            //!< queue of active SSRCs
         struct rtp_conflict *conf_queue;
         struct buffer_pool_t * bp;
         struct rtp_session_s *next;
+        struct rtp_session_s *next_ready;       //!< next session with datagrams left, see the rtp() loop
+        int ready;                              //!< set while in the ready list
         pthread_mutex_t syn;
         rtp_pt *ptdefs[128];                    //!< payload type definitions for the session (included dynamically defined)
         rtp_fmts_list *announced_fmts;          //!< list of rtp pt announced in sdp description (if present)
@@ -290,10 +441,30 @@ typedef struct rtp_session_s {
         rtp_parser_init parsers_inits[128];
         rtp_parser parsers[128];
         rtp_parser_uninit parsers_uninits[128];
+        rtp_parser_free parsers_frees[128];
+        rtp_parser_iov parsers_iov[128];        //!< parsers describing the frames in place, NULL if they copy them
         void *park;                             //!< private pointer used by the application (e.g. to hold decoder state variables)
         float fps;				//!< current frame per second
         int lost;
 		long receive_packets;
+        unsigned int reorder_window;            //!< playout buffer reorder window, in packets (0 for default)
+        enum rtp_overflow_policy overflow_policy;       //!< what to do when the bufferpool is full
+        int overflow_timeout;                   //!< longest wait for RTP_OVF_BLOCK, in msec
+        struct rtp_overflow_stats ovf_stats;
+        int bp_mem_flags;                       //!< BP_MEM_* flags for the bufferpool memory
+        int playout_delay_min;                  //!< smallest playout delay, in msec
+        int playout_delay_max;                  //!< biggest playout delay, in msec (0 for no upper bound)
+        int recv_batch;                         //!< packets read with one recvmmsg (1 for one recvfrom per packet)
+        int muxed;                              //!< RTP and RTCP sockets shared with other sessions, see rtp_mux.c
+        int rx_timestamps;                      //!< reception times taken by the kernel (SO_TIMESTAMPNS)
+        int io_uring;                           //!< packets received through io_uring, see rtp_uring.c
+        int udp_gro;                            //!< datagrams coalesced by the kernel (UDP_GRO), see rtp_recv_gro
+        int gro_size;                           //!< last segment size of the coalesced datagrams, 0 if unknown
+        char *gro_stage;                        //!< room to realign the segments of a coalesced datagram
+        rtp_wait *wait;                         //!< woken when a frame is complete, NULL if nobody can wait
+        rtp_frame_cb frame_cb;                  //!< frames pushed to the application, NULL to let it pull them
+        void *frame_cb_arg;                     //!< argument of frame_cb
+        int access_units;                       //!< video frames are whole access units, see rtp_set_access_units
 } rtp_session;
 
 typedef struct {
@@ -303,6 +474,22 @@ typedef struct {
 
         // struct timeval startime;
         unsigned int prebuffer_size;
+        unsigned int reorder_window;    //!< reorder window given to new RTP sessions
+        enum rtp_overflow_policy overflow_policy;       //!< overflow policy given to new RTP sessions
+        int overflow_timeout;           //!< RTP_OVF_BLOCK timeout given to new RTP sessions, in msec
+        int bp_mem_flags;               //!< bufferpool memory flags given to new RTP sessions
+        int playout_delay_min;          //!< playout delay bounds given to new RTP sessions, in msec
+        int playout_delay_max;
+        int recv_batch;                 //!< packets per receive call given to new RTP sessions
+        int rx_timestamps;              //!< kernel reception times for new RTP sessions
+        int io_uring;                   //!< io_uring receive engine for new RTP sessions
+        int udp_gro;                    //!< coalesced receive for new RTP sessions
+        struct rtp_uring *uring;        //!< io_uring of the RTP loop, NULL if not used
+        int rtp_epfd;                   //!< epoll descriptor of the RTP loop, -1 if not used
+        rtp_session *rtp_ready;         //!< sessions of the epoll set with datagrams left, see rtp_epoll_round
+        int buffering;                  //!< syn held until the first packet, see rtp_buffering_end
+        struct rtp_worker_ctl *worker;  //!< worker serving the sessions, NULL if they have their own threads
+        rtp_wait wait;                  //!< frames completed for rtp_wait_frames
 
         pthread_mutex_t syn;
         pthread_t rtp_tid;
@@ -341,6 +528,61 @@ enum rtp_protos {
  */
 rtp_thread *rtp_init(void);
 int rtp_thread_create(rtp_thread *);    // something like rtp_run could be better?
+void rtp_clean(void *);
+int rtp_bp_init(rtp_session *);
+/**
+ * @}
+ */
+
+/**
+ * RTP Workers
+ * An optional process-wide pool of threads serving the RTP and RTCP
+ * sockets of all the RTSP controllers, instead of two threads each.
+ * @defgroup rtp_worker RTP Workers
+ * @{
+ */
+int rtp_workers_init(int);
+int rtp_workers_uninit(void);
+int rtp_workers_active(void);
+int rtp_worker_attach(rtp_thread *);
+int rtp_worker_detach(rtp_thread *);
+int rtp_workers_mux(int);
+/**
+ * @}
+ */
+
+/**
+ * The RTP thread loop on io_uring, receiving the packets straight into
+ * the bufferpool slots. Falls back to epoll when the kernel cannot.
+ * @defgroup rtp_uring RTP io_uring
+ * @{
+ */
+int rtp_uring_create(rtp_thread *);
+int rtp_uring_loop(rtp_thread *);
+void rtp_uring_free(rtp_thread *);
+int rtp_epoll_round(rtp_thread *, int);
+void rtp_buffering_end(rtp_thread *);
+/**
+ * @}
+ */
+
+/**
+ * RTP Demultiplexing
+ * Unicast sessions sharing the receive sockets of the workers, told apart
+ * by the address of the sender and by SSRC.
+ * @defgroup rtp_mux RTP Demultiplexing
+ * @{
+ */
+int rtp_mux_open(int, int);
+void rtp_mux_close(void);
+int rtp_mux_active(void);
+int rtp_mux_fd(int, enum rtp_protos);
+int rtp_mux_setup(rtp_session *);
+int rtp_mux_add(rtp_session *, enum rtp_protos, void *);
+void rtp_mux_del(rtp_session *);
+void rtp_mux_rdlock(void);
+void rtp_mux_unlock(void);
+void *rtp_mux_find(nms_sockaddr *, uint32_t, int, enum rtp_protos);
 /**
  * @}
  */
@@ -367,6 +609,16 @@ rtp_pt * rtp_get_pt_info(rtp_session * rtp_sess, unsigned pt);
  * @{
  */
 int rtp_recv(rtp_session *);
+int rtp_recv_copy(rtp_session *, void *, int, nms_sockaddr *, struct timeval *);
+int rtp_recv_pkt(rtp_session *, int, int, nms_sockaddr *, struct timeval *);
+void rtp_recv_init(rtp_session *);
+#ifdef SO_TIMESTAMPNS
+int rtp_recv_stamp(struct msghdr *, struct timeval *);
+#endif
+uint32_t rtp_tv2ts(const struct timeval *, unsigned);
+uint64_t rtp_ext_seq(rtp_ssrc *, uint16_t);
+int rtp_overflow(rtp_session *);
+int rtp_keyframe_skip(rtp_ssrc *, rtp_pkt *, int);
 /**
  * @}
  */
@@ -384,6 +636,8 @@ int rtp_ssrc_check(rtp_session *, uint32_t, rtp_ssrc **, nms_sockaddr *,
                    enum rtp_protos);
 int rtp_ssrc_init(rtp_session *, rtp_ssrc **, uint32_t, nms_sockaddr *,
                   enum rtp_protos);
+rtp_ssrc *rtp_ssrc_find(rtp_session *, uint32_t);
+void rtp_ssrc_table_free(rtp_session *);
 /**
  * @}
  */
@@ -396,11 +650,34 @@ int rtp_ssrc_init(rtp_session *, rtp_ssrc **, uint32_t, nms_sockaddr *,
  */
 int rtp_fill_buffers(rtp_thread *);
 int rtp_fill_buffer(rtp_ssrc *, rtp_frame *, rtp_buff *);
+int rtp_fill_buffer_iov(rtp_ssrc *, rtp_frame_iov *, rtp_buff *);
+int rtp_frame_iov_add(rtp_frame_iov *, void *, long);
+int rtp_frame_iov_hold(rtp_ssrc *, rtp_frame_iov *);
+void rtp_frame_iov_release(rtp_frame_iov *);
+void rtp_frame_iov_free(rtp_frame_iov *);
+int rtp_wait_frame(rtp_ssrc *, int);
+rtp_ssrc *rtp_wait_frames(rtp_thread *, int);
+int rtp_wait_init(rtp_wait *);
+void rtp_wait_destroy(rtp_wait *);
+void rtp_wait_end(rtp_wait *);
+int rtp_wait_frame_end(rtp_ssrc *, rtp_pkt *);
+int rtp_frame_ready(rtp_ssrc *);
+int rtp_stream_over(rtp_ssrc *);
+void rtp_push_frames(rtp_ssrc *);
 
 double rtp_get_next_ts(rtp_ssrc *);
 int16_t rtp_get_next_pt(rtp_ssrc *);
 void rtp_update_fps(rtp_ssrc * stm_src, uint32_t, unsigned);
 float rtp_get_fps(rtp_ssrc *);
+int rtp_get_bp_stats(rtp_ssrc *, rtp_bp_stats *);
+void rtp_set_bp_timing(rtp_ssrc *, int);
+
+void rtp_playout_reset(rtp_ssrc *, uint32_t, unsigned);
+void rtp_playout_update(rtp_ssrc *, uint32_t, unsigned);
+int rtp_playout_due(rtp_ssrc *, rtp_pkt *);
+int rtp_playout_wait(rtp_ssrc *, rtp_pkt *);
+int rtp_set_playout_delay(rtp_ssrc *, int, int);
+double rtp_get_playout_delay(rtp_ssrc *);
 
 rtp_pkt *rtp_get_n_pkt(rtp_ssrc *, unsigned int *, unsigned);
 rtp_pkt *rtp_get_pkt(rtp_ssrc *, size_t *);
@@ -490,6 +767,8 @@ inline int rtp_set_ssrc(rtp_session *, uint32_t);
 rtp_session *rtp_session_init(nms_sockaddr *local, nms_sockaddr *peer);
 struct rtsp_ctrl_t;
 rtp_ssrc * rtp_session_get_ssrc(rtp_session *sess, struct rtsp_ctrl_t *ctl);
+int rtp_set_frame_cb(rtp_session *, rtp_frame_cb, void *);
+int rtp_set_access_units(rtp_session *, int);
 /**
  * @}
  */
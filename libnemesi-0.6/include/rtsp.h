@@ -56,6 +56,37 @@ typedef struct {
         int prebuffer_size;
         sock_type pref_rtsp_proto;
         sock_type pref_rtp_proto;
+        int reorder_window;    /*!< Packets a misordered one can be late by
+                                    and still be reordered, 0 for default. */
+        enum rtp_overflow_policy overflow_policy; /*!< What to do with
+                                    packets when a bufferpool is full. */
+        int overflow_timeout;  /*!< Longest wait for \c RTP_OVF_BLOCK,
+                                    in msec, 0 for default. */
+        int bp_mem_flags;      /*!< \c BP_MEM_HUGEPAGES and/or
+                                    \c BP_MEM_MLOCK for the bufferpools,
+                                    0 for plain memory. */
+        long bp_shared_limit;  /*!< Memory budget shared by all the
+                                    bufferpools of the process, in bytes,
+                                    0 for a separate \c BP_MAX_BYTES each. */
+        long bp_shared_soft;   /*!< Memory each bufferpool is granted from
+                                    the shared budget, in bytes. */
+        long bp_shared_hard;   /*!< Memory no bufferpool can exceed,
+                                    in bytes, see \c bpshared_init. */
+        int playout_delay_min; /*!< Bounds of the adaptive playout delay, */
+        int playout_delay_max; /*!< in msec, max 0 for no upper bound,
+                                    both 0 for no playout delay. */
+        int recv_batch;        /*!< Packets read by a single \c recvmmsg,
+                                    up to \c RTP_RECV_BATCH_MAX, 0 for
+                                    one \c recvfrom per packet. */
+        int rx_timestamps;     /*!< Take the reception time of the packets
+                                    from the kernel (\c SO_TIMESTAMPNS)
+                                    instead of \c gettimeofday. */
+        int io_uring;          /*!< Receive the RTP packets through
+                                    io_uring straight into the bufferpool,
+                                    if the kernel can, instead of epoll. */
+        int udp_gro;           /*!< Let the kernel coalesce the RTP
+                                    datagrams of a stream (\c UDP_GRO), split
+                                    again in consecutive slots. */
 } nms_rtsp_hints;
 
 /*!
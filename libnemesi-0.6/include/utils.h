@@ -41,6 +41,8 @@
 #include <inttypes.h>
 #include <stdint.h>
 
+#include "nmsatomic.h"
+
 
 #ifndef WIN32
 #	include <sys/types.h>
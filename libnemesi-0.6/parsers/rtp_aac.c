@@ -40,20 +40,26 @@ typedef struct aac_elem_s {
 
 /**
  * Local structure, contains data necessary to compose a aac frame out
- * of rtp fragments.
+ * of rtp fragments. There is one per source.
  */
 typedef struct {
     uint8_t *data;		//!< constructed frame, fragments will be copied there
     long len;			//!< buf length, it's the sum of the fragments length
     long data_size;		//!< allocated bytes for data
     unsigned long timestamp;	//!< timestamp of progressive frame
+    aac_elem *head;		//!< Head of aac frame list
+} rtp_aac;
+
+/**
+ * Configuration announced in the sdp, shared by the sources.
+ */
+typedef struct {
     uint8_t *conf;		//!< extradata
     long conf_len;		//!< extradata length
     int size_len;		//!< Number of bits in the AU header for fragment size
     int index_len;		//!< Number of bits in the AU header for the index
     int delta_len;		//!< Number of bits in the AU header for the delta index
-    aac_elem *head;		//!< Head of aac frame list
-} rtp_aac;
+} rtp_aac_conf;
 
 
 
@@ -64,7 +70,7 @@ static rtpparser_info aac_served = {
 
 static int aac_init_parser(rtp_session * rtp_sess, unsigned pt)
 {
-    rtp_aac *priv = calloc(1, sizeof(rtp_aac));
+    rtp_aac_conf *priv = calloc(1, sizeof(rtp_aac_conf));
     rtp_pt_attrs *attrs = &rtp_sess->ptdefs[pt]->attrs;
     char value[1024];
     uint8_t buffer[1024];
@@ -148,8 +154,8 @@ static int aac_init_parser(rtp_session * rtp_sess, unsigned pt)
     return 0;
 
   err_alloc:
-    if (priv->data)
-	free(priv->data);
+    if (priv->conf)
+	free(priv->conf);
     free(priv);
     return err;
 }
@@ -157,13 +163,11 @@ static int aac_init_parser(rtp_session * rtp_sess, unsigned pt)
 static int aac_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
     aac_elem *tmp;
-    rtp_aac *priv = ssrc->rtp_sess->ptdefs[pt]->priv;
+    rtp_aac *priv = ssrc->privs[pt];
 
     if (priv) {
 	if (priv->data)
 	    free(priv->data);
-	if (priv->conf)
-	    free(priv->conf);
 	while (priv->head) {
 	    tmp = priv->head;
 	    priv->head = priv->head->next;
@@ -174,11 +178,24 @@ static int aac_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 	free(priv);
     }
 
-    ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+    ssrc->privs[pt] = NULL;
 
     return 0;
 }
 
+static void aac_free_parser(rtp_session * rtp_sess, unsigned pt)
+{
+    rtp_aac_conf *priv = rtp_sess->ptdefs[pt]->priv;
+
+    if (priv) {
+	if (priv->conf)
+	    free(priv->conf);
+	free(priv);
+    }
+
+    rtp_sess->ptdefs[pt]->priv = NULL;
+}
+
 /**
  * it should return an aac frame by fetching one or more than
  * a single rtp packet
@@ -189,7 +206,8 @@ static int aac_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
     rtp_pkt *pkt;
     uint8_t *buf, *payload;
     aac_elem *cur = NULL;
-    rtp_aac *priv = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+    rtp_aac *priv;
+    rtp_aac_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
     size_t len;
     int i, buf_index;
     int header_len, header_len_bytes, headers_num, frame_len, frame_index;
@@ -212,6 +230,8 @@ static int aac_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 #endif
     if (!(pkt = rtp_get_pkt(ssrc, &len)))
         return RTP_BUFF_EMPTY;
+    if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_aac))))
+        return RTP_ERRALLOC;
 
     payload = buf = RTP_PKT_DATA(pkt);
     len = RTP_PAYLOAD_SIZE(pkt, len);
@@ -311,9 +331,9 @@ static int aac_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 //        printf("frame  len: %d\n", fr->len);
     }
 
-    if (priv->conf_len) {
-        config->data = priv->conf;
-        config->len = priv->conf_len;
+    if (conf && conf->conf_len) {
+        config->data = conf->conf;
+        config->len = conf->conf_len;
         //printf("config: %02x %02x, len %d\n", config->data[0], config->data[1], config->len);
     }
 
@@ -46,28 +46,16 @@ static rtpparser_info h263_served = {
         {"H263-1998", NULL}
 };
 
-static int h263_init_parser(rtp_session * rtp_sess, unsigned pt)
-{
-        rtp_h263 *priv = calloc(1, sizeof(rtp_h263));
-
-        if (!priv)
-                return RTP_ERRALLOC;
-
-        rtp_sess->ptdefs[pt]->priv = priv;
-
-        return 0;
-}
-
 static int h263_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
-        rtp_h263 *priv = ssrc->rtp_sess->ptdefs[pt]->priv;
+        rtp_h263 *priv = ssrc->privs[pt];
 
         if (priv && priv->data)
                 free(priv->data);
         if (priv)
                 free(priv);
 
-        ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+        ssrc->privs[pt] = NULL;
 
         return 0;
 }
@@ -80,7 +68,7 @@ static int h263_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 {
         rtp_pkt *pkt;
         uint8_t *buf;
-        rtp_h263 *priv = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_h263 *priv;
         size_t len; /* payload size, minus additional headers,
                  * plus the 2 zeroed bytes
                  */
@@ -90,6 +78,8 @@ static int h263_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 
         if (!(pkt = rtp_get_pkt(ssrc, &len)))
                 return RTP_BUFF_EMPTY;
+        if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_h263))))
+                return RTP_ERRALLOC;
 
         buf = RTP_PKT_DATA(pkt);
         len = RTP_PAYLOAD_SIZE(pkt, len);
@@ -144,4 +134,4 @@ static int h263_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
         return err;
 }
 
-RTP_PARSER_FULL(h263);
+RTP_PARSER_UNINIT(h263);
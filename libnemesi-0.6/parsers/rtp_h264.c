@@ -26,12 +26,27 @@
 
 /**
  * @file rtp_h264.c
- * H264 depacketizer RFC 3984
+ * H264 depacketizer RFC 6184
  */
 
+#define H264_DEINT_MAX 64  //!< deepest interleaving honoured
+
+/**
+ * A NAL unit of an interleaved stream, waiting to be handed out in
+ * decoding order.
+ */
+
+typedef struct {
+        uint8_t *data;     //!< the NAL unit, after a start sequence
+        long len;
+        long data_size;    //!< allocated bytes for data
+        uint32_t timestamp;
+        uint16_t don;      //!< decoding order number
+} rtp_h264_nal;
+
 /**
  * Local structure, contains data necessary to compose a h264 frame out
- * of rtp fragments and set the correct timings.
+ * of rtp fragments and set the correct timings. There is one per source.
  */
 
 typedef struct {
@@ -39,11 +54,38 @@ typedef struct {
         long len;          //!< buf length, it's the sum of the fragments length
         long data_size;    //!< allocated bytes for data
         unsigned long timestamp;    //!< timestamp of progressive frame
-        uint8_t *conf;
-        long conf_len;
         int configured;
+        int fu_b;          //!< the fragmented NAL unit started with a FU-B
+        uint16_t fu_don;   //!< DON of the FU-B
+        /** NAL units waiting for their DON, the buffers past deint_count
+         * are kept for reuse */
+        rtp_h264_nal *deint;
+        int deint_count;   //!< NAL units in the reordering stage
+        int deint_size;    //!< allocated entries
+        long deint_bytes;  //!< their size
+        uint16_t don_high; //!< highest DON received
+        int don_valid;     //!< set once a DON is received
+        long *nals;        //!< offsets of the NAL units in data
+        int nal_count;
+        int nals_size;     //!< allocated offsets
+        long au_len;       //!< bytes of data holding complete NAL units
+        int au_nals;       //!< complete NAL units in data
+        uint32_t au_ts;    //!< their timestamp
 } rtp_h264;
 
+/**
+ * Parameter sets announced in the sdp, shared by the sources.
+ */
+
+typedef struct {
+        uint8_t *data;     //!< the parameter sets, each after a start sequence
+        long len;
+        int interleaved;   //!< packetization-mode 2
+        int depth;         //!< NAL units the reordering stage holds back
+        long deint_buf_req; //!< bytes it holds back at most, 0 if unknown
+        int max_don_diff;  //!< DON distance letting a NAL unit go, 0 if unknown
+} rtp_h264_conf;
+
 static rtpparser_info h264_served = {
         -1,
         {"H264", NULL}
@@ -51,13 +93,14 @@ static rtpparser_info h264_served = {
 
 static int h264_init_parser(rtp_session * rtp_sess, unsigned pt)
 {
-        rtp_h264 *priv = calloc(1, sizeof(rtp_h264));
+        rtp_h264_conf *priv = calloc(1, sizeof(rtp_h264_conf));
         rtp_pt_attrs *attrs = &rtp_sess->ptdefs[pt]->attrs;
         char value[1024];
         int i;
         int len;
 
         if (!priv) return RTP_ERRALLOC;
+        priv->depth = -1;
 
         for (i=0; i < attrs->size; i++) {
 
@@ -68,19 +111,32 @@ static int h264_init_parser(rtp_session * rtp_sess, unsigned pt)
                 if ((len = nms_get_attr_value(attrs->data[i], "packetization-mode",
                                               value, sizeof(value)))) {
                         // We do not support anything else.
-                        if (len != 1 || atoi(value) >= 2) {
+                        if (len != 1 || atoi(value) > 2) {
                                 nms_printf(NMSML_ERR,
                                            "Unsupported H.264 packetization mode %s\n", value);
+                                free(priv->data);
+                                free(priv);
                                 return RTP_PARSE_ERROR;
                         }
+                        priv->interleaved = atoi(value) == 2;
                 }
+                if (nms_get_attr_value(attrs->data[i], "sprop-interleaving-depth",
+                                       value, sizeof(value)))
+                        priv->depth = atoi(value);
+                if (nms_get_attr_value(attrs->data[i], "sprop-deint-buf-req",
+                                       value, sizeof(value)))
+                        priv->deint_buf_req = atol(value);
+                if (nms_get_attr_value(attrs->data[i], "sprop-max-don-diff",
+                                       value, sizeof(value)))
+                        priv->max_don_diff = atoi(value);
                 if ((len = nms_get_attr_value(attrs->data[i], "sprop-parameter-sets",
                                               value, sizeof(value)))) {
                         //shamelessly ripped from ffmpeg
                         uint8_t start_seq[4] = {0, 0, 0, 1};
                         char *v = value;
-                        priv->conf_len = 0;
-                        priv->conf = NULL;
+                        free(priv->data);
+                        priv->len = 0;
+                        priv->data = NULL;
                         while (*v) {
                                 char base64packet[1024];
                                 uint8_t decoded_packet[1024];
@@ -102,20 +158,20 @@ static int h264_init_parser(rtp_session * rtp_sess, unsigned pt)
                                 if (packet_size) {
                                         uint8_t *dest = calloc(1, packet_size +
                                                                sizeof(start_seq) +
-                                                               priv->conf_len);
+                                                               priv->len);
                                         if (dest) {
-                                                if (priv->conf_len) {
-                                                        memcpy(dest, priv->conf, priv->conf_len);
-                                                        free(priv->conf);
+                                                if (priv->len) {
+                                                        memcpy(dest, priv->data, priv->len);
+                                                        free(priv->data);
                                                 }
 
-                                                memcpy(dest+priv->conf_len, start_seq,
+                                                memcpy(dest+priv->len, start_seq,
                                                        sizeof(start_seq));
-                                                memcpy(dest + priv->conf_len +  sizeof(start_seq),
+                                                memcpy(dest + priv->len +  sizeof(start_seq),
                                                        decoded_packet, packet_size);
 
-                                                priv->conf = dest;
-                                                priv->conf_len += sizeof(start_seq) + packet_size;
+                                                priv->data = dest;
+                                                priv->len += sizeof(start_seq) + packet_size;
                                         } else {
                                                 goto err_alloc;
                                         }
@@ -124,63 +180,478 @@ static int h264_init_parser(rtp_session * rtp_sess, unsigned pt)
                 }
         }
 
+        /* without interleaving the NAL units with a DON go straight out */
+        if (priv->depth < 0)
+                priv->depth = priv->interleaved ? H264_DEINT_MAX : 0;
+        else if (priv->depth > H264_DEINT_MAX)
+                priv->depth = H264_DEINT_MAX;
+
         rtp_sess->ptdefs[pt]->priv = priv;
 
         return 0;
 
 err_alloc:
+        free(priv->data);
         free(priv);
         return RTP_ERRALLOC;
 }
 
 static int h264_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
-        rtp_h264 *priv = ssrc->rtp_sess->ptdefs[pt]->priv;
+        rtp_h264 *priv = ssrc->privs[pt];
+        int i;
+
+        if (priv) {
+                for (i = 0; i < priv->deint_size; i++)
+                        free(priv->deint[i].data);
+                free(priv->deint);
+                free(priv->nals);
+        }
+        if (priv && priv->data)
+                free(priv->data);
+        if (priv)
+                free(priv);
+
+        ssrc->privs[pt] = NULL;
+
+        return 0;
+}
+
+static void h264_free_parser(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_h264_conf *priv = rtp_sess->ptdefs[pt]->priv;
 
         if (priv && priv->data)
                 free(priv->data);
-        if (priv && priv->conf)
-                free(priv->conf);
         if (priv)
                 free(priv);
 
-        ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+        rtp_sess->ptdefs[pt]->priv = NULL;
+}
+
+/**
+ * Gets the H.264 payload of a packet, past its header extension.
+ *
+ * @param pkt The packet
+ * @param len The packet size, replaced by the payload size
+ *
+ * @return the payload, NULL if the packet carries none
+ */
+static uint8_t *h264_payload(rtp_pkt * pkt, size_t * len)
+{
+        uint8_t *buf = RTP_PKT_DATA(pkt);
+        long size = RTP_PAYLOAD_SIZE(pkt, *len);
+        int ext_len;
+
+        /* syhou: add rtp packet extension parse */
+        if (RTP_PKT_EXT(pkt)) {
+                ext_len = RTP_PKT_EXT_LEN_HIGH(pkt) * 256 + RTP_PKT_EXT_LEN_LOW(pkt);
+                buf += 4 + ext_len * 4;
+                size -= 4 + ext_len * 4;
+        }
+        if (size <= 0)
+                return NULL;
+
+        *len = size;
+        return buf;
+}
+
+static uint8_t h264_start_seq[4] = {0, 0, 0, 1};
+
+/**
+ * Finds the NAL unit of the reordering stage which comes first in
+ * decoding order.
+ *
+ * @return its index in the stage
+ */
+static int h264_deint_first(rtp_h264 * priv)
+{
+        int i, first = 0;
+
+        for (i = 1; i < priv->deint_count; i++)
+                if ((int16_t) (priv->deint[i].don - priv->deint[first].don) < 0)
+                        first = i;
+
+        return first;
+}
+
+static void h264_deint_remove(rtp_h264 * priv, int i)
+{
+        rtp_h264_nal tmp = priv->deint[i];
+
+        priv->deint_bytes -= tmp.len;
+        priv->deint[i] = priv->deint[--priv->deint_count];
+        priv->deint[priv->deint_count] = tmp;
+}
+
+/**
+ * Gets the entry of the reordering stage for a new NAL unit, growing the
+ * stage if it is full. The units ready to go are handed out before each
+ * packet is parsed, so that it holds at most the interleaving depth plus
+ * the units of one aggregation packet.
+ *
+ * @return the entry, NULL if there is no memory
+ */
+static rtp_h264_nal *h264_deint_entry(rtp_h264 * priv)
+{
+        rtp_h264_nal *deint;
+        int size;
+
+        if (priv->deint_count == priv->deint_size) {
+                size = priv->deint_size ? priv->deint_size * 2 : 16;
+                if (!(deint = realloc(priv->deint, size * sizeof(*deint))))
+                        return NULL;
+                memset(deint + priv->deint_size, 0,
+                       (size - priv->deint_size) * sizeof(*deint));
+                priv->deint = deint;
+                priv->deint_size = size;
+        }
+
+        return &priv->deint[priv->deint_count];
+}
+
+/**
+ * Puts in the reordering stage the NAL unit just written in its entry.
+ */
+static void h264_deint_commit(rtp_h264 * priv, uint16_t don, uint32_t ts)
+{
+        rtp_h264_nal *nal = &priv->deint[priv->deint_count++];
+
+        nal->don = don;
+        nal->timestamp = ts;
+        priv->deint_bytes += nal->len;
+
+        if (!priv->don_valid || (int16_t) (don - priv->don_high) > 0)
+                priv->don_high = don;
+        priv->don_valid = 1;
+}
+
+/**
+ * Copies a NAL unit in the reordering stage.
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h264_deint_add(rtp_h264 * priv, uint16_t don, uint32_t ts,
+                          uint8_t * data, long len)
+{
+        rtp_h264_nal *nal = h264_deint_entry(priv);
+
+        if (!nal || nms_alloc_data(&nal->data, &nal->data_size,
+                           len + sizeof(h264_start_seq)))
+                return 1;
+        nal->len = 0;
+        nms_append_incr(nal->data, &nal->len, h264_start_seq,
+                        sizeof(h264_start_seq));
+        nms_append_incr(nal->data, &nal->len, data, len);
+        h264_deint_commit(priv, don, ts);
+
+        return 0;
+}
+
+/**
+ * Moves the NAL unit rebuilt from a FU-B and its FU-As in the reordering
+ * stage, trading buffers with it when it is alone in priv->data.
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h264_deint_add_fu(rtp_h264 * priv)
+{
+        rtp_h264_nal *nal;
+        uint8_t *data;
+        long size;
+
+        priv->fu_b = 0;
+        if (priv->au_len) {
+                data = priv->data + priv->au_len + sizeof(h264_start_seq);
+                size = priv->len - priv->au_len - sizeof(h264_start_seq);
+                priv->len = priv->au_len;
+                return h264_deint_add(priv, priv->fu_don, priv->timestamp,
+                                      data, size);
+        }
+
+        if (!(nal = h264_deint_entry(priv)))
+                return 1;
+        data = nal->data;
+        size = nal->data_size;
+        nal->data = priv->data;
+        nal->data_size = priv->data_size;
+        nal->len = priv->len;
+        priv->data = data;
+        priv->data_size = size;
+        priv->len = 0;
+        h264_deint_commit(priv, priv->fu_don, priv->timestamp);
+
+        return 0;
+}
+
+/**
+ * Moves the NAL units of a STAP-B or of a MTAP in the reordering stage.
+ * The NAL units of a STAP-B have consecutive DONs, in a MTAP each one
+ * has its own DON and timestamp offset.
+ *
+ * @return 0 on success, RTP_PARSE_ERROR if the packet has no NAL unit,
+ * RTP_ERRALLOC if there is no memory
+ */
+static int h264_deint_aggr(rtp_h264 * priv, rtp_pkt * pkt, uint8_t * buf,
+                           long len)
+{
+        int ts_len = (buf[0] & 0x1f) == 27 ? 3 :
+                     (buf[0] & 0x1f) == 26 ? 2 : 0;
+        uint16_t don = (buf[1] << 8) | buf[2];
+        uint8_t *src = buf + 3;
+        long src_len = len - 3;
+        uint16_t nal_size, nal_don;
+        uint32_t ts;
+        int i, count = 0;
+
+        while (src_len > 2) {   // because there could be rtp padding..
+                nal_size = nms_consume_BE2(&src);
+                src_len -= 2;
+                if (nal_size > src_len || nal_size <= 1 + ts_len) {
+                        nms_printf(NMSML_ERR,
+                                   "nal size exceeds length: %d %ld\n",
+                                   nal_size, src_len);
+                        break;
+                }
+                ts = RTP_PKT_TS(pkt);
+                if (ts_len) {   // DOND and timestamp offset
+                        nal_don = don + src[0];
+                        for (i = 1; i <= ts_len; i++)
+                                ts += src[i] << (8 * (ts_len - i));
+                        if (h264_deint_add(priv, nal_don, ts, src + 1 + ts_len,
+                                           nal_size - 1 - ts_len))
+                                return RTP_ERRALLOC;
+                } else if (h264_deint_add(priv, don++, ts, src, nal_size))
+                        return RTP_ERRALLOC;
+                count++;
+                src += nal_size;
+                src_len -= nal_size;
+        }
+
+        return count ? 0 : RTP_PARSE_ERROR;
+}
+
+/**
+ * Tells if the first NAL unit of the reordering stage can go: the stage
+ * holds more units than the interleaving depth or more bytes than the
+ * deinterleaving buffer, or the unit is further than sprop-max-don-diff
+ * from the highest DON received. Once the stream is over every unit goes.
+ *
+ * @return its index in the stage, -1 if it must wait
+ */
+static int h264_deint_ready(rtp_ssrc * ssrc, rtp_h264 * priv,
+                            rtp_h264_conf * conf)
+{
+        int first;
+
+        if (!priv->deint_count)
+                return -1;
+
+        first = h264_deint_first(priv);
+        if (conf && !rtp_stream_over(ssrc) && priv->deint_count <= conf->depth
+                        && (!conf->deint_buf_req
+                            || priv->deint_bytes <= conf->deint_buf_req)
+                        && (!conf->max_don_diff
+                            || (int16_t) (priv->don_high - priv->deint[first].don)
+                                    <= conf->max_don_diff))
+                return -1;
+
+        return first;
+}
+
+/**
+ * Makes room in priv->nals for the offset of one more NAL unit.
+ *
+ * @param count The offsets already there
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h264_nals_room(rtp_h264 * priv, int count)
+{
+        long *nals;
+        int size;
+
+        if (count == priv->nals_size) {
+                size = priv->nals_size ? priv->nals_size * 2 : 16;
+                if (!(nals = realloc(priv->nals, size * sizeof(*nals))))
+                        return 1;
+                priv->nals = nals;
+                priv->nals_size = size;
+        }
+
+        return 0;
+}
+
+/**
+ * Marks the start of a NAL unit at the end of priv->data.
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h264_nal_mark(rtp_h264 * priv)
+{
+        if (h264_nals_room(priv, priv->nal_count))
+                return 1;
+        priv->nals[priv->nal_count++] = priv->len;
 
         return 0;
 }
 
+/**
+ * Marks the start of a NAL unit at the end of a frame described in place.
+ * The offsets are kept in priv->nals.
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h264_iov_mark(rtp_h264 * priv, rtp_frame_iov * fr)
+{
+        if (h264_nals_room(priv, fr->nal_count))
+                return 1;
+        priv->nals[fr->nal_count++] = fr->len;
+        fr->nals = priv->nals;
+
+        return 0;
+}
+
+/**
+ * Drops the NAL unit being built, keeping the complete ones.
+ */
+static void h264_nal_drop(rtp_h264 * priv)
+{
+        priv->len = priv->au_len;
+        priv->nal_count = priv->au_nals;
+        priv->fu_b = 0;
+}
+
+/**
+ * Hands out the complete NAL units of priv->data as a frame.
+ */
+static int h264_au_out(rtp_h264 * priv, rtp_frame * fr)
+{
+        fr->data = priv->data;
+        fr->len = priv->au_len;
+        fr->timestamp = priv->au_ts;
+        fr->nals = priv->nals;
+        fr->nal_count = priv->au_nals;
+
+        priv->len = priv->au_len = 0;
+        priv->nal_count = priv->au_nals = 0;
+
+        return RTP_FILL_OK;
+}
+
+/**
+ * Ends the NAL units just completed in priv->data: they are a frame of
+ * their own, or with rtp_set_access_units they join the access unit
+ * being gathered, which ends at the marker bit.
+ *
+ * @return RTP_FILL_OK if fr holds a frame, EAGAIN otherwise
+ */
+static int h264_nal_end(rtp_ssrc * ssrc, rtp_h264 * priv, rtp_frame * fr,
+                        int mark, uint32_t ts)
+{
+        priv->au_len = priv->len;
+        priv->au_nals = priv->nal_count;
+        priv->au_ts = ts;
+
+        if (ssrc->rtp_sess->access_units && !mark)
+                return EAGAIN;
+
+        return h264_au_out(priv, fr);
+}
+
+/**
+ * Hands out a NAL unit of the reordering stage. It is moved to priv->data,
+ * trading buffers when nothing is gathered there. An access unit being
+ * gathered is handed out first if the NAL unit does not belong to it.
+ *
+ * @return RTP_FILL_OK if fr holds a frame, EAGAIN otherwise, RTP_ERRALLOC
+ */
+static int h264_deint_next(rtp_ssrc * ssrc, rtp_h264 * priv, rtp_frame * fr,
+                           int first)
+{
+        rtp_h264_nal *nal = &priv->deint[first];
+        uint32_t ts = nal->timestamp;
+        uint8_t *data;
+        long size;
+
+        if (priv->au_len && ts != priv->au_ts)
+                return h264_au_out(priv, fr);
+
+        if (h264_nal_mark(priv))
+                return RTP_ERRALLOC;
+        if (!priv->len) {
+                data = priv->data;
+                size = priv->data_size;
+                priv->data = nal->data;
+                priv->data_size = nal->data_size;
+                priv->len = nal->len;
+                nal->data = data;
+                nal->data_size = size;
+        } else {
+                if (nms_alloc_data(&priv->data, &priv->data_size,
+                                   priv->len + nal->len)) {
+                        priv->nal_count--;
+                        return RTP_ERRALLOC;
+                }
+                nms_append_incr(priv->data, &priv->len, nal->data, nal->len);
+        }
+        h264_deint_remove(priv, first);
+
+        return h264_nal_end(ssrc, priv, fr, 0, ts);
+}
+
 /**
  * it should return a h264 frame either by unpacking an aggregate
- * or by fetching more than a single rtp packet
+ * or by fetching more than a single rtp packet.
+ * The NAL units carrying a DON (STAP-B, MTAP, FU-B) go through the
+ * reordering stage first, and come out one per call in decoding order.
+ * With rtp_set_access_units the NAL units are gathered instead, and come
+ * out together when the marker bit or the next timestamp ends them.
+ * The frame tells where each NAL unit starts.
  */
 
 static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 {
         rtp_pkt *pkt;
         size_t len;
-        rtp_h264 *priv = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_h264 *priv;
+        rtp_h264_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
         uint8_t *buf;
-		uint8_t *buf_ext;
         uint8_t type;
         uint8_t start_seq[4] = {0, 0, 0, 1};
         int err = RTP_FILL_OK;
-		int ext = 0;
-		int ext_len, ext_len1, ext_len2;
-        if (!(pkt = rtp_get_pkt(ssrc, &len)))
+        int first;
+        if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_h264))))
+                return RTP_ERRALLOC;
+
+        if (conf && conf->len) {
+                config->data = conf->data;
+                config->len = conf->len;
+        }
+
+        /* the NAL units ready in the reordering stage come first */
+        while ((first = h264_deint_ready(ssrc, priv, conf)) >= 0)
+                if ((err = h264_deint_next(ssrc, priv, fr, first)) != EAGAIN)
+                        return err;
+        err = RTP_FILL_OK;
+
+        if (!(pkt = rtp_get_pkt(ssrc, &len))) {
+                /* no packet will end the access unit gathered */
+                if (priv->au_len && rtp_stream_over(ssrc))
+                        return h264_au_out(priv, fr);
                 return RTP_BUFF_EMPTY;
+        }
+        /* the access unit gathered ends where the timestamp changes; the
+         * interleaved ones are gathered in decoding order, out of the
+         * reordering stage, and end in h264_deint_next */
+        if (priv->au_len && (!conf || !conf->interleaved)
+                        && RTP_PKT_TS(pkt) != priv->au_ts)
+                return h264_au_out(priv, fr);
 		//printf("rtp_get_pkt size=%d\n", len);
-        buf = RTP_PKT_DATA(pkt);
-        len = RTP_PAYLOAD_SIZE(pkt, len);
-		/* syhou: add rtp packet extension parse */
-		ext = RTP_PKT_EXT(pkt);
-		if (ext == 1){
-			ext_len1 = RTP_PKT_EXT_LEN_LOW(pkt);
-			ext_len2 = RTP_PKT_EXT_LEN_HIGH(pkt);
-			ext_len = ext_len2 * 256 + ext_len1;
-			//printf("ext_len=%d!!\n", ext_len);
-			buf = buf + 4 + ext_len * 4;
-			len = len - 4 - ext_len * 4;
-		}
+        if (!(buf = h264_payload(pkt, &len))) {
+                rtp_rm_pkt(ssrc);
+                return RTP_PKT_UNKNOWN;
+        }
         type = (buf[0] & 0x1f);
 #ifdef PKT_DBG
 		if(len){
@@ -211,23 +682,27 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 #if 0 //lchen, SPS/PPS will write outside
         // In order to produce a compliant bitstream, a PPS NALU should prefix
         // the data stream.
-        if (!priv->configured && priv->conf_len) {
-                if (nms_alloc_data(&priv->data, &priv->data_size, priv->conf_len)) {
+        if (!priv->configured && conf && conf->len) {
+                if (nms_alloc_data(&priv->data, &priv->data_size, conf->len)) {
                         return RTP_ERRALLOC;
                 }
-                nms_append_incr(priv->data, &priv->len, priv->conf, priv->conf_len);
+                nms_append_incr(priv->data, &priv->len, conf->data, conf->len);
                 priv->configured = 1;
         }
 #endif
 
-        if (priv->conf_len) {
-                config->data = priv->conf;
-                config->len = priv->conf_len;
-        }
 		//priv->timestamp = RTP_PKT_TS(pkt);
 
         if (type >= 1 && type <= 23) type = 1; // single packet
 
+        /* a FU-A fragment continues the NAL unit being built, anything
+         * else starts a new one */
+        if (priv->len != priv->au_len
+                        && (type != 28 || (len > 1 && (buf[1] & 0x80)))) {
+                nms_printf(NMSML_WARN, "fragment start but buff is not zero\n");
+                h264_nal_drop(priv);
+        }
+
         switch (type) {
         case 0: // undefined;
                 err = RTP_PKT_UNKNOWN;
@@ -237,14 +712,14 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 		//nms_printf(NMSML_WARN,"nal size exceeds length: %d\n",len+4);
 
                 if (nms_alloc_data(&priv->data, &priv->data_size,
-                                   len + sizeof(start_seq) + priv->len)) {
+                                   len + sizeof(start_seq) + priv->len)
+                                || h264_nal_mark(priv)) {
                         return RTP_ERRALLOC;
                 }
                 nms_append_incr(priv->data, &priv->len, start_seq, sizeof(start_seq));
                 nms_append_incr(priv->data, &priv->len, buf, len);
-                fr->data = priv->data;
-                fr->len = priv->len;
-                priv->len = 0;
+                err = h264_nal_end(ssrc, priv, fr, RTP_PKT_MARK(pkt),
+                                   RTP_PKT_TS(pkt));
                 break;
         case 24:    // STAP-A (aggregate, output as whole or split it?)
 #if 0
@@ -298,6 +773,8 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
                                                 if (pass==0) {
                                                         total_length += sizeof(start_seq) + nal_size;
                                                 } else {
+                                                        if (h264_nal_mark(priv))
+                                                                return RTP_ERRALLOC;
                                                         nms_append_incr(priv->data, &priv->len, start_seq,
                                                                         sizeof(start_seq));
                                                         nms_append_incr(priv->data, &priv->len, src,
@@ -326,24 +803,49 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
                                 }
                         }
                 }
-                fr->data = priv->data;
-                fr->len = priv->len;
-                priv->len = 0;
+                err = h264_nal_end(ssrc, priv, fr, RTP_PKT_MARK(pkt),
+                                   RTP_PKT_TS(pkt));
                 break;
 #endif
-                /* Unsupported for now */
         case 25:    // STAP-B
-                err = RTP_PKT_UNKNOWN;
-                nms_printf (NMSML_WARN,"STAP-B\n");
-                break;
         case 26:    // MTAP-16
-                err = RTP_PKT_UNKNOWN;
-                nms_printf (NMSML_WARN,"MTAP-16\n");
-                break;
         case 27:    // MTAP-24
-                nms_printf (NMSML_WARN,"MTAP-24\n");
-                err = RTP_PKT_UNKNOWN;
+                if (len < 3) {
+                        err = RTP_PARSE_ERROR;
+                        break;
+                }
+                if (!(err = h264_deint_aggr(priv, pkt, buf, len)))
+                        err = EAGAIN; /* out of the reordering stage */
                 break;
+        case 29: {  // FU-B, the first FU-A of a NAL unit, with its DON
+                uint8_t fu_header = buf[1];
+                uint8_t reconstructed_nal = (buf[0] & 0xe0) | (fu_header & 0x1f);
+
+                if (len < 4 || !(fu_header & 0x80)) {
+                        err = RTP_PARSE_ERROR;
+                        break;
+                }
+                if (nms_alloc_data(&priv->data, &priv->data_size,
+                                   len - 4 + 1 + sizeof(start_seq) + priv->len)) {
+                        nms_printf(NMSML_WARN, "no memory\n");
+                        return RTP_ERRALLOC;
+                }
+                nms_append_incr(priv->data, &priv->len, start_seq,
+                                sizeof(start_seq));
+                nms_append_incr(priv->data, &priv->len, &reconstructed_nal, 1);
+                nms_append_incr(priv->data, &priv->len, buf + 4, len - 4);
+                priv->fu_b = 1;
+                priv->fu_don = (buf[2] << 8) | buf[3];
+                priv->timestamp = RTP_PKT_TS(pkt);
+                if (!(fu_header & 0x40)) {
+                        err = EAGAIN; /* the rest comes in FU-As */
+                } else if (h264_deint_add_fu(priv)) {
+                        err = RTP_ERRALLOC;
+                } else {
+                        err = EAGAIN; /* out of the reordering stage */
+                }
+        }
+        break;
 
         case 28: {  // FU-A (fragmented nal, output frags or aggregate it)
                 uint8_t fu_indicator = nms_consume_1(&buf);  // read the fu_indicator
@@ -361,16 +863,6 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
                 reconstructed_nal = fu_indicator & 0xe0;
                 reconstructed_nal |= nal_type;
 
-                // lchen
-				if (start_bit && priv->len != 0) {
-					nms_printf(NMSML_WARN, "fragment start but buff is not zero\n");
-#if 1
-                    priv->len = 0;
-#else
-                    priv->len = 0;
-                    priv->timestamp = RTP_PKT_TS(pkt);
-#endif
-				}
 				if (start_bit == 1)
 				{
 					//printf("start_bit == 1 in parse!\n");
@@ -379,9 +871,11 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 					//printf("start_bit == 0 in parse!\n");
 				}
 				
-                if (start_bit && !priv->len) {
+                if (start_bit) {
+                        priv->fu_b = 0;
                         if (nms_alloc_data(&priv->data, &priv->data_size,
-                                           len + 1 + sizeof(start_seq) + priv->len)) {
+                                           len + 1 + sizeof(start_seq) + priv->len)
+                                        || h264_nal_mark(priv)) {
                                 nms_printf(NMSML_WARN, "no memory\n");
                                 return RTP_ERRALLOC;
                         }
@@ -391,19 +885,12 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
                         nms_append_incr(priv->data, &priv->len, &reconstructed_nal, 1);
                         nms_append_incr(priv->data, &priv->len, buf, len);
                 } else { /* inter or end */
-                        if (priv->timestamp != RTP_PKT_TS(pkt)) {
-#if 1
-							    nms_printf(NMSML_WARN, "rtp timestamp not same\n");
-                                fr->len = priv->len = 0;
-                                rtp_rm_pkt(ssrc);
-                                return RTP_PKT_UNKNOWN;
-#else
+                        if (priv->len == priv->au_len
+                                        || priv->timestamp != RTP_PKT_TS(pkt)) {
 							    nms_printf(NMSML_WARN, "rtp timestamp not same\n");
-                                priv->timestamp = RTP_PKT_TS(pkt);
-                                fr->len = priv->len = 0;
+                                h264_nal_drop(priv);
                                 rtp_rm_pkt(ssrc);
                                 return RTP_PKT_UNKNOWN;
-#endif
                         }
                         if (nms_alloc_data(&priv->data, &priv->data_size,
                                            len + priv->len)) {
@@ -416,10 +903,11 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
                 priv->timestamp = RTP_PKT_TS(pkt);
                 if (!end_bit) {
                         err = EAGAIN; /* to parser again */
+                } else if (priv->fu_b) { /* whole NALU got, to reorder */
+                        err = h264_deint_add_fu(priv) ? RTP_ERRALLOC : EAGAIN;
                 } else { /* whole NALU got */
-                        fr->data = priv->data;
-                        fr->len = priv->len;
-                        priv->len = 0;
+                        err = h264_nal_end(ssrc, priv, fr, RTP_PKT_MARK(pkt),
+                                           priv->timestamp);
                 }
         }
         break;
@@ -439,4 +927,140 @@ static int h264_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
         return err;
 }
 
-RTP_PARSER_FULL(h264);
+/**
+ * Like h264_parse, but the NAL units are described in place, see
+ * rtp_fill_buffer_iov: each one starts with h264_start_seq and the
+ * FU-A fragments are chained after the NAL header rebuilt over the FU
+ * header of the first one.
+ * The NAL units of interleaved streams, and the access units, are
+ * gathered in a copy by h264_parse and handed out as a single piece,
+ * valid until the next call.
+ */
+static int h264_parse_iov(rtp_ssrc * ssrc, rtp_frame_iov * fr,
+                          rtp_buff * config)
+{
+        rtp_h264_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_h264 *priv;
+        rtp_frame copy;
+        rtp_pkt *pkt;
+        size_t len;
+        uint8_t *buf, *src;
+        uint8_t type, fu_header;
+        uint16_t nal_size;
+        int src_len, err;
+
+        if ((conf && conf->interleaved) || ssrc->rtp_sess->access_units) {
+                memset(&copy, 0, sizeof(copy));
+                copy.pt = fr->pt;
+                copy.timestamp = fr->timestamp;
+                if ((err = h264_parse(ssrc, &copy, config)) == RTP_FILL_OK) {
+                        fr->timestamp = copy.timestamp;
+                        fr->nals = copy.nals;
+                        fr->nal_count = copy.nal_count;
+                        if (rtp_frame_iov_add(fr, copy.data, copy.len))
+                                return RTP_ERRALLOC;
+                }
+                return err;
+        }
+
+        if (!(pkt = rtp_get_pkt(ssrc, &len)))
+                return RTP_BUFF_EMPTY;
+        if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_h264))))
+                return RTP_ERRALLOC;
+        if (!(buf = h264_payload(pkt, &len))) {
+                rtp_rm_pkt(ssrc);
+                return RTP_PKT_UNKNOWN;
+        }
+        type = (buf[0] & 0x1f);
+
+        if (conf && conf->len) {
+                config->data = conf->data;
+                config->len = conf->len;
+        }
+
+        if (type >= 1 && type <= 23) type = 1; // single packet
+
+        /* a FU-A fragment continues the NAL unit in the frame, anything
+         * else starts a new one */
+        if (fr->iovcnt && (type != 28 || (len > 1 && (buf[1] & 0x80)))) {
+                nms_printf(NMSML_WARN, "fragment start but buff is not zero\n");
+                rtp_frame_iov_release(fr);
+        }
+        if (!fr->iovcnt)
+                fr->timestamp = RTP_PKT_TS(pkt);
+
+        switch (type) {
+        case 1:
+                if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                        return err;
+                if (h264_iov_mark(priv, fr)
+                                || rtp_frame_iov_add(fr, h264_start_seq, sizeof(h264_start_seq))
+                                || rtp_frame_iov_add(fr, buf, len))
+                        goto err_alloc;
+                return RTP_FILL_OK;
+        case 24:    // STAP-A
+                if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                        return err;
+                src = buf + 1;
+                src_len = len - 1;
+                while (src_len > 2) {   // because there could be rtp padding..
+                        nal_size = nms_consume_BE2(&src);
+                        src_len -= 2;
+                        if (nal_size > src_len) {
+                                nms_printf(NMSML_ERR,
+                                           "nal size exceeds length: %d %d\n",
+                                           nal_size, src_len);
+                                break;
+                        }
+                        if (h264_iov_mark(priv, fr)
+                                        || rtp_frame_iov_add(fr, h264_start_seq, sizeof(h264_start_seq))
+                                        || rtp_frame_iov_add(fr, src, nal_size))
+                                goto err_alloc;
+                        src += nal_size;
+                        src_len -= nal_size;
+                }
+                if (!fr->iovcnt) {
+                        rtp_frame_iov_release(fr);
+                        return RTP_PARSE_ERROR;
+                }
+                return RTP_FILL_OK;
+        case 28:    // FU-A
+                if (len < 2) {
+                        rtp_rm_pkt(ssrc);
+                        return RTP_PARSE_ERROR;
+                }
+                fu_header = buf[1];
+                if (fu_header & 0x80) {
+                        if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                                return err;
+                        // the original nal forbidden bit and NRI are stored in
+                        // this packet's nal, the type in the fu header
+                        buf[1] = (buf[0] & 0xe0) | (fu_header & 0x1f);
+                        if (h264_iov_mark(priv, fr)
+                                        || rtp_frame_iov_add(fr, h264_start_seq, sizeof(h264_start_seq))
+                                        || rtp_frame_iov_add(fr, buf + 1, len - 1))
+                                goto err_alloc;
+                } else {
+                        if (!fr->iovcnt || fr->timestamp != RTP_PKT_TS(pkt)) {
+                                nms_printf(NMSML_WARN, "rtp timestamp not same\n");
+                                rtp_frame_iov_release(fr);
+                                rtp_rm_pkt(ssrc);
+                                return RTP_PKT_UNKNOWN;
+                        }
+                        if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                                return err;
+                        if (rtp_frame_iov_add(fr, buf + 2, len - 2))
+                                goto err_alloc;
+                }
+                return (fu_header & 0x40) ? RTP_FILL_OK : EAGAIN;
+        default:
+                rtp_rm_pkt(ssrc);
+                return RTP_PKT_UNKNOWN;
+        }
+
+err_alloc:
+        rtp_frame_iov_release(fr);
+        return RTP_ERRALLOC;
+}
+
+RTP_PARSER_FULL_IOV(h264);
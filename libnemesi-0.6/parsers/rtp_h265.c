@@ -0,0 +1,492 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+#include "rtpparser.h"
+#include "rtp_utils.h"
+
+/**
+ * @file rtp_h265.c
+ * H.265/HEVC depacketizer RFC 7798
+ */
+
+#define H265_NAL_TYPE(buf)  (((buf)[0] >> 1) & 0x3f)
+
+/**
+ * Local structure, contains data necessary to compose a h265 frame out
+ * of rtp fragments and set the correct timings. There is one per source.
+ */
+
+typedef struct {
+        uint8_t *data;     //!< constructed frame, fragments will be copied there
+        long len;          //!< buf length, it's the sum of the fragments length
+        long data_size;    //!< allocated bytes for data
+        unsigned long timestamp;    //!< timestamp of progressive frame
+} rtp_h265;
+
+/**
+ * Parameter sets announced in the sdp, shared by the sources.
+ */
+
+typedef struct {
+        uint8_t *data;     //!< VPS, SPS, PPS and SEI, each after a start sequence
+        long len;
+        int donl;          //!< set if the packets carry decoding order numbers
+} rtp_h265_conf;
+
+static rtpparser_info h265_served = {
+        -1,
+        {"H265", NULL}
+};
+
+static uint8_t h265_start_seq[4] = {0, 0, 0, 1};
+
+/* in the order the decoder wants them */
+static const char *h265_sprops[] = {
+        "sprop-vps", "sprop-sps", "sprop-pps", "sprop-sei", NULL
+};
+
+/**
+ * Appends the comma separated, base64 encoded NAL units of a sprop
+ * parameter to the configuration.
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h265_add_sprop(rtp_h265_conf * priv, char *v)
+{
+        char base64packet[1024];
+        uint8_t decoded_packet[1024];
+        uint8_t *dest;
+        char *dst;
+        int packet_size;
+
+        while (*v) {
+                dst = base64packet;
+                while (*v && *v != ','
+                                && (dst - base64packet) < sizeof(base64packet) - 1)
+                        *dst++ = *v++;
+                *dst = '\0';
+                while (*v && *v++ != ',');
+
+                packet_size = nms_base64_decode(decoded_packet, base64packet,
+                                                sizeof(decoded_packet));
+                if (packet_size <= 0)
+                        continue;
+
+                if (!(dest = realloc(priv->data, priv->len +
+                                     sizeof(h265_start_seq) + packet_size)))
+                        return 1;
+                priv->data = dest;
+                nms_append_incr(priv->data, &priv->len, h265_start_seq,
+                                sizeof(h265_start_seq));
+                nms_append_incr(priv->data, &priv->len, decoded_packet,
+                                packet_size);
+        }
+
+        return 0;
+}
+
+static int h265_init_parser(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_h265_conf *priv = calloc(1, sizeof(rtp_h265_conf));
+        rtp_pt_attrs *attrs = &rtp_sess->ptdefs[pt]->attrs;
+        char value[1024];
+        int i, j;
+
+        if (!priv) return RTP_ERRALLOC;
+
+        for (j = 0; h265_sprops[j]; j++) {
+                for (i = 0; i < attrs->size; i++) {
+                        if (nms_get_attr_value(attrs->data[i], h265_sprops[j],
+                                               value, sizeof(value))
+                                        && h265_add_sprop(priv, value))
+                                goto err_alloc;
+                }
+        }
+
+        for (i = 0; i < attrs->size; i++) {
+                if (nms_get_attr_value(attrs->data[i], "sprop-max-don-diff",
+                                       value, sizeof(value)))
+                        priv->donl = atoi(value) > 0;
+        }
+
+        rtp_sess->ptdefs[pt]->priv = priv;
+
+        return 0;
+
+err_alloc:
+        free(priv->data);
+        free(priv);
+        return RTP_ERRALLOC;
+}
+
+static int h265_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
+{
+        rtp_h265 *priv = ssrc->privs[pt];
+
+        if (priv && priv->data)
+                free(priv->data);
+        if (priv)
+                free(priv);
+
+        ssrc->privs[pt] = NULL;
+
+        return 0;
+}
+
+static void h265_free_parser(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_h265_conf *priv = rtp_sess->ptdefs[pt]->priv;
+
+        if (priv && priv->data)
+                free(priv->data);
+        if (priv)
+                free(priv);
+
+        rtp_sess->ptdefs[pt]->priv = NULL;
+}
+
+/**
+ * Tells if the packets of an H.265 payload type carry decoding order
+ * numbers, announced by a sprop-max-don-diff above 0.
+ *
+ * @param rtp_sess The session of the payload type
+ * @param pt A payload type served by the H.265 parser
+ *
+ * @return 1 if they do, 0 otherwise
+ */
+int rtp_h265_donl(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_h265_conf *conf = rtp_sess->ptdefs[pt]->priv;
+
+        return conf && conf->donl;
+}
+
+/**
+ * Gets the H.265 payload of a packet, past its header extension.
+ *
+ * @param pkt The packet
+ * @param len The packet size, replaced by the payload size
+ *
+ * @return the payload, NULL if it is too short for a payload header
+ * and some data
+ */
+static uint8_t *h265_payload(rtp_pkt * pkt, size_t * len)
+{
+        uint8_t *buf = RTP_PKT_DATA(pkt);
+        long size = RTP_PAYLOAD_SIZE(pkt, *len);
+        int ext_len;
+
+        if (RTP_PKT_EXT(pkt)) {
+                ext_len = RTP_PKT_EXT_LEN_HIGH(pkt) * 256 + RTP_PKT_EXT_LEN_LOW(pkt);
+                buf += 4 + ext_len * 4;
+                size -= 4 + ext_len * 4;
+        }
+        if (size < 3)
+                return NULL;
+
+        *len = size;
+        return buf;
+}
+
+/**
+ * Appends data to the frame being built, growing it by doubling.
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+static int h265_append(rtp_h265 * priv, uint8_t * data, long len)
+{
+        long size = priv->data_size * 2;
+
+        if (priv->len + len > priv->data_size) {
+                if (size < priv->len + len)
+                        size = priv->len + len;
+                if (nms_alloc_data(&priv->data, &priv->data_size, size))
+                        return 1;
+        }
+        nms_append_incr(priv->data, &priv->len, data, len);
+
+        return 0;
+}
+
+/**
+ * it returns a h265 frame: a single NAL unit, all the NAL units of an
+ * aggregation packet or a NAL unit rebuilt from its fragments, each
+ * after a start sequence
+ */
+
+static int h265_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
+{
+        rtp_h265_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        int donl = (conf && conf->donl) ? 2 : 0;
+        rtp_h265 *priv;
+        rtp_pkt *pkt;
+        size_t len;
+        uint8_t *buf, *src;
+        uint8_t type, fu_header, nal[2];
+        uint16_t nal_size;
+        int src_len, skip;
+        int err = RTP_FILL_OK;
+
+        if (!(pkt = rtp_get_pkt(ssrc, &len)))
+                return RTP_BUFF_EMPTY;
+        if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_h265))))
+                return RTP_ERRALLOC;
+        if (!(buf = h265_payload(pkt, &len))) {
+                rtp_rm_pkt(ssrc);
+                return RTP_PKT_UNKNOWN;
+        }
+        type = H265_NAL_TYPE(buf);
+
+        if (conf && conf->len) {
+                config->data = conf->data;
+                config->len = conf->len;
+        }
+
+        if (type < 48) type = 0; // single NAL unit packet
+
+        /* a FU continues the NAL unit being built, anything else starts
+         * a new one */
+        if (priv->len && (type != 49 || (buf[2] & 0x80))) {
+                nms_printf(NMSML_WARN, "fragment start but buff is not zero\n");
+                priv->len = 0;
+        }
+
+        switch (type) {
+        case 0:
+                if (len < 2 + donl) {
+                        err = RTP_PARSE_ERROR;
+                        break;
+                }
+                if (h265_append(priv, h265_start_seq, sizeof(h265_start_seq))
+                                || h265_append(priv, buf, 2)
+                                || h265_append(priv, buf + 2 + donl, len - 2 - donl))
+                        return RTP_ERRALLOC;
+                fr->data = priv->data;
+                fr->len = priv->len;
+                priv->len = 0;
+                break;
+        case 48:    // AP, the DONL of the first NAL unit and the DOND of the others are skipped
+                src = buf + 2;
+                src_len = len - 2;
+                skip = donl;
+                while (src_len > 2 + skip) {    // because there could be rtp padding..
+                        src += skip;
+                        src_len -= skip;
+                        skip = donl ? 1 : 0;
+                        nal_size = nms_consume_BE2(&src);
+                        src_len -= 2;
+                        if (nal_size > src_len) {
+                                nms_printf(NMSML_ERR,
+                                           "nal size exceeds length: %d %d\n",
+                                           nal_size, src_len);
+                                break;
+                        }
+                        if (h265_append(priv, h265_start_seq, sizeof(h265_start_seq))
+                                        || h265_append(priv, src, nal_size))
+                                return RTP_ERRALLOC;
+                        src += nal_size;
+                        src_len -= nal_size;
+                }
+                if (!priv->len) {
+                        err = RTP_PARSE_ERROR;
+                        break;
+                }
+                fr->data = priv->data;
+                fr->len = priv->len;
+                priv->len = 0;
+                break;
+        case 49:    // FU
+                fu_header = buf[2];
+                if (fu_header & 0x80) {
+                        if (len < 3 + donl) {
+                                err = RTP_PARSE_ERROR;
+                                break;
+                        }
+                        // forbidden bit, layer id and tid come from the
+                        // payload header, the type from the fu header
+                        nal[0] = (buf[0] & 0x81) | ((fu_header & 0x3f) << 1);
+                        nal[1] = buf[1];
+                        if (h265_append(priv, h265_start_seq, sizeof(h265_start_seq))
+                                        || h265_append(priv, nal, 2)
+                                        || h265_append(priv, buf + 3 + donl, len - 3 - donl))
+                                return RTP_ERRALLOC;
+                } else if (!priv->len || priv->timestamp != RTP_PKT_TS(pkt)) {
+                        nms_printf(NMSML_WARN, "rtp timestamp not same\n");
+                        priv->len = 0;
+                        err = RTP_PKT_UNKNOWN;
+                        break;
+                } else if (h265_append(priv, buf + 3, len - 3)) {
+                        return RTP_ERRALLOC;
+                }
+
+                priv->timestamp = RTP_PKT_TS(pkt);
+                if (!(fu_header & 0x40)) {
+                        err = EAGAIN; /* to parser again */
+                } else { /* whole NALU got */
+                        fr->data = priv->data;
+                        fr->len = priv->len;
+                        priv->len = 0;
+                }
+                break;
+        case 50:    // PACI
+        default:
+                err = RTP_PKT_UNKNOWN;
+                break;
+        }
+
+        rtp_rm_pkt(ssrc);
+
+        return err;
+}
+
+/**
+ * Like h265_parse, but the NAL units are described in place, see
+ * rtp_fill_buffer_iov: each one starts with h265_start_seq, and the NAL
+ * unit headers which are not next to their data are rebuilt there, over
+ * the DONL or the FU header.
+ */
+static int h265_parse_iov(rtp_ssrc * ssrc, rtp_frame_iov * fr,
+                          rtp_buff * config)
+{
+        rtp_h265_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        int donl = (conf && conf->donl) ? 2 : 0;
+        rtp_pkt *pkt;
+        size_t len;
+        uint8_t *buf, *src;
+        uint8_t type, fu_header, nal[2];
+        uint16_t nal_size;
+        int src_len, skip, err;
+
+        if (!(pkt = rtp_get_pkt(ssrc, &len)))
+                return RTP_BUFF_EMPTY;
+        if (!(buf = h265_payload(pkt, &len))) {
+                rtp_rm_pkt(ssrc);
+                return RTP_PKT_UNKNOWN;
+        }
+        type = H265_NAL_TYPE(buf);
+
+        if (conf && conf->len) {
+                config->data = conf->data;
+                config->len = conf->len;
+        }
+
+        if (type < 48) type = 0; // single NAL unit packet
+
+        /* a FU continues the NAL unit in the frame, anything else starts
+         * a new one */
+        if (fr->iovcnt && (type != 49 || (buf[2] & 0x80))) {
+                nms_printf(NMSML_WARN, "fragment start but buff is not zero\n");
+                rtp_frame_iov_release(fr);
+        }
+        if (!fr->iovcnt)
+                fr->timestamp = RTP_PKT_TS(pkt);
+
+        switch (type) {
+        case 0:
+                if (len < 2 + donl) {
+                        rtp_rm_pkt(ssrc);
+                        return RTP_PARSE_ERROR;
+                }
+                if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                        return err;
+                if (donl) {
+                        buf[3] = buf[1];
+                        buf[2] = buf[0];
+                        buf += 2;
+                        len -= 2;
+                }
+                if (rtp_frame_iov_add(fr, h265_start_seq, sizeof(h265_start_seq))
+                                || rtp_frame_iov_add(fr, buf, len))
+                        goto err_alloc;
+                return RTP_FILL_OK;
+        case 48:    // AP
+                if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                        return err;
+                src = buf + 2;
+                src_len = len - 2;
+                skip = donl;
+                while (src_len > 2 + skip) {    // because there could be rtp padding..
+                        src += skip;
+                        src_len -= skip;
+                        skip = donl ? 1 : 0;
+                        nal_size = nms_consume_BE2(&src);
+                        src_len -= 2;
+                        if (nal_size > src_len) {
+                                nms_printf(NMSML_ERR,
+                                           "nal size exceeds length: %d %d\n",
+                                           nal_size, src_len);
+                                break;
+                        }
+                        if (rtp_frame_iov_add(fr, h265_start_seq, sizeof(h265_start_seq))
+                                        || rtp_frame_iov_add(fr, src, nal_size))
+                                goto err_alloc;
+                        src += nal_size;
+                        src_len -= nal_size;
+                }
+                if (!fr->iovcnt) {
+                        rtp_frame_iov_release(fr);
+                        return RTP_PARSE_ERROR;
+                }
+                return RTP_FILL_OK;
+        case 49:    // FU
+                fu_header = buf[2];
+                if (fu_header & 0x80) {
+                        if (len < 3 + donl) {
+                                rtp_rm_pkt(ssrc);
+                                return RTP_PARSE_ERROR;
+                        }
+                        if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                                return err;
+                        nal[0] = (buf[0] & 0x81) | ((fu_header & 0x3f) << 1);
+                        nal[1] = buf[1];
+                        buf += 1 + donl;
+                        len -= 1 + donl;
+                        buf[0] = nal[0];
+                        buf[1] = nal[1];
+                        if (rtp_frame_iov_add(fr, h265_start_seq, sizeof(h265_start_seq))
+                                        || rtp_frame_iov_add(fr, buf, len))
+                                goto err_alloc;
+                } else {
+                        if (!fr->iovcnt || fr->timestamp != RTP_PKT_TS(pkt)) {
+                                nms_printf(NMSML_WARN, "rtp timestamp not same\n");
+                                rtp_frame_iov_release(fr);
+                                rtp_rm_pkt(ssrc);
+                                return RTP_PKT_UNKNOWN;
+                        }
+                        if ((err = rtp_frame_iov_hold(ssrc, fr)))
+                                return err;
+                        if (rtp_frame_iov_add(fr, buf + 3, len - 3))
+                                goto err_alloc;
+                }
+                return (fu_header & 0x40) ? RTP_FILL_OK : EAGAIN;
+        case 50:    // PACI
+        default:
+                rtp_rm_pkt(ssrc);
+                return RTP_PKT_UNKNOWN;
+        }
+
+err_alloc:
+        rtp_frame_iov_release(fr);
+        return RTP_ERRALLOC;
+}
+
+RTP_PARSER_FULL_IOV(h265);
@@ -31,7 +31,7 @@
 
 /**
  * Local structure, contains data necessary to compose a m4v frame out
- * of rtp fragments.
+ * of rtp fragments. There is one per source.
  */
 
 typedef struct {
@@ -39,11 +39,18 @@ typedef struct {
         long len;       //!< buf length, it's the sum of the fragments length
         long data_size; //!< allocated bytes for data
         unsigned long timestamp; //!< timestamp of progressive frame
-        uint8_t *conf;
-        long conf_len;
         int configured;
 } rtp_m4v;
 
+/**
+ * Configuration announced in the sdp, shared by the sources.
+ */
+
+typedef struct {
+        uint8_t *data;  //!< the 'VOL Header'
+        long len;
+} rtp_m4v_conf;
+
 static rtpparser_info m4v_served = {
         -1,
         {"MP4V-ES", NULL}
@@ -51,7 +58,7 @@ static rtpparser_info m4v_served = {
 
 static int m4v_init_parser(rtp_session * rtp_sess, unsigned pt)
 {
-        rtp_m4v *priv = calloc(1, sizeof(rtp_m4v));
+        rtp_m4v_conf *priv = calloc(1, sizeof(rtp_m4v_conf));
         rtp_pt_attrs *attrs = &rtp_sess->ptdefs[pt]->attrs;
         char value[1024];
         uint8_t buffer[1024];
@@ -67,10 +74,10 @@ static int m4v_init_parser(rtp_session * rtp_sess, unsigned pt)
                                 *(value + v_len) = '\0';
                                 if ((len = nms_hex_decode(buffer, value, sizeof(buffer))) < 0)
                                         goto err_alloc;
-                                if (!(priv->conf = realloc(priv->conf, priv->conf_len + len)))
+                                if (!(priv->data = realloc(priv->data, priv->len + len)))
                                         goto err_alloc;
-                                memcpy(priv->conf + priv->conf_len, buffer, len);
-                                priv->conf_len += len;
+                                memcpy(priv->data + priv->len, buffer, len);
+                                priv->len += len;
                         }
                 }
         }
@@ -88,20 +95,30 @@ err_alloc:
 
 static int m4v_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
-        rtp_m4v *priv = ssrc->rtp_sess->ptdefs[pt]->priv;
+        rtp_m4v *priv = ssrc->privs[pt];
 
         if (priv && priv->data)
                 free(priv->data);
-        if (priv && priv->conf)
-                free(priv->conf);
         if (priv)
                 free(priv);
 
-        ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+        ssrc->privs[pt] = NULL;
 
         return 0;
 }
 
+static void m4v_free_parser(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_m4v_conf *priv = rtp_sess->ptdefs[pt]->priv;
+
+        if (priv && priv->data)
+                free(priv->data);
+        if (priv)
+                free(priv);
+
+        rtp_sess->ptdefs[pt]->priv = NULL;
+}
+
 /**
  * it should return a m4v frame by fetching one or more than a single rtp packet
  */
@@ -110,13 +127,16 @@ static int m4v_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 {
         rtp_pkt *pkt;
         uint8_t *buf;
-        rtp_m4v *priv = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_m4v *priv;
+        rtp_m4v_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
         size_t len;
 
         int err = RTP_FILL_OK;
 
         if (!(pkt = rtp_get_pkt(ssrc, &len)))
                 return RTP_BUFF_EMPTY;
+        if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_m4v))))
+                return RTP_ERRALLOC;
 
         buf = RTP_PKT_DATA(pkt);
         len = RTP_PAYLOAD_SIZE(pkt, len);
@@ -129,13 +149,13 @@ static int m4v_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 
         // In order to produce a compliant bitstream, a 'VOL Header' should prefix
         // the data stream.
-        if (!priv->configured && !priv->len && priv->conf_len) {
-                if (!(priv->data = realloc(priv->data, priv->conf_len))) {
+        if (!priv->configured && !priv->len && conf && conf->len) {
+                if (!(priv->data = realloc(priv->data, conf->len))) {
                         return RTP_ERRALLOC;
                 }
                 priv->data_size = len;
-                memcpy(priv->data, priv->conf, priv->conf_len);
-                priv->len = priv->conf_len;
+                memcpy(priv->data, conf->data, conf->len);
+                priv->len = conf->len;
                 priv->configured = 1;
         }
 
@@ -159,9 +179,9 @@ static int m4v_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
                 priv->len = 0;
         }
 
-        if (priv->conf_len) {
-                config->data = priv->conf;
-                config->len = priv->conf_len;
+        if (conf && conf->len) {
+                config->data = conf->data;
+                config->len = conf->len;
         }
 
         rtp_rm_pkt(ssrc);
@@ -335,8 +335,6 @@ static int mpa_parse(rtp_ssrc * stm_src, rtp_frame * fr, rtp_buff * config)
                 mpa_priv->data_size = max(DEFAULT_MPA_DATA_FRAME, mpa.frm_len);
                 if (!(mpa_priv->data = malloc(mpa_priv->data_size)))
                         return RTP_ERRALLOC;
-                rtp_parser_set_uninit(stm_src->rtp_sess, fr->pt,
-                                      mpa_uninit_parser);
                 nms_printf(NMSML_DBG3, "done\n");
         } else if (mpa_priv->data_size < pkt_len) {
                 nms_printf(NMSML_DBG3, "[rtp_mpa] reallocating data...");
@@ -367,4 +365,4 @@ static int mpa_parse(rtp_ssrc * stm_src, rtp_frame * fr, rtp_buff * config)
         return RTP_FILL_OK;
 }
 
-RTP_PARSER(mpa);
+RTP_PARSER_UNINIT(mpa);
@@ -115,41 +115,31 @@ uint32_t fbv:
 #define RTP_MPV_TR(pkt)            (RTP_MPV_PKT(pkt)->tr_h << 8 | RTP_MPV_PKT(pkt)->tr_l)
 #endif
 
-static int mpv_init_parser(rtp_session * rtp_sess, unsigned pt)
-{
-        rtp_mpv *priv = calloc(1, sizeof(rtp_mpv));
-
-        if (!priv)
-                return RTP_ERRALLOC;
-
-        rtp_sess->ptdefs[pt]->priv = priv;
-
-        return 0;
-}
-
 static int mpv_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
-        rtp_mpv *priv = ssrc->rtp_sess->ptdefs[pt]->priv;
+        rtp_mpv *priv = ssrc->privs[pt];
 
         if (priv && priv->data)
                 free(priv->data);
         if (priv)
                 free(priv);
 
-        ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+        ssrc->privs[pt] = NULL;
 
         return 0;
 }
 
 static int mpv_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 {
-        rtp_mpv *priv = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_mpv *priv;
         rtp_pkt *pkt;
         size_t pkt_len;
         int err = RTP_FILL_OK;
 
         if (!(pkt = rtp_get_pkt(ssrc, &pkt_len)))
                 return RTP_BUFF_EMPTY;
+        if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_mpv))))
+                return RTP_ERRALLOC;
 
         nms_printf(NMSML_DBG3, "\n[MPV]: header: mbz:%u t:%u tr:%u an:%u n:%u s:%u b:%u e:%u p:%u fbv:%u bfc:%u ffv:%u ffc:%u\n", RTP_MPV_PKT(pkt)->mbz, RTP_MPV_PKT(pkt)->t,
                    RTP_MPV_TR(pkt),
@@ -198,4 +188,4 @@ static int mpv_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
         return err;
 }
 
-RTP_PARSER_FULL(mpv);
+RTP_PARSER_UNINIT(mpv);
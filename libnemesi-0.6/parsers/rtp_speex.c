@@ -34,12 +34,20 @@ static rtpparser_info speex_served = {
         {"speex", NULL}
 };
 
+static int speex_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
+{
+        free(ssrc->privs[pt]);
+        ssrc->privs[pt] = NULL;
+
+        return 0;
+}
+
 static int speex_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
 {
         rtp_pkt *pkt;
         uint8_t *buf;
         size_t len;
-        void *priv = ssrc->privs[fr->pt];
+        void *priv;
         int err = RTP_FILL_OK;
 
         if (!(pkt = rtp_get_pkt(ssrc, &len)))
@@ -53,7 +61,9 @@ static int speex_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
          * should be ignored, including itself (it will be a multiple of
          * four)
          */
-        priv = fr->data = realloc(priv, len);
+        if (!(priv = realloc(ssrc->privs[fr->pt], len)))
+                return RTP_ERRALLOC;
+        ssrc->privs[fr->pt] = fr->data = priv;
         memcpy(fr->data, buf, len);
         fr->len = len;
 
@@ -64,4 +74,4 @@ static int speex_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
         return err;
 }
 
-RTP_PARSER(speex);
+RTP_PARSER_UNINIT(speex);
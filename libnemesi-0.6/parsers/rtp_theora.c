@@ -41,9 +41,17 @@ typedef struct {
         uint8_t *buf;   //!< constructed frame, fragments will be copied there
         long len;       //!< buf length, it's the sum of the fragments length
         int id;         //!< Vorbis id, it could change across packets.
+        rtp_xiph_conf *conf;        //!< configuration list, see rtp_theora_conf
+} rtp_theora;
+
+/**
+ * Configurations announced in the sdp, shared by the sources.
+ */
+
+typedef struct {
         rtp_xiph_conf *conf;        //!< configuration list
         int conf_len;
-} rtp_theora;
+} rtp_theora_conf;
 
 static rtpparser_info theora_served = {
         -1,
@@ -150,7 +158,7 @@ static uint64_t get_v(uint8_t **cur, int *len)
         return val;
 }
 
-static int xiphrtp_to_mkv(rtp_theora *priv, uint8_t **value, int *size)
+static int xiphrtp_to_mkv(rtp_theora_conf *priv, uint8_t **value, int *size)
 {
         uint8_t *conf;
         rtp_xiph_conf *tmp;
@@ -192,7 +200,7 @@ static int xiphrtp_to_mkv(rtp_theora *priv, uint8_t **value, int *size)
 }
 
 
-static int unpack_config(rtp_theora *priv, char *value, int len)
+static int unpack_config(rtp_theora_conf *priv, char *value, int len)
 {
         uint8_t buff[len];
         uint8_t *cur = buff;
@@ -210,11 +218,9 @@ static int unpack_config(rtp_theora *priv, char *value, int len)
         return 0;
 }
 
-static void cleanup (rtp_theora *priv)
+static void cleanup (rtp_theora_conf *priv)
 {
         int i;
-        if (priv->buf)
-                free(priv->buf);
         if (priv->conf) {
                 for (i = 0; i < priv->conf_len; i++)
                         if (priv->conf[i].conf)
@@ -227,20 +233,33 @@ static void cleanup (rtp_theora *priv)
 
 static int theora_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
-        rtp_theora *priv = ssrc->rtp_sess->ptdefs[pt]->priv;
+        rtp_theora *priv = ssrc->privs[pt];
 
         if (!priv) return 0;
 
-        cleanup(priv);
+        if (priv->buf)
+                free(priv->buf);
+        free(priv);
 
-        ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+        ssrc->privs[pt] = NULL;
 
         return 0;
 }
 
+static void theora_free_parser(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_theora_conf *priv = rtp_sess->ptdefs[pt]->priv;
+
+        if (!priv) return;
+
+        cleanup(priv);
+
+        rtp_sess->ptdefs[pt]->priv = NULL;
+}
+
 static int theora_init_parser(rtp_session * rtp_sess, unsigned pt)
 {
-        rtp_theora *priv = calloc(1, sizeof(rtp_theora));
+        rtp_theora_conf *priv = calloc(1, sizeof(rtp_theora_conf));
         rtp_pt_attrs *attrs = &rtp_sess->ptdefs[pt]->attrs;
         char value[65536];
         int i, err = -1;
@@ -249,7 +268,7 @@ static int theora_init_parser(rtp_session * rtp_sess, unsigned pt)
         if (!priv)
                 return RTP_ERRALLOC;
 
-        memset(priv, 0, sizeof(rtp_theora));
+        memset(priv, 0, sizeof(rtp_theora_conf));
 
 // parse the sdp to get the first configuration
         for (i=0; i < attrs->size; i++) {
@@ -266,9 +285,6 @@ static int theora_init_parser(rtp_session * rtp_sess, unsigned pt)
                 return RTP_PARSE_ERROR;
         }
 
-        // We start with the first codebook set
-        priv->id = priv->conf[0].id;
-
         rtp_sess->ptdefs[pt]->priv = priv;
 
         return 0;
@@ -284,14 +300,22 @@ static int theora_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
         rtp_pkt *pkt;
         size_t len;
 
-        rtp_theora *priv = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_theora *priv;
+        rtp_theora_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
 
-        config->data = priv->conf[0].conf;
-        config->len  = priv->conf[0].len;
+        config->data = conf->conf[0].conf;
+        config->len  = conf->conf[0].len;
 
         // get the current packet
         if (!(pkt = rtp_get_pkt(ssrc, &len)))
                 return RTP_BUFF_EMPTY;
+        if (!(priv = ssrc->privs[fr->pt])) {
+                if (!(priv = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_theora))))
+                        return RTP_ERRALLOC;
+                // We start with the first codebook set
+                priv->conf = conf->conf;
+                priv->id = conf->conf[0].id;
+        }
         /*fprintf(stderr, "ID: %d, Type: %d, Off: %d\n", RTP_XIPH_ID(pkt), RTP_XIPH_T(pkt), priv->offset);*/
         // if I don't have previous work
         if (!priv->pkts) {
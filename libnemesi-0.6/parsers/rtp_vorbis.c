@@ -41,9 +41,17 @@ typedef struct {
         uint8_t *buf;   //!< constructed frame, fragments will be copied there
         long len;       //!< buf length, it's the sum of the fragments length
         int id;         //!< Vorbis id, it could change across packets.
+        rtp_xiph_conf *conf;        //!< configuration list, see rtp_vorbis_conf
+} rtp_vorbis;
+
+/**
+ * Configurations announced in the sdp, shared by the sources.
+ */
+
+typedef struct {
         rtp_xiph_conf *conf;        //!< configuration list
         int conf_len;
-} rtp_vorbis;
+} rtp_vorbis_conf;
 
 static rtpparser_info vorbis_served = {
         -1,
@@ -150,7 +158,7 @@ static uint64_t get_v(uint8_t **cur, int *len)
         return val;
 }
 
-static int xiphrtp_to_mkv(rtp_vorbis *vorb, uint8_t **value, int *size)
+static int xiphrtp_to_mkv(rtp_vorbis_conf *vorb, uint8_t **value, int *size)
 {
         uint8_t *conf;
         rtp_xiph_conf *tmp;
@@ -192,7 +200,7 @@ static int xiphrtp_to_mkv(rtp_vorbis *vorb, uint8_t **value, int *size)
 }
 
 
-static int unpack_config(rtp_vorbis *vorb, char *value, int len)
+static int unpack_config(rtp_vorbis_conf *vorb, char *value, int len)
 {
         uint8_t buff[len];
         uint8_t *cur = buff;
@@ -210,11 +218,9 @@ static int unpack_config(rtp_vorbis *vorb, char *value, int len)
         return 0;
 }
 
-static void cleanup (rtp_vorbis *vorb)
+static void cleanup (rtp_vorbis_conf *vorb)
 {
         int i;
-        if (vorb->buf)
-                free(vorb->buf);
         if (vorb->conf) {
                 for (i = 0; i < vorb->conf_len; i++)
                         if (vorb->conf[i].conf)
@@ -227,20 +233,33 @@ static void cleanup (rtp_vorbis *vorb)
 
 static int vorbis_uninit_parser(rtp_ssrc * ssrc, unsigned pt)
 {
-        rtp_vorbis *vorb = ssrc->rtp_sess->ptdefs[pt]->priv;
+        rtp_vorbis *vorb = ssrc->privs[pt];
 
         if (!vorb) return 0;
 
-        cleanup(vorb);
+        if (vorb->buf)
+                free(vorb->buf);
+        free(vorb);
 
-        ssrc->rtp_sess->ptdefs[pt]->priv = NULL;
+        ssrc->privs[pt] = NULL;
 
         return 0;
 }
 
+static void vorbis_free_parser(rtp_session * rtp_sess, unsigned pt)
+{
+        rtp_vorbis_conf *vorb = rtp_sess->ptdefs[pt]->priv;
+
+        if (!vorb) return;
+
+        cleanup(vorb);
+
+        rtp_sess->ptdefs[pt]->priv = NULL;
+}
+
 static int vorbis_init_parser(rtp_session * rtp_sess, unsigned pt)
 {
-        rtp_vorbis *vorb = calloc(1, sizeof(rtp_vorbis));
+        rtp_vorbis_conf *vorb = calloc(1, sizeof(rtp_vorbis_conf));
         rtp_pt_attrs *attrs = &rtp_sess->ptdefs[pt]->attrs;
         char value[65536];
         int i, err = -1;
@@ -249,7 +268,7 @@ static int vorbis_init_parser(rtp_session * rtp_sess, unsigned pt)
         if (!vorb)
                 return RTP_ERRALLOC;
 
-        memset(vorb, 0, sizeof(rtp_vorbis));
+        memset(vorb, 0, sizeof(rtp_vorbis_conf));
 
 // parse the sdp to get the first configuration
         for (i=0; i < attrs->size; i++) {
@@ -266,9 +285,6 @@ static int vorbis_init_parser(rtp_session * rtp_sess, unsigned pt)
                 return RTP_PARSE_ERROR;
         }
 
-        // We start with the first codebook set
-        vorb->id = vorb->conf[0].id;
-
         rtp_sess->ptdefs[pt]->priv = vorb;
 
         return 0;
@@ -284,14 +300,22 @@ static int vorbis_parse(rtp_ssrc * ssrc, rtp_frame * fr, rtp_buff * config)
         rtp_pkt *pkt;
         size_t len;
 
-        rtp_vorbis *vorb = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
+        rtp_vorbis *vorb;
+        rtp_vorbis_conf *conf = ssrc->rtp_sess->ptdefs[fr->pt]->priv;
 
-        config->data = vorb->conf[0].conf;
-        config->len  = vorb->conf[0].len;
+        config->data = conf->conf[0].conf;
+        config->len  = conf->conf[0].len;
 
         // get the current packet
         if (!(pkt = rtp_get_pkt(ssrc, &len)))
                 return RTP_BUFF_EMPTY;
+        if (!(vorb = ssrc->privs[fr->pt])) {
+                if (!(vorb = rtp_parser_priv(ssrc, fr->pt, sizeof(rtp_vorbis))))
+                        return RTP_ERRALLOC;
+                // We start with the first codebook set
+                vorb->conf = conf->conf;
+                vorb->id = conf->conf[0].id;
+        }
         /*fprintf(stderr, "ID: %d, Type: %d, Off: %d\n", RTP_XIPH_ID(pkt), RTP_XIPH_T(pkt), vorb->offset);*/
         // if I don't have previous work
         if (!vorb->pkts) {
@@ -25,32 +25,57 @@
 
 #include "rtpparsers.h"
 
-/*! the parser could define an "unint function" of the type:
- * static int rtp_uninit_parser(rtp_ssrc *stm_src, unsigned pt);
- * and link this function to che corresponding pointer in
- * <tt>rtp_parser_uninit *rtp_parsers_uninits</tt> array in rtp_session struct.
+/*! the parser keeps the state of each source in <tt>stm_src->privs[pt]</tt>,
+ * allocated on the first packet (see <tt>rtp_parser_priv</tt>), so that the
+ * sources of a session never share it and can be parsed concurrently.
+ * The parser could define an "uninit function" of the type:
+ * static int x_uninit_parser(rtp_ssrc *stm_src, unsigned pt);
+ * freeing it, called for every source at rtp thread end.
  * */
 
 #define RTP_PARSER(x) rtpparser rtp_parser_##x = { \
-    &x##_served, \
-    NULL, \
-    x##_parse, \
-    NULL \
+    .served = &x##_served, \
+    .parse = x##_parse \
+}
+
+#define RTP_PARSER_UNINIT(x) rtpparser rtp_parser_##x = { \
+    .served = &x##_served, \
+    .parse = x##_parse, \
+    .uninit = x##_uninit_parser \
 }
 
 /**
  * the <tt>rtp_parser_init</tt> function is called at rtp thread start
  * (in <tt>rtp_thread_create</tt>)
  * for all the parsers registered for announced payload types
- * (present in the <tt>announced_fmts</tt> list)
+ * (present in the <tt>announced_fmts</tt> list).
+ * It keeps what the sources share, like the configuration announced in the
+ * sdp, in <tt>rtp_sess->ptdefs[pt]->priv</tt>: the sources only read it.
+ * The <tt>rtp_parser_free</tt> function frees it at rtp thread end.
  * */
 
 #define RTP_PARSER_FULL(x) \
     rtpparser rtp_parser_##x = {\
-        &x##_served, \
-        x##_init_parser, \
-        x##_parse, \
-        x##_uninit_parser \
+        .served = &x##_served, \
+        .init = x##_init_parser, \
+        .parse = x##_parse, \
+        .uninit = x##_uninit_parser, \
+        .free = x##_free_parser \
+    }
+
+/**
+ * Like RTP_PARSER_FULL, for the parsers which can also describe the
+ * frames in place, see <tt>rtp_fill_buffer_iov</tt>.
+ * */
+
+#define RTP_PARSER_FULL_IOV(x) \
+    rtpparser rtp_parser_##x = {\
+        .served = &x##_served, \
+        .init = x##_init_parser, \
+        .parse = x##_parse, \
+        .uninit = x##_uninit_parser, \
+        .free = x##_free_parser, \
+        .parse_iov = x##_parse_iov \
     }
 
 #endif                /*RTPPTFRAMER_H_ */
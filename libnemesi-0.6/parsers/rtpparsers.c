@@ -28,6 +28,7 @@
 extern rtpparser rtp_parser_mpa;
 extern rtpparser rtp_parser_mpv;
 extern rtpparser rtp_parser_h264;
+extern rtpparser rtp_parser_h265;
 extern rtpparser rtp_parser_h263;
 extern rtpparser rtp_parser_speex;
 extern rtpparser rtp_parser_theora;
@@ -39,6 +40,7 @@ rtpparser *rtpparsers[] = {
         &rtp_parser_mpa,
         &rtp_parser_mpv,
         &rtp_parser_h264,
+        &rtp_parser_h265,
         &rtp_parser_h263,
         &rtp_parser_speex,
         &rtp_parser_theora,
@@ -49,6 +51,7 @@ rtpparser *rtpparsers[] = {
 };
 
 static int rtp_def_parser(rtp_ssrc *, rtp_frame * fr, rtp_buff * config);
+static int rtp_def_uninit(rtp_ssrc *, unsigned pt);
 
 static rtp_parser rtp_parsers[128] = {
         rtp_def_parser, rtp_def_parser, rtp_def_parser, rtp_def_parser,
@@ -86,18 +89,25 @@ static rtp_parser rtp_parsers[128] = {
 };
 
 static rtp_parser_init rtp_parsers_inits[128];
+static rtp_parser_uninit rtp_parsers_uninits[128];
+static rtp_parser_free rtp_parsers_frees[128];
 
 void rtp_parsers_init(void)
 {
         int i;
 
         memset(rtp_parsers_inits, 0, sizeof(rtp_parsers_inits));
+        memset(rtp_parsers_frees, 0, sizeof(rtp_parsers_frees));
+        for (i = 0; i < 128; i++)
+                rtp_parsers_uninits[i] = rtp_def_uninit;
 
         for (i = 0; rtpparsers[i]; i++) {
                 int pt = rtpparsers[i]->served->static_pt;
                 if (pt < 96 && pt != -1) {
                         rtp_parsers[pt] = rtpparsers[i]->parse;
                         rtp_parsers_inits[pt] = rtpparsers[i]->init;
+                        rtp_parsers_uninits[pt] = rtpparsers[i]->uninit;
+                        rtp_parsers_frees[pt] = rtpparsers[i]->free;
                 }
         }
 }
@@ -119,6 +129,12 @@ int rtp_parser_reg(rtp_session * rtp_sess, int16_t pt, char *mime)
                                 rtp_sess->parsers[pt] = rtpparsers[i]->parse;
                                 rtp_sess->parsers_inits[pt] =
                                         rtpparsers[i]->init;
+                                rtp_sess->parsers_uninits[pt] =
+                                        rtpparsers[i]->uninit;
+                                rtp_sess->parsers_frees[pt] =
+                                        rtpparsers[i]->free;
+                                rtp_sess->parsers_iov[pt] =
+                                        rtpparsers[i]->parse_iov;
                                 return RTP_OK;
                         }
                 }
@@ -128,11 +144,17 @@ int rtp_parser_reg(rtp_session * rtp_sess, int16_t pt, char *mime)
 }
 
 void rtp_parsers_new(rtp_parser * new_parsers,
-                     rtp_parser_init * new_parsers_inits)
+                     rtp_parser_init * new_parsers_inits,
+                     rtp_parser_uninit * new_parsers_uninits,
+                     rtp_parser_free * new_parsers_frees)
 {
         memcpy(new_parsers, rtp_parsers, sizeof(rtp_parsers));
         memcpy(new_parsers_inits, rtp_parsers_inits,
                sizeof(rtp_parsers_inits));
+        memcpy(new_parsers_uninits, rtp_parsers_uninits,
+               sizeof(rtp_parsers_uninits));
+        memcpy(new_parsers_frees, rtp_parsers_frees,
+               sizeof(rtp_parsers_frees));
 }
 
 inline void rtp_parser_set_uninit(rtp_session * rtp_sess, unsigned pt,
@@ -141,6 +163,24 @@ inline void rtp_parser_set_uninit(rtp_session * rtp_sess, unsigned pt,
         rtp_sess->parsers_uninits[pt] = parser_uninit;
 }
 
+/**
+ * Gets the state a parser keeps for a source, allocated zeroed on the
+ * first packet of the payload type and freed by the parser uninit.
+ *
+ * @param stm_src The source being parsed
+ * @param pt The payload type
+ * @param size The size of the state
+ *
+ * @return the state, NULL if there is no memory
+ */
+void *rtp_parser_priv(rtp_ssrc * stm_src, unsigned pt, size_t size)
+{
+        if (!stm_src->privs[pt])
+                stm_src->privs[pt] = calloc(1, size);
+
+        return stm_src->privs[pt];
+}
+
 #define DEFAULT_PRSR_DATA_FRAME 65535
 
 typedef struct {
@@ -197,3 +237,16 @@ static int rtp_def_parser(rtp_ssrc * stm_src, rtp_frame * fr,
 
         return RTP_FILL_OK;
 }
+
+static int rtp_def_uninit(rtp_ssrc * stm_src, unsigned pt)
+{
+        rtp_def_parser_s *priv = stm_src->privs[pt];
+
+        if (priv) {
+                free(priv->data);
+                free(priv);
+                stm_src->privs[pt] = NULL;
+        }
+
+        return 0;
+}
@@ -42,7 +42,9 @@ typedef struct {
         rtpparser_info *served;     //!< Depayloader info
         rtp_parser_init init;       //!< Optional initialization
         rtp_parser parse;           //!< rtp parse/depayload function
-        rtp_parser_uninit uninit;   //!< Optional deinitialization
+        rtp_parser_uninit uninit;   //!< Optional deinitialization of a source
+        rtp_parser_free free;       //!< Optional deinitialization
+        rtp_parser_iov parse_iov;   //!< Optional depayload in place, see rtp_fill_buffer_iov
 } rtpparser;
 
 // parsers
@@ -53,8 +55,12 @@ typedef struct {
 void rtp_parsers_init(void);
 int rtp_parser_reg(rtp_session *, int16_t, char *);
 void rtp_parsers_new(rtp_parser * new_parsers,
-                     rtp_parser_init * new_parsers_inits);
+                     rtp_parser_init * new_parsers_inits,
+                     rtp_parser_uninit * new_parsers_uninits,
+                     rtp_parser_free * new_parsers_frees);
 inline void rtp_parser_set_uninit(rtp_session * rtp_sess, unsigned pt,
                                   rtp_parser_uninit parser_uninit);
+void *rtp_parser_priv(rtp_ssrc * stm_src, unsigned pt, size_t size);
+int rtp_h265_donl(rtp_session *, unsigned);
 
 #endif                /* RTPFRAMERS_H_ */
@@ -28,6 +28,15 @@
 #include "rtcp.h"
 #include "utils.h"
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#define RTCP_EPOLL
+#define RTCP_EPOLL_EVENTS 16    //!< events taken by a single epoll_wait
+#define RTCP_EPOLL_BUDGET 16    //!< rtcp_recv calls per ready session and round
+#endif
+
 /**
  * RTCP Layer clean up is demanded to RTP layer (rtp_clean)
  * This function actually does nothing
@@ -55,28 +64,19 @@ double rtcp_interval(int members, int senders,
                      double avg_rtcp_size, int initial);
 
 /**
- * The RTCP thread main loop, continuously calls rctp_recv every time there is data available
- * or handles pending events if no data is available
+ * Schedules the first Receiver Report of every session
  *
- * @param args The rtp_thread for which to loop.
+ * @param rtp_sess_head The sessions
+ *
+ * @return The events queue head, NULL on error
  */
-static void *rtcp(void *args)
+struct rtcp_event *rtcp_schedule_sessions(rtp_session * rtp_sess_head)
 {
-        rtp_session *rtp_sess_head = ((rtp_thread *) args)->rtp_sess_head;
         rtp_session *rtp_sess;
         struct rtcp_event *head = NULL;
-        int maxfd = 0, ret;
         double t;
         struct timeval tv, now;
 
-        fd_set readset;
-
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-        // pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-        pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-        pthread_cleanup_push(rtcp_clean, (void *) &rtp_sess_head);
-        pthread_cleanup_push(rtcp_clean_events, (void *) &head);
-
         for (rtp_sess = rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next) {
                 t = rtcp_interval(rtp_sess->sess_stats.members,
                                   rtp_sess->sess_stats.senders,
@@ -93,11 +93,186 @@ static void *rtcp(void *args)
                 if ((head =
                                         rtcp_schedule(head, rtp_sess, rtp_sess->sess_stats.tn,
                                                       RTCP_RR)) == NULL)
-                        pthread_exit(NULL);
+                        return NULL;
                 nms_printf(NMSML_DBG1, "RTCP: %d.%d -> %d.%d\n", now.tv_sec,
                            now.tv_usec, head->tv.tv_sec, head->tv.tv_usec);
         }
 
+        return head;
+}
+
+#ifdef RTCP_EPOLL
+/**
+ * Closes the epoll and timer descriptors of the RTCP loop
+ *
+ * @param args The two descriptors
+ */
+static void rtcp_epoll_clean(void *args)
+{
+        int *fds = args;
+
+        if (fds[0] >= 0)
+                close(fds[0]);
+        if (fds[1] >= 0)
+                close(fds[1]);
+}
+
+/**
+ * Registers the RTCP socket of every session of the thread, switched to
+ * non blocking mode, and a timer for the RTCP events in an edge triggered
+ * epoll set.
+ *
+ * @param rtp_sess_head The sessions of the thread
+ * @param fds Where to store the epoll and timer descriptors
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+static int rtcp_epoll_create(rtp_session * rtp_sess_head, int *fds)
+{
+        rtp_session *rtp_sess;
+        struct epoll_event ev;
+        int fd;
+
+        if ((fds[0] = epoll_create(RTCP_EPOLL_EVENTS)) < 0
+                        || (fds[1] = timerfd_create(CLOCK_REALTIME, 0)) < 0)
+                return 1;
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(fds[0], EPOLL_CTL_ADD, fds[1], &ev) < 0)
+                return 1;
+
+        for (rtp_sess = rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next) {
+                fd = rtp_sess->transport.RTCP.sock.fd;
+                ev.data.ptr = rtp_sess;
+                if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0
+                                || epoll_ctl(fds[0], EPOLL_CTL_ADD, fd, &ev) < 0)
+                        return 1;
+        }
+
+        return 0;
+}
+
+/**
+ * Arms the timer of an RTCP loop for the first scheduled event
+ *
+ * @param tfd The timer descriptor
+ * @param tv The time of the event, as given by gettimeofday
+ */
+void rtcp_timer_set(int tfd, struct timeval *tv)
+{
+        struct itimerspec its;
+
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = tv->tv_sec;
+        /* a zero value would disarm the timer */
+        its.it_value.tv_nsec = tv->tv_usec * 1000 + 1;
+        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * The RTCP thread main loop on epoll: the RTCP sockets are registered once,
+ * only the ready ones are read, and the events are driven by a timerfd.
+ * A socket is read at most RTCP_EPOLL_BUDGET times per round: the sessions
+ * not drained are kept in front of the events of the next round, which
+ * does not wait for new ones.
+ *
+ * @param rtp_sess_head The sessions of the thread
+ * @param head The scheduled events
+ * @param fds The epoll and timer descriptors
+ */
+static void rtcp_epoll_loop(rtp_session * rtp_sess_head,
+                            struct rtcp_event **head, int *fds)
+{
+        struct epoll_event events[RTCP_EPOLL_EVENTS];
+        rtp_session *rtp_sess;
+        rtp_ssrc *ssrc;
+        uint64_t expired;
+        long total_receive;
+        int total_lost;
+        uint32_t total_bad_seq;
+        int i, j, m = 0, n, ret;
+
+        while (1) {
+                pthread_testcancel();
+
+                rtcp_timer_set(fds[1], &(*head)->tv);
+
+                if (m == RTCP_EPOLL_EVENTS
+                                || (n = epoll_wait(fds[0], events + m,
+                                                   RTCP_EPOLL_EVENTS - m,
+                                                   m ? 0 : -1)) < 0)
+                        n = 0;
+                n += m;
+                m = 0;
+
+                total_receive = 0;
+                total_lost = 0;
+                total_bad_seq = 65537;
+                for (i = 0; i < n; i++) {
+                        if (!(rtp_sess = events[i].data.ptr)) {
+                                /* timer scaduto */
+                                if (read(fds[1], &expired, sizeof(expired)) > 0
+                                                && (*head = rtcp_handle_event(*head)) == NULL)
+                                        pthread_exit(NULL);
+                                continue;
+                        }
+                        for (j = 0; j < RTCP_EPOLL_BUDGET
+                                        && (ret = rtcp_recv(rtp_sess)) != RTP_RECV_AGAIN;
+                                        j++)
+                                if (ret < 0)
+                                        pthread_exit(NULL);
+                        if (j == RTCP_EPOLL_BUDGET)
+                                events[m++] = events[i];
+                        total_receive += rtp_sess->receive_packets;
+                        total_lost += rtp_sess->lost;
+                        for (ssrc = rtp_sess->ssrc_queue; ssrc; ssrc = ssrc->next)
+                                if (total_bad_seq < ssrc->ssrc_stats.bad_seq)
+                                        total_bad_seq = ssrc->ssrc_stats.bad_seq;
+                }
+                total_receive_packets = total_receive;
+                total_lost_packets = total_lost;
+                bad_seq_total = total_bad_seq;
+        }
+}
+#endif
+
+/**
+ * The RTCP thread main loop, continuously calls rctp_recv every time there is data available
+ * or handles pending events if no data is available
+ *
+ * @param args The rtp_thread for which to loop.
+ */
+static void *rtcp(void *args)
+{
+        rtp_session *rtp_sess_head = ((rtp_thread *) args)->rtp_sess_head;
+        rtp_session *rtp_sess;
+        struct rtcp_event *head = NULL;
+        int maxfd = 0, ret;
+        struct timeval tv, now;
+#ifdef RTCP_EPOLL
+        int fds[2] = { -1, -1 };
+#endif
+
+        fd_set readset;
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        // pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+        pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+        pthread_cleanup_push(rtcp_clean, (void *) &rtp_sess_head);
+        pthread_cleanup_push(rtcp_clean_events, (void *) &head);
+
+        if ((head = rtcp_schedule_sessions(rtp_sess_head)) == NULL)
+                pthread_exit(NULL);
+
+#ifdef RTCP_EPOLL
+        pthread_cleanup_push(rtcp_epoll_clean, (void *) fds);
+        if (!rtcp_epoll_create(rtp_sess_head, fds))
+                rtcp_epoll_loop(rtp_sess_head, &head, fds);
+        nms_printf(NMSML_WARN, "Cannot use epoll for RTCP, using select\n");
+        pthread_cleanup_pop(1);
+#endif
+
         while (1) {
 
                 pthread_testcancel();
@@ -185,6 +360,10 @@ int rtcp_thread_create(rtp_thread * rtp_th)
         int n;
         pthread_attr_t rtcp_attr;
 
+        /* RTCP is served by the worker the sessions are attached to */
+        if (rtp_th->worker)
+                return 0;
+
         pthread_attr_init(&rtcp_attr);
         if (pthread_attr_setdetachstate(&rtcp_attr, PTHREAD_CREATE_JOINABLE) !=
                         0)
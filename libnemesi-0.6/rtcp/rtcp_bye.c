@@ -47,6 +47,7 @@ int rtcp_parse_bye(rtp_ssrc * ssrc, rtcp_pkt * pkt)
 
         rtsp_t = ssrc->rtp_sess->owner;
         rtsp_t->rtp_th->run = 0;
+        rtp_wait_end(&rtsp_t->rtp_th->wait);
         return 0;
 }
 
@@ -97,18 +97,18 @@ static int rtcp_hdr_val_chk(rtcp_pkt * pkt, int len)
 /**
  * Actually receives an RTCP packet for the given RTP Session
  * @param rtp_sess The Session for which to receive the packet
- * @return 0 if everything was ok, 1 if the packet was malformed
+ * @return 0 if everything was ok, RTP_RECV_AGAIN if the socket is non
+ * blocking and had no packet, 1 if the packet was malformed or the receive
+ * interrupted, -1 if the socket failed
  */
 int rtcp_recv(rtp_session * rtp_sess)
 {
         uint8_t buffer[1024];
-        rtp_ssrc *stm_src;
 
         struct sockaddr_storage serveraddr;
         nms_sockaddr server = { (struct sockaddr *) &serveraddr, sizeof(serveraddr) };
 
-        rtcp_pkt *pkt;
-        int ret, n;
+        int n;
 
         memset(buffer, 0, 1024);
 
@@ -116,6 +116,11 @@ int rtcp_recv(rtp_session * rtp_sess)
                                 recvfrom(rtp_sess->transport.RTCP.sock.fd, buffer, 1024, 0, server.addr,
                                          &server.addr_len)) == -1) {
                 switch (errno) {
+                case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+                case EWOULDBLOCK:
+#endif
+                        return RTP_RECV_AGAIN;
                 case EBADF:
                         nms_printf(NMSML_ERR,
                                    "RTCP recvfrom: invalid descriptor\n");
@@ -128,7 +133,7 @@ int rtcp_recv(rtp_session * rtp_sess)
                 case EINTR:
                         nms_printf(NMSML_ERR,
                                    "RTCP recvfrom: The receive was interrupted by delivery of a signal\n");
-                        break;
+                        return 1;
                 case EFAULT:
                         nms_printf(NMSML_ERR,
                                    "RTCP recvfrom: The buffer points outside userspace\n");
@@ -141,10 +146,27 @@ int rtcp_recv(rtp_session * rtp_sess)
                         nms_printf(NMSML_ERR, "in RTCP recvfrom\n");
                         break;
                 }
-                return 1;
+                return -1;
         }
 
-        pkt = (rtcp_pkt *) buffer;
+        return rtcp_recv_pkt(rtp_sess, buffer, n, &server);
+}
+
+/**
+ * Handles an RTCP packet already read, also from a socket shared by many
+ * sessions.
+ * @param rtp_sess The Session the packet was sent to
+ * @param data The packet, 32 bits aligned
+ * @param n The length of the packet
+ * @param server The address of the sender
+ * @return 0 if everything was ok, 1 if the packet was malformed
+ */
+int rtcp_recv_pkt(rtp_session * rtp_sess, void *data, int n,
+                  nms_sockaddr * server)
+{
+        rtcp_pkt *pkt = data;
+        rtp_ssrc *stm_src;
+        int ret;
 
         if (rtcp_hdr_val_chk(pkt, n)) {
                 nms_printf(NMSML_WARN,
@@ -153,13 +175,15 @@ int rtcp_recv(rtp_session * rtp_sess)
         }
 
         switch (rtp_ssrc_check
-                        (rtp_sess, ntohl((pkt->r).sr.ssrc), &stm_src, &server, RTCP)) {
+                        (rtp_sess, ntohl((pkt->r).sr.ssrc), &stm_src, server, RTCP)) {
         case SSRC_NEW:
                 if (pkt->common.pt == RTCP_SR)
                         rtp_sess->sess_stats.senders++;
                 rtp_sess->sess_stats.members++;
         case SSRC_RTCPNEW:
                 break;
+        case SSRC_COLLISION:
+                return 0;
         case -1:
                 return 1;
                 break;
@@ -60,8 +60,7 @@ int rtcp_build_rr(rtp_session * rtp_sess, rtcp_pkt * pkt)
                         rr->ssrc = htonl(stm_src->ssrc);
 
                         expected =
-                                stm_src->ssrc_stats.cycles +
-                                stm_src->ssrc_stats.max_seq -
+                                (uint32_t) stm_src->ssrc_stats.ext_max_seq -
                                 stm_src->ssrc_stats.base_seq + 1;
                         expected_interval =
                                 expected - stm_src->ssrc_stats.expected_prior;
@@ -91,10 +90,9 @@ int rtcp_build_rr(rtp_session * rtp_sess, rtcp_pkt * pkt)
 						total_receive+=stm_src->ssrc_stats.received;
 						
                         rr->last_seq =
-                                htonl(stm_src->ssrc_stats.cycles +
-                                      stm_src->ssrc_stats.max_seq);
+                                htonl((uint32_t) stm_src->ssrc_stats.ext_max_seq);
                         rr->jitter =
-                                htonl((uint32_t) stm_src->ssrc_stats.jitter);
+                                htonl(stm_src->ssrc_stats.jitter >> 4);
                         rr->last_sr =
                                 htonl(((stm_src->ssrc_stats.
                                         ntplastsr[0] & 0x0000ffff) << 16) |
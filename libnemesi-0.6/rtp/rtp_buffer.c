@@ -42,10 +42,43 @@ int rtp_fill_buffers(rtp_thread * rtp_th)
         return !rtp_th->run;
 }
 
+/**
+ * Gets the oldest packet of a source, if due for playout, waiting a little
+ * for the RTP thread to complete a frame otherwise.
+ *
+ * @return the packet, NULL if there is none ready
+ */
+static rtp_pkt *rtp_fill_pkt(rtp_ssrc * stm_src)
+{
+        rtp_pkt *pkt;
+
+        /* If we did a seek, we must wait for seek reset and bufferpool clean up,
+         * so wait until rtp_recv receives the first new packet and resets the bufferpool
+         */
+        /* the frames pushed to the application do not wait for playout */
+        if (stm_src->done_seek
+                        || !(pkt = rtp_get_pkt(stm_src, NULL))
+                        || (!stm_src->rtp_sess->frame_cb
+                            && !rtp_playout_due(stm_src, pkt))) {
+                /* wait a little for the RTP thread to complete a frame,
+                 * as long as the old usleep(1000) but no longer than needed */
+                if (rtp_wait_frame(stm_src, 1)
+                                || !(pkt = rtp_get_pkt(stm_src, NULL)))
+                        return NULL;
+        }
+
+        return pkt;
+}
+
 /**
  *  fills the frame with depacketized data (full frame or sample group) and
  *  provides optional extradata if available. The structs MUST be empty and
  *  the data delivered MUST not be freed.
+ *  The parsers keep their state per source, so that different sources,
+ *  even of the same session, can be filled concurrently by different
+ *  threads; a single source must not.
+ *  Once the stream is over, the parser of the last packet is called
+ *  again for the frames it still holds back.
  *  @param stm_src an active ssrc
  *  @param fr an empty frame structure
  *  @param config an empty buffer structure
@@ -72,21 +105,16 @@ int rtp_fill_buffer(rtp_ssrc * stm_src, rtp_frame * fr, rtp_buff * config)
 			printf("fr->pt=%d\n", fr->pt);
 		}*/
 		
-		/* If we did a seek, we must wait for seek reset and bufferpool clean up,
-         * so wait until rtp_recv receives the first new packet and resets the bufferpool
-         */
-        if (stm_src->done_seek) {
-                usleep(1000);
+        if ((pkt = rtp_fill_pkt(stm_src))) {
+                fr->pt = RTP_PKT_PT(pkt);
+                fr->timestamp = RTP_PKT_TS(pkt);
+        } else if (stm_src->parsed_pt && rtp_stream_over(stm_src)) {
+                /* the parser may still hold back frames of the last packets */
+                fr->pt = stm_src->parsed_pt - 1;
+                fr->timestamp = stm_src->ssrc_stats.lastts;
+        } else
                 return RTP_BUFF_EMPTY;
-        }
-
-        if (!(pkt = rtp_get_pkt(stm_src, NULL))) {
-                usleep(1000);
-                return RTP_BUFF_EMPTY;
-        }
-
-        fr->pt = RTP_PKT_PT(pkt);
-        fr->timestamp = RTP_PKT_TS(pkt);
+        stm_src->parsed_pt = fr->pt + 1;
 
 		/* chenlei why?
         if (fr->time_sec > 1000) {
@@ -97,6 +125,8 @@ int rtp_fill_buffer(rtp_ssrc * stm_src, rtp_frame * fr, rtp_buff * config)
         */
 
         fr->fps = stm_src->rtp_sess->fps;
+        fr->nals = NULL;
+        fr->nal_count = 0;
         stm_src->ssrc_stats.lastts = fr->timestamp;
 #if 0
 {
@@ -141,6 +171,203 @@ int rtp_fill_buffer(rtp_ssrc * stm_src, rtp_frame * fr, rtp_buff * config)
         return err;
 }
 
+/**
+ * Like rtp_fill_buffer, but the frame is described in place: the payloads
+ * stay in the bufferpool slots of their packets, held by the frame, so
+ * that nothing is copied. The payloads whose parser cannot do it are
+ * copied by it as usual, and described as a single piece valid until the
+ * next call.
+ *
+ * The frame belongs to the caller, zeroed the first time. Once written it
+ * must be given back with rtp_frame_iov_release, or the slots it holds
+ * are lost to the RTP thread. If the call fails in the middle of a frame,
+ * the next one completes it.
+ *
+ * @param stm_src an active ssrc
+ * @param fr the frame, empty or holding an incomplete one
+ * @param config an empty buffer structure
+ * @return RTP_FILL_OK on success
+ */
+int rtp_fill_buffer_iov(rtp_ssrc * stm_src, rtp_frame_iov * fr,
+                        rtp_buff * config)
+{
+        rtp_session *rtp_sess = stm_src->rtp_sess;
+        rtp_frame copy;
+        rtp_pkt *pkt;
+        int pt, err;
+
+        if ((pkt = rtp_fill_pkt(stm_src)))
+                pt = RTP_PKT_PT(pkt);
+        else if (stm_src->parsed_pt && rtp_stream_over(stm_src))
+                /* the parser may still hold back frames of the last packets */
+                pt = stm_src->parsed_pt - 1;
+        else
+                return RTP_BUFF_EMPTY;
+        stm_src->parsed_pt = pt + 1;
+
+        if (fr->iovcnt && fr->pt != pt)
+                rtp_frame_iov_release(fr);
+        fr->pt = pt;
+        if (!fr->iovcnt) {
+                fr->timestamp = pkt ? RTP_PKT_TS(pkt)
+                                    : stm_src->ssrc_stats.lastts;
+                fr->nals = NULL;
+                fr->nal_count = 0;
+        }
+        fr->fps = rtp_sess->fps;
+        stm_src->ssrc_stats.lastts = fr->timestamp;
+
+        if (rtp_sess->parsers_iov[fr->pt]) {
+                while ((err = rtp_sess->parsers_iov[fr->pt] (stm_src, fr, config))
+                                == EAGAIN);
+        } else {
+                memset(&copy, 0, sizeof(copy));
+                copy.pt = fr->pt;
+                copy.timestamp = fr->timestamp;
+                while ((err = rtp_sess->parsers[copy.pt] (stm_src, &copy, config))
+                                == EAGAIN);
+                fr->timestamp = copy.timestamp;
+                fr->nals = copy.nals;
+                fr->nal_count = copy.nal_count;
+                if (!err && rtp_frame_iov_add(fr, copy.data, copy.len))
+                        err = RTP_ERRALLOC;
+        }
+
+        fr->time_sec =
+                ((double) (fr->timestamp - stm_src->ssrc_stats.firstts)) /
+                (double) rtp_sess->ptdefs[fr->pt]->rate;
+
+        return err;
+}
+
+/**
+ * Appends a piece to a frame described in place.
+ *
+ * @param fr The frame
+ * @param data The piece, in a slot held by the frame or in memory which
+ * outlives it
+ * @param len Its size
+ *
+ * @return 0 on success, 1 if there is no memory
+ */
+int rtp_frame_iov_add(rtp_frame_iov * fr, void *data, long len)
+{
+        struct iovec *iov;
+        int size;
+
+        if (fr->iovcnt == fr->iov_size) {
+                size = fr->iov_size ? fr->iov_size * 2 : 64;
+                if (!(iov = realloc(fr->iov, size * sizeof(*iov))))
+                        return 1;
+                fr->iov = iov;
+                fr->iov_size = size;
+        }
+
+        fr->iov[fr->iovcnt].iov_base = data;
+        fr->iov[fr->iovcnt].iov_len = len;
+        fr->iovcnt++;
+        fr->len += len;
+
+        return 0;
+}
+
+/**
+ * Removes the oldest packet of a source from its playout buffer, like
+ * rtp_rm_pkt, but the frame keeps its slot: the pieces added from the
+ * packet stay valid until rtp_frame_iov_release.
+ *
+ * @param stm_src The source of the packet
+ * @param fr The frame
+ *
+ * @return RTP_FILL_OK, RTP_BUFF_EMPTY if there is no packet,
+ * RTP_ERRALLOC if there is no memory
+ */
+int rtp_frame_iov_hold(rtp_ssrc * stm_src, rtp_frame_iov * fr)
+{
+        int *slots;
+        int index, size;
+
+        if ((index = popeek(stm_src->po, 0)) < 0)
+                return RTP_BUFF_EMPTY;
+
+        if (fr->nslots == fr->slots_size) {
+                size = fr->slots_size ? fr->slots_size * 2 : 64;
+                if (!(slots = realloc(fr->slots, size * sizeof(*slots))))
+                        return RTP_ERRALLOC;
+                fr->slots = slots;
+                fr->slots_size = size;
+        }
+
+        if (bpdetach(stm_src->rtp_sess->bp, stm_src->po, index))
+                return RTP_BUFF_EMPTY;
+        fr->bp = stm_src->rtp_sess->bp;
+        fr->slots[fr->nslots++] = index;
+
+        return RTP_FILL_OK;
+}
+
+/**
+ * Gives back the slots held by a frame described in place and empties it,
+ * keeping its memory for the next one.
+ *
+ * @param fr The frame
+ */
+void rtp_frame_iov_release(rtp_frame_iov * fr)
+{
+        if (fr->nslots)
+                bpfreen(fr->bp, fr->slots, fr->nslots);
+        fr->nslots = 0;
+        fr->iovcnt = 0;
+        fr->len = 0;
+        fr->nal_count = 0;
+}
+
+/**
+ * Releases a frame described in place and frees its memory.
+ *
+ * @param fr The frame
+ */
+void rtp_frame_iov_free(rtp_frame_iov * fr)
+{
+        rtp_frame_iov_release(fr);
+        free(fr->iov);
+        free(fr->slots);
+        fr->iov = NULL;
+        fr->slots = NULL;
+        fr->iov_size = fr->slots_size = 0;
+}
+
+/**
+ * Hands to the frame callback of the session every complete frame queued
+ * for a source. Called by the thread receiving the packets, after one
+ * completed a frame.
+ *
+ * @param stm_src The source of the packet
+ */
+void rtp_push_frames(rtp_ssrc * stm_src)
+{
+        rtp_session *rtp_sess = stm_src->rtp_sess;
+        rtp_frame fr;
+        rtp_buff conf;
+        rtp_pkt *pkt;
+        int err;
+
+        while (rtp_frame_ready(stm_src)) {
+                pkt = rtp_get_pkt(stm_src, NULL);
+                memset(&fr, 0, sizeof(fr));
+                memset(&conf, 0, sizeof(conf));
+                if ((err = rtp_fill_buffer(stm_src, &fr, &conf)) == RTP_FILL_OK)
+                        rtp_sess->frame_cb(stm_src, &fr, &conf,
+                                           rtp_sess->frame_cb_arg);
+                else if (rtp_get_pkt(stm_src, NULL) == pkt) {
+                        if (err == RTP_BUFF_EMPTY)
+                                break;
+                        /* nobody else would skip the packet the parser refused */
+                        rtp_rm_pkt(stm_src);
+                }
+        }
+}
+
 /**
  * Gets the time in seconds between the first packet of the RTP stream
  * and the next one in the buffer.
@@ -203,38 +430,73 @@ float rtp_get_fps(rtp_ssrc * stm_src)
         return stm_src->rtp_sess->fps;
 }
 
+/**
+ *  Reads the bufferpool telemetry of the session of a source.
+ *  It never locks, so it can be polled from any thread to alert before
+ *  the bufferpool saturates.
+ *  @param stm_src an active ssrc
+ *  @param stats where to store the counters
+ *  @return 0
+ */
+int rtp_get_bp_stats(rtp_ssrc * stm_src, rtp_bp_stats * stats)
+{
+        buffer_pool *bp = stm_src->rtp_sess->bp;
+        int i;
+
+        stats->slots_in_use = bp->flcount;
+        stats->slots_allocated = bp->size;
+        stats->slots_max = BP_MAX_SIZE;
+        stats->high_water = bp->stats.high_water;
+        stats->enlarged = bp->stats.enlarged;
+        stats->dropped_full = bp->stats.drops[BP_DROP_FULL];
+        stats->dropped_evicted = bp->stats.drops[BP_DROP_EVICTED];
+        stats->dropped_late = bp->stats.drops[BP_DROP_LATE];
+        stats->dropped_duplicated = bp->stats.drops[BP_DROP_DUPLICATED];
+        stats->dropped_overrun = bp->stats.drops[BP_DROP_OVERRUN];
+        stats->dropped_truncated = bp->stats.drops[BP_DROP_TRUNCATED];
+        stats->dropped_invalid = bp->stats.drops[BP_DROP_INVALID];
+        stats->dropped_keyframe = bp->stats.drops[BP_DROP_KEYFRAME];
+        for (i = 0; i < RTP_BP_HIST_BUCKETS && i < BP_HIST_BUCKETS; i++)
+                stats->time_in_buffer[i] = bp->stats.hist[i];
+
+        return 0;
+}
+
+/**
+ *  Enables the time in buffer histogram of the bufferpool telemetry.
+ *  It is off by default, so that the clock is not read for every packet
+ *  consumed when nobody looks at it.
+ *  @param stm_src an active ssrc
+ *  @param enable 1 to fill the histogram, 0 to stop
+ */
+void rtp_set_bp_timing(rtp_ssrc * stm_src, int enable)
+{
+        stm_src->rtp_sess->bp->stats.timing = enable;
+}
+
 /**
  * Returns a pointer to Nth packet in the bufferpool for given playout buffer.
  * WARNING: the pointer returned is the memory space of the slot inside buffer pool:
  * Once the packet is decoded it must be removed from rtp queue using @see rtp_rm_pkt.
  * WARNING: returned pointer looks at a memory space not locked by mutex. This because
  * we suppose that there is only one reader for each playout buffer.
- * We lock mutex only for potail var reading.
  * @param stm_src The source for which to get the packet
  * @param len this is a return parameter for lenght of pkt. NULL value is allowed:
  * in this case, we understand that you are not interested about this value.
  * @param pkt_num The index of the packet we want to get.
- * shawill: this function put his dirty hands on bufferpool internals!!!
  * @return the pointer to next packet in buffer or NULL if playout buffer is empty.
  * */
 rtp_pkt *rtp_get_n_pkt(rtp_ssrc * stm_src, unsigned int *len, unsigned int pkt_num)
 {
-        // TODO complete;
         int buffer_index;
 
-        pthread_mutex_lock(&(stm_src->po->po_mutex));
-        buffer_index = stm_src->po->potail;
-        while ((buffer_index >= 0) && (pkt_num-- > 0))
-                buffer_index = stm_src->po->pobuff[buffer_index].next;
-        pthread_mutex_unlock(&(stm_src->po->po_mutex));
-
-        if (buffer_index < 0)
+        if ((buffer_index = popeek(stm_src->po, pkt_num)) < 0)
                 return NULL;
 
         if (len)
                 *len = (stm_src->po->pobuff[buffer_index]).pktlen;
 
-        return (rtp_pkt *) (*(stm_src->po->bufferpool) + buffer_index);
+        return (rtp_pkt *) PO_SLOT(stm_src->po, buffer_index);
 }
 
 /** Returns a pointer to next packet in the bufferpool for given playout buffer.
@@ -245,12 +507,10 @@ rtp_pkt *rtp_get_n_pkt(rtp_ssrc * stm_src, unsigned int *len, unsigned int pkt_n
  * WARNING: returned pointer looks at a memory space not locked by mutex.
  * This because
  * we suppose that there is only one reader for each playout buffer.
- * We lock mutex only for potail var reading.
  * @param stm_src The source for which to get the packet.
  * @param len this is a return parameter for lenght of pkt.
  * NULL value is allowed:
  * in this case, we understand that you are not interested about this value.
- * shawill: this function put its dirty hands on bufferpool internals!!!
  * @return the pointer to next packet in buffer or NULL if playout buffer
  * is empty.
  * */
@@ -259,14 +519,10 @@ rtp_pkt *rtp_get_pkt(rtp_ssrc * stm_src, size_t * len)
         int index;
 
         do {
-                pthread_mutex_lock(&(stm_src->po->po_mutex));
-                index = stm_src->po->potail;
-                pthread_mutex_unlock(&(stm_src->po->po_mutex));
-
-                if (index < 0) return NULL;
+                if ((index = popeek(stm_src->po, 0)) < 0)
+                        return NULL;
         } while (!stm_src->rtp_sess->
-                        ptdefs[((rtp_pkt *) (*(stm_src->po->bufferpool) +
-                                             index))->pt]
+                        ptdefs[((rtp_pkt *) PO_SLOT(stm_src->po, index))->pt]
                         &&
                         /* always true - XXX be careful if bufferpool API changes -> */
                         !rtp_rm_pkt(stm_src));
@@ -274,7 +530,7 @@ rtp_pkt *rtp_get_pkt(rtp_ssrc * stm_src, size_t * len)
         if (len)
                 *len = (stm_src->po->pobuff[index]).pktlen;
 
-        return (rtp_pkt *) (*(stm_src->po->bufferpool) + index);
+        return (rtp_pkt *) PO_SLOT(stm_src->po, index);
 }
 
 /**
@@ -284,8 +540,12 @@ rtp_pkt *rtp_get_pkt(rtp_ssrc * stm_src, size_t * len)
  */
 inline int rtp_rm_pkt(rtp_ssrc * stm_src)
 {
-        return bprmv(stm_src->rtp_sess->bp, stm_src->po,
-                     stm_src->po->potail);
+        int index;
+
+        if ((index = popeek(stm_src->po, 0)) < 0)
+                return 0;
+
+        return bprmv(stm_src->rtp_sess->bp, stm_src->po, index);
 }
 
 /**
@@ -299,6 +559,10 @@ static void socket_clear(rtp_ssrc * stm_src)
         fd_set readset;
         struct timeval timeout;
 
+        /* the packets queued there are for the other sessions too */
+        if (rtp_sess->muxed)
+                return;
+
         memset(&timeout, 0, sizeof(struct timeval));
 
         while (1) {
@@ -323,35 +587,14 @@ void rtp_rm_all_pkts(rtp_ssrc * stm_src)
 {
         playout_buff * po = stm_src->po;
         buffer_pool * bp = stm_src->rtp_sess->bp;
+        int index;
 
         //Clear the RECV BUFFER
         socket_clear(stm_src);
 
-        //Clear PLAYOUTBUFFER and Bufferpool
-        pthread_mutex_lock(&(po->po_mutex));
-        pthread_mutex_lock(&(bp->fl_mutex));
-        while (po->potail >= 0) {
-                int index = po->potail;
-
-                if (po->pobuff[index].next != -1)
-                        po->pobuff[po->pobuff[index].next].prev =
-                                po->pobuff[index].prev;
-                else
-                        po->potail = po->pobuff[index].prev;
-                if (po->pobuff[index].prev != -1)
-                        po->pobuff[po->pobuff[index].prev].next =
-                                po->pobuff[index].next;
-                else
-                        po->pohead = po->pobuff[index].next;
-
-                po->pocount--;
-
-                bp->freelist[index] = bp->flhead;
-                bp->flhead = index;
-                bp->flcount--;
-        }
-
-        pthread_cond_signal(&(bp->cond_full));
-        pthread_mutex_unlock(&(bp->fl_mutex));
-        pthread_mutex_unlock(&(po->po_mutex));
+        //Clear PLAYOUTBUFFER and Bufferpool, without waiting for the holes
+        do {
+                while ((index = popeek(po, 0)) >= 0)
+                        bprmv(bp, po, index);
+        } while (!poskip(po));
 }
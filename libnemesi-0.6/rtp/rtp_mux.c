@@ -0,0 +1,394 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+/** @file rtp_mux.c
+ * This file contains the demultiplexing of unicast RTP sessions sharing
+ * the same local port pair: every worker receives on its own RTP and RTCP
+ * socket bound with SO_REUSEPORT to that pair, and the datagrams are
+ * handed to the session of their sender through a hash table.
+ *
+ * The sessions are hashed by the address and port the server announced in
+ * the SETUP reply. Sessions sent from the same address and port are told
+ * apart by SSRC, either announced in the reply or learnt from the first
+ * packet of one of the payload types the session announced. Their RTCP
+ * packets go to the session which met the same SSRC in RTP.
+ */
+
+#include "rtp.h"
+#include "utils.h"
+
+#define RTP_MUX_HASH 1024       //!< buckets of the demultiplexing table, a power of 2
+
+struct rtp_mux_entry {
+        nms_addr addr;                  //!< address of the sender
+        in_port_t port;                 //!< port of the sender, 0 for any
+        enum rtp_protos proto;
+        uint32_t ssrc;                  //!< SSRC of the sender, if ssrc_known
+        volatile int ssrc_known;
+        rtp_session *rtp_sess;
+        void *data;                     //!< given by the caller of rtp_mux_add
+        struct rtp_mux_entry *next;
+};
+
+static int rtp_mux_socks;               //!< socket pairs open, one per worker
+static int (*rtp_mux_fds)[2];
+static pthread_rwlock_t rtp_mux_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct rtp_mux_entry *rtp_mux_table[RTP_MUX_HASH];
+
+static unsigned rtp_mux_hash(const nms_addr * addr, in_port_t port)
+{
+        const uint32_t *w = (const uint32_t *) &addr->addr;
+        uint32_t h = port;
+        int i, n = addr->family == AF_INET6 ? 4 : 1;
+
+        for (i = 0; i < n; i++)
+                h = (h ^ w[i]) * 0x9e3779b1;
+
+        return (h ^ (h >> 16)) & (RTP_MUX_HASH - 1);
+}
+
+/**
+ * Binds a UDP socket shared with SO_REUSEPORT.
+ *
+ * @return the socket, -1 on error
+ */
+static int rtp_mux_bind(int port)
+{
+        struct addrinfo hints, *res, *ressave;
+        char service[8];
+        int fd = -1, on = 1;
+
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_flags = AI_PASSIVE;
+#ifdef IPV6
+        hints.ai_family = AF_UNSPEC;
+#else
+        hints.ai_family = AF_INET;
+#endif
+        hints.ai_socktype = SOCK_DGRAM;
+        sprintf(service, "%d", port);
+
+        if (getaddrinfo(NULL, service, &hints, &res))
+                return -1;
+
+        for (ressave = res; res; res = res->ai_next) {
+                if ((fd = socket(res->ai_family, res->ai_socktype,
+                                 res->ai_protocol)) < 0)
+                        continue;
+                if (!setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+                                && !setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on,
+                                               sizeof(on))
+                                && !bind(fd, res->ai_addr, res->ai_addrlen)) {
+#ifdef SO_TIMESTAMPNS
+                        /* the batches are handed out late: keep the real times */
+                        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#endif
+                        break;
+                }
+                close(fd);
+                fd = -1;
+        }
+        freeaddrinfo(ressave);
+
+        return fd;
+}
+
+/**
+ * Opens the shared sockets: n RTP sockets bound to port and n RTCP
+ * sockets bound to port + 1, the kernel spreads the senders among them.
+ *
+ * @param port The even local port given to the servers
+ * @param n Number of socket pairs
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+int rtp_mux_open(int port, int n)
+{
+#ifdef SO_REUSEPORT
+        int i;
+
+        if (port <= 0 || port > 65534 || port % 2)
+                return nms_printf(NMSML_ERR,
+                                  "RTP shared port must be even (%d)\n", port);
+        if (rtp_mux_socks)
+                return nms_printf(NMSML_ERR, "RTP shared sockets already open\n");
+        if (!(rtp_mux_fds = calloc(n, sizeof(*rtp_mux_fds))))
+                return nms_printf(NMSML_FATAL, "Cannot allocate memory!\n");
+
+        for (i = 0; i < n; i++) {
+                if ((rtp_mux_fds[i][RTP] = rtp_mux_bind(port)) < 0)
+                        break;
+                if ((rtp_mux_fds[i][RTCP] = rtp_mux_bind(port + 1)) < 0) {
+                        close(rtp_mux_fds[i][RTP]);
+                        break;
+                }
+        }
+        rtp_mux_socks = i;
+        if (i < n) {
+                rtp_mux_close();
+                return nms_printf(NMSML_ERR,
+                                  "Cannot bind the RTP shared ports %d-%d\n",
+                                  port, port + 1);
+        }
+        nms_printf(NMSML_DBG1, "RTP shared ports %d-%d, %d sockets each\n",
+                   port, port + 1, n);
+
+        return 0;
+#else
+        return nms_printf(NMSML_ERR, "SO_REUSEPORT not supported\n");
+#endif
+}
+
+/**
+ * Closes the shared sockets. No session must be using them.
+ */
+void rtp_mux_close(void)
+{
+        int i;
+
+        for (i = 0; i < rtp_mux_socks; i++) {
+                close(rtp_mux_fds[i][RTP]);
+                close(rtp_mux_fds[i][RTCP]);
+        }
+        free(rtp_mux_fds);
+        rtp_mux_fds = NULL;
+        rtp_mux_socks = 0;
+}
+
+/**
+ * @return 1 if new unicast sessions share the sockets, 0 otherwise
+ */
+int rtp_mux_active(void)
+{
+        return rtp_mux_socks > 0;
+}
+
+/**
+ * @param i Index of the socket pair
+ * @param proto RTP or RTCP
+ *
+ * @return the shared socket
+ */
+int rtp_mux_fd(int i, enum rtp_protos proto)
+{
+        return rtp_mux_fds[i][proto];
+}
+
+/**
+ * Sets up the transport of a session on the shared sockets, instead of
+ * binding a port pair of its own. The sockets of the session are used to
+ * send its RTCP reports and are not closed with it.
+ *
+ * @param rtp_sess The session
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+int rtp_mux_setup(rtp_session * rtp_sess)
+{
+        struct sockaddr_storage rtpaddr, rtcpaddr;
+        socklen_t rtplen = sizeof(rtpaddr), rtcplen = sizeof(rtcpaddr);
+
+        if (!rtp_mux_socks
+                        || getsockname(rtp_mux_fds[0][RTP],
+                                       (struct sockaddr *) &rtpaddr, &rtplen)
+                        || getsockname(rtp_mux_fds[0][RTCP],
+                                       (struct sockaddr *) &rtcpaddr, &rtcplen))
+                return 1;
+
+        rtp_sess->transport.RTP.sock.fd = rtp_mux_fds[0][RTP];
+        rtp_sess->transport.RTCP.sock.fd = rtp_mux_fds[0][RTCP];
+        rtp_sess->transport.RTP.sock.local_port =
+                ntohs(sock_get_port((struct sockaddr *) &rtpaddr));
+        rtp_sess->transport.RTCP.sock.local_port =
+                ntohs(sock_get_port((struct sockaddr *) &rtcpaddr));
+        rtp_sess->muxed = 1;
+
+        return 0;
+}
+
+/**
+ * Adds a session to the demultiplexing table, once the server told where
+ * it sends from.
+ *
+ * @param rtp_sess The session, on the shared sockets
+ * @param proto RTP or RTCP
+ * @param data What rtp_mux_find returns for the datagrams of the session
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+int rtp_mux_add(rtp_session * rtp_sess, enum rtp_protos proto, void *data)
+{
+        struct rtp_mux_entry *e;
+        unsigned h;
+
+        if (!(e = calloc(1, sizeof(struct rtp_mux_entry))))
+                return 1;
+
+        e->addr = rtp_sess->transport.RTP.u.udp.srcaddr;
+        e->port = proto == RTP ? rtp_sess->transport.RTP.sock.remote_port
+                  : rtp_sess->transport.RTCP.sock.remote_port;
+        e->proto = proto;
+        /* the transport has our SSRC unless the server told its own */
+        if (rtp_sess->transport.ssrc != rtp_sess->local_ssrc) {
+                e->ssrc = rtp_sess->transport.ssrc;
+                e->ssrc_known = 1;
+        }
+        e->rtp_sess = rtp_sess;
+        e->data = data;
+
+        h = rtp_mux_hash(&e->addr, e->port);
+        pthread_rwlock_wrlock(&rtp_mux_lock);
+        e->next = rtp_mux_table[h];
+        rtp_mux_table[h] = e;
+        pthread_rwlock_unlock(&rtp_mux_lock);
+
+        return 0;
+}
+
+/**
+ * Removes a session from the demultiplexing table. Once it returns no
+ * worker is handing datagrams to the session any more.
+ *
+ * @param rtp_sess The session
+ */
+void rtp_mux_del(rtp_session * rtp_sess)
+{
+        struct rtp_mux_entry *e, **prev;
+        in_port_t ports[2];
+        int i;
+
+        ports[RTP] = rtp_sess->transport.RTP.sock.remote_port;
+        ports[RTCP] = rtp_sess->transport.RTCP.sock.remote_port;
+
+        pthread_rwlock_wrlock(&rtp_mux_lock);
+        for (i = RTP; i <= RTCP; i++)
+                for (prev = &rtp_mux_table[rtp_mux_hash
+                                           (&rtp_sess->transport.RTP.u.udp.srcaddr,
+                                            ports[i])]; (e = *prev);)
+                        if (e->rtp_sess == rtp_sess) {
+                                *prev = e->next;
+                                free(e);
+                        } else {
+                                prev = &e->next;
+                        }
+        pthread_rwlock_unlock(&rtp_mux_lock);
+}
+
+/**
+ * Takes the demultiplexing table for reading: the sessions found stay
+ * valid until rtp_mux_unlock.
+ */
+void rtp_mux_rdlock(void)
+{
+        pthread_rwlock_rdlock(&rtp_mux_lock);
+}
+
+void rtp_mux_unlock(void)
+{
+        pthread_rwlock_unlock(&rtp_mux_lock);
+}
+
+/**
+ * Tells if an entry whose sender SSRC is not known yet can take a
+ * datagram: RTP packets need one of the payload types the session
+ * announced, RTCP ones an SSRC the session already met in RTP.
+ */
+static int rtp_mux_claims(struct rtp_mux_entry *e, uint32_t ssrc, int pt)
+{
+        rtp_fmts_list *fmt;
+
+        if (e->proto == RTP) {
+                for (fmt = e->rtp_sess->announced_fmts; fmt; fmt = fmt->next)
+                        if (fmt->pt == pt)
+                                return 1;
+        } else if (rtp_ssrc_find(e->rtp_sess, ssrc))
+                return 1;
+
+        return 0;
+}
+
+/**
+ * Looks up one bucket of the table.
+ */
+static struct rtp_mux_entry *rtp_mux_lookup(const nms_addr * addr,
+                                            in_port_t port, uint32_t ssrc,
+                                            int pt, enum rtp_protos proto)
+{
+        struct rtp_mux_entry *e, *last = NULL, *unknown = NULL;
+        int found = 0;
+
+        for (e = rtp_mux_table[rtp_mux_hash(addr, port)]; e; e = e->next) {
+                if (e->proto != proto || e->port != port
+                                || nms_addr_cmp(&e->addr, addr))
+                        continue;
+                if (e->ssrc_known && e->ssrc == ssrc)
+                        return e;
+                if (!e->ssrc_known && !unknown && rtp_mux_claims(e, ssrc, pt))
+                        unknown = e;
+                last = e;
+                found++;
+        }
+
+        if (unknown && proto == RTP) {
+                /*
+                 * A sender address and port always hash to the same shared
+                 * socket, thus to the same worker: no one else writes here.
+                 */
+                unknown->ssrc = ssrc;
+                nms_barrier();
+                unknown->ssrc_known = 1;
+        }
+        if (unknown)
+                return unknown;
+
+        /* a single session from there: its source changed SSRC */
+        return found == 1 ? last : NULL;
+}
+
+/**
+ * Finds the session a datagram received on a shared socket was sent to.
+ * The caller holds rtp_mux_rdlock.
+ *
+ * @param from The sender of the datagram
+ * @param ssrc The SSRC of the sender, from the RTP or RTCP header
+ * @param pt The RTP payload type, -1 for RTCP
+ * @param proto RTP or RTCP
+ *
+ * @return what was given to rtp_mux_add for the session, NULL if unknown
+ */
+void *rtp_mux_find(nms_sockaddr * from, uint32_t ssrc, int pt,
+                   enum rtp_protos proto)
+{
+        struct rtp_mux_entry *e;
+        nms_addr addr;
+        in_port_t port;
+
+        if (sockaddr_get_nms_addr(from->addr, &addr))
+                return NULL;
+        port = ntohs(sock_get_port(from->addr));
+
+        /* servers that did not tell their ports are hashed with port 0 */
+        if (!(e = rtp_mux_lookup(&addr, port, ssrc, pt, proto)))
+                e = rtp_mux_lookup(&addr, 0, ssrc, pt, proto);
+
+        return e ? e->data : NULL;
+}
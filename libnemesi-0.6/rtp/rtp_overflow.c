@@ -0,0 +1,206 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+/** @file rtp_overflow.c
+ * This file contains the overflow policies applied by rtp_recv when the
+ * bufferpool of a session is full.
+ */
+
+#include "rtp.h"
+#include "rtpptdefs.h"
+#include "bufferpool.h"
+#include "parsers/rtpparsers.h"
+#include "utils.h"
+
+/**
+ * Applies the overflow policy of the session after bpget failed, and tries
+ * again to get a slot.
+ *
+ * The RTP thread used to block forever (or reboot) when the application
+ * stopped reading; now only the stream of the slow reader loses packets.
+ *
+ * @param rtp_sess The RTP session whose bufferpool is full
+ *
+ * @return the slot index, -1 if the packet must be discarded
+ */
+int rtp_overflow(rtp_session * rtp_sess)
+{
+        struct rtp_overflow_stats *stats = &rtp_sess->ovf_stats;
+        rtp_ssrc *stm_src, *victim = NULL;
+        int slot;
+
+        stats->overflows++;
+
+        switch (rtp_sess->overflow_policy) {
+        case RTP_OVF_DROP_OLDEST:
+                for (stm_src = rtp_sess->ssrc_queue; stm_src;
+                                stm_src = stm_src->next)
+                        if (!victim || stm_src->po->pocount > victim->po->pocount)
+                                victim = stm_src;
+                if (victim && (slot = poevict(victim->po)) >= 0) {
+                        bpfree(rtp_sess->bp, slot);
+                        stats->evicted++;
+                        BP_STAT_DROP(rtp_sess->bp, BP_DROP_EVICTED);
+                }
+                break;
+        case RTP_OVF_DROP_TO_KEYFRAME:
+                for (stm_src = rtp_sess->ssrc_queue; stm_src;
+                                stm_src = stm_src->next) {
+                        while ((slot = poevict(stm_src->po)) >= 0) {
+                                bpfree(rtp_sess->bp, slot);
+                                stats->evicted++;
+                                BP_STAT_DROP(rtp_sess->bp, BP_DROP_EVICTED);
+                        }
+                        stm_src->wait_keyframe = 1;
+                }
+                break;
+        case RTP_OVF_BLOCK:
+                stats->waits++;
+                if (bpwait(rtp_sess->bp, rtp_sess->overflow_timeout))
+                        stats->timeouts++;
+                break;
+        case RTP_OVF_DROP_NEWEST:
+        default:
+                break;
+        }
+
+        if ((slot = bpget(rtp_sess->bp)) < 0)
+                stats->dropped++;
+
+        return slot;
+}
+
+/**
+ * Tells whether an H.264 packet starts a keyframe: SPS or IDR slice,
+ * alone, first in an aggregation packet or in the first fragment.
+ */
+static int h264_keyframe(uint8_t * data, int len)
+{
+        int type;
+
+        if (len < 2)
+                return 0;
+
+        switch ((type = data[0] & 0x1f)) {
+        case 24:        // STAP-A
+                if (len < 4)
+                        return 0;
+                type = data[3] & 0x1f;
+                break;
+        case 25:        // STAP-B
+                if (len < 6)
+                        return 0;
+                type = data[5] & 0x1f;
+                break;
+        case 26:        // MTAP-16
+                if (len < 9)
+                        return 0;
+                type = data[8] & 0x1f;
+                break;
+        case 27:        // MTAP-24
+                if (len < 10)
+                        return 0;
+                type = data[9] & 0x1f;
+                break;
+        case 28:        // FU-A
+        case 29:        // FU-B
+                if (!(data[1] & 0x80))
+                        return 0;
+                type = data[1] & 0x1f;
+                break;
+        }
+
+        return type == 5 || type == 7;
+}
+
+/**
+ * Tells whether an H.265 packet starts a keyframe: VPS or IRAP picture,
+ * alone, first in an aggregation packet or in the first fragment.
+ *
+ * @param donl 1 if the packets carry decoding order numbers, 0 otherwise
+ */
+static int h265_keyframe(uint8_t * data, int len, int donl)
+{
+        int type;
+
+        if (len < 3)
+                return 0;
+
+        switch ((type = (data[0] >> 1) & 0x3f)) {
+        case 48:        // AP, the first NAL unit after its DONL and size
+                if (len < 5 + 2 * donl)
+                        return 0;
+                type = (data[4 + 2 * donl] >> 1) & 0x3f;
+                break;
+        case 49:        // FU, the DONL follows the FU header
+                if (len < 3 + 2 * donl || !(data[2] & 0x80))
+                        return 0;
+                type = data[2] & 0x3f;
+                break;
+        }
+
+        return (type >= 16 && type <= 21) || type == 32;
+}
+
+/**
+ * Checks a packet of a source waiting for a keyframe after the
+ * RTP_OVF_DROP_TO_KEYFRAME policy flushed its queue.
+ *
+ * For H.264 and H.265 the wait ends on the packet starting a keyframe,
+ * for audio at once, for other payloads on the packet following a marker
+ * bit, that is at the next frame boundary.
+ *
+ * @param stm_src The source of the packet
+ * @param pkt The packet received
+ * @param len The length of the packet
+ *
+ * @return 1 if the packet must be discarded, 0 otherwise.
+ */
+int rtp_keyframe_skip(rtp_ssrc * stm_src, rtp_pkt * pkt, int len)
+{
+        rtp_pt *pt = stm_src->rtp_sess->ptdefs[pkt->pt];
+        uint8_t *data = RTP_PKT_DATA(pkt);
+
+        len -= data - (uint8_t *) pkt;
+        if (pkt->ext && len >= 4) {
+                len -= 4 + 4 * ((data[2] << 8) | data[3]);
+                data += 4 + 4 * ((data[2] << 8) | data[3]);
+        }
+
+        if (!pt || pt->type == AU) {
+                stm_src->wait_keyframe = 0;
+        } else if (!strcasecmp(pt->name, "H264")) {
+                if (h264_keyframe(data, len))
+                        stm_src->wait_keyframe = 0;
+        } else if (!strcasecmp(pt->name, "H265")) {
+                if (h265_keyframe(data, len,
+                                  rtp_h265_donl(stm_src->rtp_sess, pkt->pt)))
+                        stm_src->wait_keyframe = 0;
+        } else if (stm_src->wait_keyframe < 0) {
+                /* the previous packet closed a frame */
+                stm_src->wait_keyframe = 0;
+        } else if (pkt->mark) {
+                stm_src->wait_keyframe = -1;
+        }
+
+        return stm_src->wait_keyframe != 0;
+}
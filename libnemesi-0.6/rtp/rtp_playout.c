@@ -0,0 +1,183 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+/** @file rtp_playout.c
+ * This file contains the adaptive playout delay: packets are handed to the
+ * application when their RTP timestamp, mapped to the local clock, plus a
+ * delay following the measured jitter is due.
+ */
+
+#include "rtp.h"
+#include "rtpptdefs.h"
+
+/**
+ * Local time in RTP timestamp units, computed like the transit time
+ * of rtp_recv.
+ */
+static uint32_t rtp_now_ts(unsigned rate)
+{
+        struct timeval now;
+
+        gettimeofday(&now, NULL);
+
+        return rtp_tv2ts(&now, rate);
+}
+
+/**
+ * Restarts the playout delay of a source, on its first packet and after
+ * a seek.
+ *
+ * @param stm_src The source
+ * @param transit The transit time of the packet received, in timestamp units
+ * @param rate The clock rate of the packet received
+ */
+void rtp_playout_reset(rtp_ssrc * stm_src, uint32_t transit, unsigned rate)
+{
+        struct rtp_playout *playout = &stm_src->playout;
+
+        playout->delay = stm_src->rtp_sess->playout_delay_min;
+        playout->transit_min = transit;
+        playout->rate = rate;
+        playout->delay_ts = (uint32_t) (playout->delay * rate / 1000.);
+}
+
+/**
+ * Tunes the playout delay of a source after the jitter was updated by
+ * rtp_recv.
+ *
+ * The smallest transit time seen is the reference for the packets which
+ * were not delayed by the network. The delay is raised at once to
+ * RTP_PLAYOUT_JITTER_MUL times the jitter and lowered slowly, so that
+ * one quiet period does not lead to underruns on the next burst.
+ *
+ * @param stm_src The source
+ * @param transit The transit time of the packet received, in timestamp units
+ * @param rate The clock rate of the packet received
+ */
+void rtp_playout_update(rtp_ssrc * stm_src, uint32_t transit, unsigned rate)
+{
+        struct rtp_playout *playout = &stm_src->playout;
+        rtp_session *rtp_sess = stm_src->rtp_sess;
+        double target;
+
+        if (rate != playout->rate) {
+                rtp_playout_reset(stm_src, transit, rate);
+                return;
+        }
+
+        if ((int32_t) (transit - playout->transit_min) < 0)
+                playout->transit_min = transit;
+
+        target = RTP_PLAYOUT_JITTER_MUL * (stm_src->ssrc_stats.jitter / 16.) *
+                 1000. / rate;
+        if (target < rtp_sess->playout_delay_min)
+                target = rtp_sess->playout_delay_min;
+        if (rtp_sess->playout_delay_max
+                        && target > rtp_sess->playout_delay_max)
+                target = rtp_sess->playout_delay_max;
+
+        if (target > playout->delay)
+                playout->delay = target;
+        else
+                playout->delay += (target - playout->delay) / 64.;
+
+        playout->delay_ts = (uint32_t) (playout->delay * rate / 1000.);
+}
+
+/**
+ * Tells if a packet can be handed to the application.
+ *
+ * @param stm_src The source of the packet
+ * @param pkt The oldest packet queued for the source
+ *
+ * @return 1 if the playout time of the packet is due or there is no
+ * playout delay for the session, 0 otherwise.
+ */
+int rtp_playout_due(rtp_ssrc * stm_src, rtp_pkt * pkt)
+{
+        return !rtp_playout_wait(stm_src, pkt);
+}
+
+/**
+ * Tells how long a packet has still to wait before it can be handed to
+ * the application.
+ *
+ * @param stm_src The source of the packet
+ * @param pkt The oldest packet queued for the source
+ *
+ * @return the wait in msec, rounded up, 0 if the packet is due.
+ */
+int rtp_playout_wait(rtp_ssrc * stm_src, rtp_pkt * pkt)
+{
+        struct rtp_playout *playout = &stm_src->playout;
+        unsigned rate = playout->rate;
+        int32_t early;
+
+        if (!RTP_PLAYOUT_ON(stm_src->rtp_sess) || !rate)
+                return 0;
+
+        early = (int32_t) (RTP_PKT_TS(pkt) + playout->transit_min
+                           + playout->delay_ts - rtp_now_ts(rate));
+        if (early <= 0)
+                return 0;
+
+        return (int) (((int64_t) early * 1000 + rate - 1) / rate);
+}
+
+/**
+ * Sets the bounds of the adaptive playout delay of the session
+ * of a source.
+ *
+ * @param stm_src an active ssrc
+ * @param min_delay The smallest delay, in msec
+ * @param max_delay The biggest delay, in msec, 0 for no upper bound
+ *
+ * Both bounds 0 disable the playout delay.
+ *
+ * @return 0, 1 if the bounds are not valid
+ */
+int rtp_set_playout_delay(rtp_ssrc * stm_src, int min_delay, int max_delay)
+{
+        rtp_session *rtp_sess = stm_src->rtp_sess;
+
+        if (min_delay < 0 || max_delay < 0
+                        || (max_delay && max_delay < min_delay))
+                return 1;
+
+        rtp_sess->playout_delay_min = min_delay;
+        rtp_sess->playout_delay_max = max_delay;
+
+        return 0;
+}
+
+/**
+ * Gets the current playout delay of a source.
+ *
+ * @param stm_src an active ssrc
+ *
+ * @return the delay in msec
+ */
+double rtp_get_playout_delay(rtp_ssrc * stm_src)
+{
+        return RTP_PLAYOUT_ON(stm_src->rtp_sess) ?
+               stm_src->playout.delay : 0;
+}
@@ -24,10 +24,36 @@
  * This file contains the functions that perform packet reception and validity check.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* recvmmsg */
+#endif
+
 #include "rtp.h"
 #include "rtpptdefs.h"
 #include "bufferpool.h"
+#include "utils.h"
 #include <sys/time.h>
+#include <netinet/udp.h>
+
+#ifdef MSG_TRUNC
+#define RTP_RECV_FLAGS MSG_TRUNC
+#else
+#define RTP_RECV_FLAGS 0
+#endif
+
+#ifdef UDP_GRO
+#define RTP_GRO_SEGS 64         //!< most datagrams the kernel coalesces
+#define RTP_GRO_STAGE 65536     //!< biggest coalesced datagram
+
+/**
+ * Room for the control messages of a coalesced datagram: its segment
+ * size and, if the session takes them, its kernel reception time.
+ */
+typedef union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct timespec))];
+} rtp_gro_cmsg;
+#endif
 
 /**
  * Checks if the RTP header is valid for the given packet
@@ -95,7 +121,7 @@ static void rtp_init_seq(rtp_ssrc * stm_src, uint16_t seq)
         stats->base_seq = seq - 1;    // FIXME: in rfc 3550 it's set to seq.
         stats->max_seq = seq;
         stats->bad_seq = RTP_SEQ_MOD + 1;
-        stats->cycles = 0;
+        stats->ext_max_seq = seq;
         stats->received = 0;
         stats->received_prior = 0;
         stats->expected_prior = 1;
@@ -126,6 +152,7 @@ static void rtp_update_seq(rtp_ssrc * stm_src, uint16_t seq)
                 if (seq == stats->max_seq + 1) {
                         stats->probation--;
                         stats->max_seq = seq;
+                        stats->ext_max_seq = seq;
                         if (stats->probation == 0) {
                                 rtp_init_seq(stm_src, seq);
                                 stats->received++;
@@ -134,15 +161,15 @@ static void rtp_update_seq(rtp_ssrc * stm_src, uint16_t seq)
                 } else {
                         stats->probation = MIN_SEQUENTIAL - 1;
                         stats->max_seq = seq;
+                        stats->ext_max_seq = seq;
                 }
                 return;
         } else if (udelta < MAX_DROPOUT) {
-                if (seq < stats->max_seq) {
-                        /*
-                         * Sequence number wrapped - count another 64k cycle.
-                         */
-                        stats->cycles += RTP_SEQ_MOD;
-                }
+                /*
+                 * In order, with a permissible gap: a wrap of the
+                 * sequence number is carried into the extended one.
+                 */
+                stats->ext_max_seq += udelta;
                 stats->max_seq = seq;
         } else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
                 /* the sequence number made a very large jump */
@@ -160,14 +187,59 @@ static void rtp_update_seq(rtp_ssrc * stm_src, uint16_t seq)
 }
 
 /**
- * Reads a packet from the RTP socket. Checks if its valid,
- * creates a new source if the sender of the packet isnt already known
- * and appends it to the playout buffer of the source.
+ * Extends a sequence number to 64 bits using the highest one seen
+ * for the source, so that packets misordered across a wrap of the 16 bits
+ * field get the right cycle.
  *
- * @param rtp_sess The RTP session for which to receive the packet
+ * @param stm_src The source the packet belongs to
+ * @param seq The sequence number of the packet
  *
- * @return 0 if the packet was correctly received, 1 otherwise.
+ * @return the extended sequence number
+ */
+uint64_t rtp_ext_seq(rtp_ssrc * stm_src, uint16_t seq)
+{
+        struct rtp_ssrc_stats *stats = &(stm_src->ssrc_stats);
+
+        return stats->ext_max_seq + (int16_t) (seq - stats->max_seq);
+}
+
+/**
+ * Converts a wallclock time to RTP timestamp units, modulo 2^32.
+ *
+ * @param tv The time
+ * @param rate The clock rate
+ *
+ * @return the time in timestamp units
  */
+uint32_t rtp_tv2ts(const struct timeval *tv, unsigned rate)
+{
+        return (uint32_t) ((uint64_t) tv->tv_sec * rate +
+                           (uint64_t) tv->tv_usec * rate / 1000000);
+}
+
+/**
+ * Gets the clock rate of the payload type of a packet, looked up again
+ * only when the source changes payload type.
+ *
+ * @param stm_src The source of the packet
+ * @param pt The payload type of the packet
+ *
+ * @return the clock rate, RTP_DEF_CLK_RATE if the payload type has none
+ */
+static unsigned rtp_clock_rate(rtp_ssrc * stm_src, unsigned pt)
+{
+        rtp_session *rtp_sess = stm_src->rtp_sess;
+
+        if (pt != stm_src->rate_pt || !stm_src->rate) {
+                if (!rtp_sess->ptdefs[pt]
+                                || !(stm_src->rate = rtp_sess->ptdefs[pt]->rate))
+                        stm_src->rate = RTP_DEF_CLK_RATE;
+                stm_src->rate_pt = pt;
+        }
+
+        return stm_src->rate;
+}
+
  #if 0
 	 typedef struct {
 			uint8_t *data;	   //!< constructed frame, fragments will be copied there
@@ -181,67 +253,43 @@ static void rtp_update_seq(rtp_ssrc * stm_src, uint16_t seq)
 #define nms_consume_1(buff) *((uint8_t*)(*(buff))++)
 #define RTP_PKT_DATA(pkt)   (pkt->data  + (pkt->cc * 4)) 
 #endif
-int rtp_recv(rtp_session * rtp_sess)
-{
 
-        int n;
+/**
+ * Validates a packet received in a bufferpool slot, creates a new source
+ * if the sender of the packet isnt already known and appends it to the
+ * playout buffer of the source. The slot is given back to the bufferpool
+ * if the packet is discarded.
+ *
+ * @param rtp_sess The RTP session the packet was received for
+ * @param slot The bufferpool slot holding the packet
+ * @param n The size of the datagram
+ * @param server The address of the sender
+ * @param now The reception time
+ *
+ * @return 0 if the packet was correctly received, 1 otherwise.
+ */
+int rtp_recv_pkt(rtp_session * rtp_sess, int slot, int n,
+                 nms_sockaddr * server, struct timeval *now)
+{
         unsigned rate;
-        int slot;
         rtp_pkt *pkt;
         rtp_ssrc *stm_src;
-        struct timeval now;
-        unsigned transit;
-        int delta;
-
-        struct sockaddr_storage serveraddr;
-        nms_sockaddr server = { (struct sockaddr *) &serveraddr, sizeof(serveraddr) };
-
-        {
-            static int aaabbbccc;
-            if (aaabbbccc++ % 100 == 0) {
-                printf("Local SSRC: %u, flcount: %d\n", rtp_sess->local_ssrc, rtp_sess->bp->flcount);
-            }
-        }
+        uint32_t transit;
+        int32_t delta;
 
-        if ((slot = bpget(rtp_sess->bp)) < 0) {
+        if (n > BP_SLOT_LEN(rtp_sess->bp, slot)) {
                 nms_printf(NMSML_VERB,
-                           "No more space in Playout Buffer!" BLANK_LINE);
-                return 1;
+                           "RTP packet of %d bytes truncated, raising slot size\n",
+                           n);
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_TRUNCATED);
+                bpfree(rtp_sess->bp, slot);
+                if (bpresize(rtp_sess->bp, n))
+                        nms_printf(NMSML_WARN,
+                                   "RTP packet of %d bytes is too big\n", n);
+                return 0;
         }
 
-        if ((n = recvfrom(rtp_sess->transport.RTP.sock.fd,
-                          &(rtp_sess->bp->bufferpool[slot]),
-                          BP_SLOT_SIZE, 0, server.addr, &server.addr_len)) == -1) {
-                switch (errno) {
-                case EBADF:
-                        nms_printf(NMSML_ERR,
-                                   "RTP recvfrom: invalid descriptor\n");
-                        break;
-#ifndef WIN32
-                case ENOTSOCK:
-                        nms_printf(NMSML_ERR, "RTP recvfrom: not a socket\n");
-                        break;
-#endif
-                case EINTR:
-                        nms_printf(NMSML_ERR,
-                                   "RTP recvfrom: The receive was interrupted by delivery"
-                                   " of a signal\n");
-                        break;
-                case EFAULT:
-                        nms_printf(NMSML_ERR,
-                                   "RTP recvfrom: The buffer points outside userspace\n");
-                        break;
-                case EINVAL:
-                        nms_printf(NMSML_ERR,
-                                   "RTP recvfrom: Invalid argument passed.\n");
-                        break;
-                default:
-                        nms_printf(NMSML_ERR, "in RTP recvfrom\n");
-                        break;
-                }
-                return 1;
-        }
-        pkt = (rtp_pkt *)(&rtp_sess->bp->bufferpool[slot]);
+        pkt = (rtp_pkt *) BP_SLOT(rtp_sess->bp, slot);
 #if 0
 		{
 				char *tbuf;
@@ -266,28 +314,26 @@ int rtp_recv(rtp_session * rtp_sess)
 					}
 		}
 #endif
-        gettimeofday(&now, NULL);
-
-
         if (rtp_hdr_val_chk(pkt, n)) {
                 nms_printf(NMSML_NORM, "RTP header validity check FAILED!\n");
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_INVALID);
                 bpfree(rtp_sess->bp, slot);
                 return 0;
         }
 
         switch (rtp_ssrc_check (rtp_sess, RTP_PKT_SSRC(pkt),
-                                &stm_src, &server, RTP)) {
+                                &stm_src, server, RTP)) {
         case SSRC_KNOWN:
                 if (stm_src->done_seek) {
                         stm_src->ssrc_stats.probation = 0;
                         stm_src->ssrc_stats.max_seq = RTP_PKT_SEQ(pkt);
+                        stm_src->ssrc_stats.ext_max_seq = RTP_PKT_SEQ(pkt);
                         stm_src->ssrc_stats.firstts = RTP_PKT_TS(pkt);
-                        stm_src->ssrc_stats.firsttv = now;
+                        stm_src->ssrc_stats.firsttv = *now;
                         stm_src->ssrc_stats.jitter = 0;
 
                         stm_src->ssrc_stats.base_seq = RTP_PKT_SEQ(pkt) - 1;    // FIXME: in rfc 3550 it's set to seq.
                         stm_src->ssrc_stats.bad_seq = RTP_SEQ_MOD + 1;
-                        stm_src->ssrc_stats.cycles = 0;
                         stm_src->ssrc_stats.received = 0;
                         stm_src->ssrc_stats.received_prior = 0;
                         stm_src->ssrc_stats.expected_prior = 1;
@@ -296,24 +342,22 @@ int rtp_recv(rtp_session * rtp_sess)
                 rtp_update_seq(stm_src, RTP_PKT_SEQ(pkt));
                 rtp_update_fps(stm_src, RTP_PKT_TS(pkt), RTP_PKT_PT(pkt));
 
-                if (!rtp_sess->ptdefs[pkt->pt]
-                                || !(rate = (rtp_sess->ptdefs[pkt->pt]->rate)))
-                        rate = RTP_DEF_CLK_RATE;
-
-                transit = (uint32_t) (((double) now.tv_sec +
-                                       (double) now.tv_usec / 1000000.0) *
-                                      (double) rate) - ntohl(pkt->time);
+                rate = rtp_clock_rate(stm_src, pkt->pt);
+                transit = rtp_tv2ts(now, rate) - RTP_PKT_TS(pkt);
                 delta = transit - stm_src->ssrc_stats.transit;
                 stm_src->ssrc_stats.transit = transit;
 
                 if (stm_src->done_seek) {
                         nms_printf(NMSML_NORM, "Seek reset performed on %u\n", stm_src->ssrc_stats.firstts);
                         stm_src->done_seek = 0;
+                        rtp_playout_reset(stm_src, transit, rate);
                 } else {
                         if (delta < 0)
                                 delta = -delta;
+                        /* J += (|D| - J) / 16, with J scaled by 16 */
                         stm_src->ssrc_stats.jitter +=
-                                (1. / 16.) * ((double) delta - stm_src->ssrc_stats.jitter);
+                                delta - ((stm_src->ssrc_stats.jitter + 8) >> 4);
+                        rtp_playout_update(stm_src, transit, rate);
                 }
                 break;
         case SSRC_NEW:
@@ -322,24 +366,22 @@ int rtp_recv(rtp_session * rtp_sess)
         case SSRC_RTPNEW:
                 stm_src->ssrc_stats.probation = MIN_SEQUENTIAL;
                 stm_src->ssrc_stats.max_seq = RTP_PKT_SEQ(pkt) - 1;
+                stm_src->ssrc_stats.ext_max_seq = stm_src->ssrc_stats.max_seq;
 
-                if (!rtp_sess->ptdefs[pkt->pt]
-                                || !(rate = (rtp_sess->ptdefs[pkt->pt]->rate)))
-                        rate = RTP_DEF_CLK_RATE;
+                rate = rtp_clock_rate(stm_src, pkt->pt);
                 (stm_src->ssrc_stats).transit =
-                        (uint32_t) (((double) now.tv_sec +
-                                     (double) now.tv_usec / 1000000.0) *
-                                    (double) rate) - ntohl(pkt->time);
+                        rtp_tv2ts(now, rate) - RTP_PKT_TS(pkt);
 
                 (stm_src->ssrc_stats).jitter = 0;
+                rtp_playout_reset(stm_src, (stm_src->ssrc_stats).transit, rate);
                 (stm_src->ssrc_stats).firstts = RTP_PKT_TS(pkt);
-                (stm_src->ssrc_stats).firsttv = now;
+                (stm_src->ssrc_stats).firsttv = *now;
 
                 rtp_update_seq(stm_src, RTP_PKT_SEQ(pkt));
                 rtp_update_fps(stm_src, RTP_PKT_TS(pkt), RTP_PKT_PT(pkt));
                 break;
         case SSRC_COLLISION:
-                bprmv(rtp_sess->bp, stm_src->po, slot);
+                bpfree(rtp_sess->bp, slot);
                 return 0;
                 break;
         case -1:
@@ -349,10 +391,38 @@ int rtp_recv(rtp_session * rtp_sess)
                 break;
         }
 
-        switch (poadd(stm_src->po, slot, stm_src->ssrc_stats.cycles)) {
+        if (stm_src->wait_keyframe && rtp_keyframe_skip(stm_src, pkt, n)) {
+                rtp_sess->ovf_stats.dropped++;
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_KEYFRAME);
+                bpfree(rtp_sess->bp, slot);
+                return 0;
+        }
+
+        /* the slot is published to the reader by poadd: fill it first */
+        stm_src->po->pobuff[slot].pktlen = n;
+        stm_src->po->pobuff[slot].arrival =
+                (uint32_t) now->tv_sec * 1000 + now->tv_usec / 1000;
+
+        switch (poadd(stm_src->po, slot,
+                      rtp_ext_seq(stm_src, RTP_PKT_SEQ(pkt)))) {
         case PKT_DUPLICATED:
                 nms_printf(NMSML_VERB,
                            "WARNING: Duplicate packet found... discarded\n");
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_DUPLICATED);
+                bpfree(rtp_sess->bp, slot);
+                return 0;
+                break;
+        case PKT_LATE:
+                nms_printf(NMSML_VERB,
+                           "WARNING: Late packet found... discarded\n");
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_LATE);
+                bpfree(rtp_sess->bp, slot);
+                return 0;
+                break;
+        case PKT_OVERRUN:
+                nms_printf(NMSML_VERB,
+                           "WARNING: Packet beyond playout buffer... discarded\n");
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_OVERRUN);
                 bpfree(rtp_sess->bp, slot);
                 return 0;
                 break;
@@ -364,10 +434,496 @@ int rtp_recv(rtp_session * rtp_sess)
                 break;
         }
 
-        stm_src->po->pobuff[slot].pktlen = n;
-		if (n == 36 || n == 37)
-		{
-			//printf("recv %d bytes\n", n);
-		} 
+        if (rtp_wait_frame_end(stm_src, pkt) && rtp_sess->frame_cb) {
+                rtp_push_frames(stm_src);
+        }
+
+        return 0;
+}
+
+/**
+ * Gets a bufferpool slot for the next packet, applying the overflow policy
+ * of the session if the bufferpool is full. If no slot can be had the
+ * datagram is consumed and discarded.
+ *
+ * @param rtp_sess The RTP session for which to receive the packet
+ *
+ * @return the slot index, -1 if the datagram was discarded, -2 if there
+ * was none.
+ */
+static int rtp_recv_slot(rtp_session * rtp_sess)
+{
+        int slot;
+
+        if ((slot = bpget(rtp_sess->bp)) < 0
+                        && (slot = rtp_overflow(rtp_sess)) < 0) {
+                char discard;
+
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_FULL);
+                nms_printf(NMSML_VERB,
+                           "No more space in Playout Buffer!" BLANK_LINE);
+                /* consume the datagram, or select would return at once */
+                if (recv(rtp_sess->transport.RTP.sock.fd, &discard, 1, 0) < 0
+                                && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return -2;
+        }
+
+        return slot;
+}
+
+/**
+ * Reports a failed receive from the RTP socket.
+ *
+ * @param call The name of the failed call
+ * @param err The errno it set
+ */
+static void rtp_recv_error(const char *call, int err)
+{
+        switch (err) {
+        case EBADF:
+                nms_printf(NMSML_ERR,
+                           "RTP %s: invalid descriptor\n", call);
+                break;
+#ifndef WIN32
+        case ENOTSOCK:
+                nms_printf(NMSML_ERR, "RTP %s: not a socket\n", call);
+                break;
+#endif
+        case EINTR:
+                nms_printf(NMSML_ERR,
+                           "RTP %s: The receive was interrupted by delivery"
+                           " of a signal\n", call);
+                break;
+        case EFAULT:
+                nms_printf(NMSML_ERR,
+                           "RTP %s: The buffer points outside userspace\n",
+                           call);
+                break;
+        case EINVAL:
+                nms_printf(NMSML_ERR,
+                           "RTP %s: Invalid argument passed.\n", call);
+                break;
+        default:
+                nms_printf(NMSML_ERR, "in RTP %s\n", call);
+                break;
+        }
+}
+
+#ifdef HAVE_RECVMMSG
+/**
+ * Reads up to recv_batch packets from the RTP socket with a single
+ * recvmmsg, straight into bufferpool slots taken at once, and handles
+ * them with a single reception time, or with their own kernel reception
+ * times if the session takes them.
+ *
+ * @param rtp_sess The RTP session for which to receive the packets
+ *
+ * @return 0 if the packets were correctly received, 1 otherwise.
+ */
+static int rtp_recv_batch(rtp_session * rtp_sess)
+{
+        int slots[RTP_RECV_BATCH_MAX];
+        struct mmsghdr msgs[RTP_RECV_BATCH_MAX];
+        struct iovec iovs[RTP_RECV_BATCH_MAX];
+        struct sockaddr_storage addrs[RTP_RECV_BATCH_MAX];
+#ifdef SO_TIMESTAMPNS
+        rtp_recv_cmsg ctrls[RTP_RECV_BATCH_MAX];
+#endif
+        nms_sockaddr server;
+        struct timeval now, stamp;
+        int i, n, received, err = 0;
+
+        n = min(rtp_sess->recv_batch, RTP_RECV_BATCH_MAX);
+        if (!(n = bpgetn(rtp_sess->bp, slots, n))) {
+                if ((slots[0] = rtp_recv_slot(rtp_sess)) < 0)
+                        return slots[0] == -2 ? RTP_RECV_AGAIN : 0;
+                n = 1;
+        }
+
+        memset(msgs, 0, n * sizeof(struct mmsghdr));
+        for (i = 0; i < n; i++) {
+                iovs[i].iov_base = BP_SLOT(rtp_sess->bp, slots[i]);
+                iovs[i].iov_len = BP_SLOT_LEN(rtp_sess->bp, slots[i]);
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_TIMESTAMPNS
+                if (rtp_sess->rx_timestamps) {
+                        msgs[i].msg_hdr.msg_control = &ctrls[i];
+                        msgs[i].msg_hdr.msg_controllen = sizeof(ctrls[i]);
+                }
+#endif
+        }
+
+        /* MSG_TRUNC makes msg_len the real datagram size, select told
+         * there is at least one: take just what is queued */
+        if ((received = recvmmsg(rtp_sess->transport.RTP.sock.fd, msgs, n,
+                                 RTP_RECV_FLAGS | MSG_DONTWAIT, NULL)) == -1) {
+                err = errno;
+                bpfreen(rtp_sess->bp, slots, n);
+                if (err == EAGAIN || err == EWOULDBLOCK)
+                        return RTP_RECV_AGAIN;
+                rtp_recv_error("recvmmsg", err);
+                return 1;
+        }
+        bpfreen(rtp_sess->bp, slots + received, n - received);
+
+        gettimeofday(&now, NULL);
+
+        for (i = 0; i < received; i++) {
+                server.addr = (struct sockaddr *) &addrs[i];
+                server.addr_len = msgs[i].msg_hdr.msg_namelen;
+#ifdef SO_TIMESTAMPNS
+                if (rtp_sess->rx_timestamps
+                                && !rtp_recv_stamp(&msgs[i].msg_hdr, &stamp)) {
+                        err |= rtp_recv_pkt(rtp_sess, slots[i], msgs[i].msg_len,
+                                            &server, &stamp);
+                        continue;
+                }
+#endif
+                err |= rtp_recv_pkt(rtp_sess, slots[i], msgs[i].msg_len,
+                                    &server, &now);
+        }
+
+        return err;
+}
+#endif
+
+#ifdef UDP_GRO
+/**
+ * Gets the segment size of a datagram coalesced by the kernel.
+ *
+ * @param msg The message the datagram was received with
+ *
+ * @return the segment size, 0 if the datagram was not coalesced
+ */
+static int rtp_gro_size(struct msghdr *msg)
+{
+        struct cmsghdr *cmsg;
+        int size;
+
+        for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                        memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                        return size;
+                }
+
         return 0;
 }
+
+/**
+ * Reads a datagram the kernel may have coalesced from many RTP packets of
+ * the same sender, scattered on consecutive bufferpool slots cut at the
+ * last segment size seen: every packet lands at the start of a slot of its
+ * own and is handed to rtp_recv_pkt as if read alone. The gro_stage of the
+ * session takes what does not fit in the slots: the packets left without
+ * a slot are copied from there by rtp_recv_copy. When the segment size
+ * changed the packets are realigned through the stage.
+ *
+ * @param rtp_sess The RTP session for which to receive the packets
+ *
+ * @return 0 if the packets were correctly received, RTP_RECV_AGAIN if the
+ * socket is non blocking and had no datagram, 1 otherwise.
+ */
+static int rtp_recv_gro(rtp_session * rtp_sess)
+{
+        buffer_pool *bp = rtp_sess->bp;
+        char *stage = rtp_sess->gro_stage;
+        int slots[RTP_GRO_SEGS];
+        struct iovec iovs[RTP_GRO_SEGS + 1];
+        struct sockaddr_storage serveraddr;
+        nms_sockaddr server;
+        struct msghdr msg;
+        rtp_gro_cmsg ctrl;
+        struct timeval now;
+        int i, n, nslots, nsegs, seg, len, room, got, aligned;
+        int stamped = 0, err = 0;
+
+        if (!(nslots = bpgetn(bp, slots, RTP_GRO_SEGS))) {
+                if ((slots[0] = rtp_recv_slot(rtp_sess)) < 0)
+                        return slots[0] == -2 ? RTP_RECV_AGAIN : 0;
+                nslots = 1;
+        }
+
+        for (i = room = 0; i < nslots; i++) {
+                iovs[i].iov_base = BP_SLOT(bp, slots[i]);
+                iovs[i].iov_len = BP_SLOT_LEN(bp, slots[i]);
+                if (rtp_sess->gro_size && rtp_sess->gro_size < iovs[i].iov_len)
+                        iovs[i].iov_len = rtp_sess->gro_size;
+                room += iovs[i].iov_len;
+        }
+        /* what does not fit in the slots goes to the stage */
+        if (room < RTP_GRO_STAGE) {
+                iovs[nslots].iov_base = stage;
+                iovs[nslots].iov_len = RTP_GRO_STAGE - room;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &serveraddr;
+        msg.msg_namelen = sizeof(serveraddr);
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = room < RTP_GRO_STAGE ? nslots + 1 : nslots;
+        msg.msg_control = &ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        /* MSG_TRUNC makes recvmsg return the size of the whole datagram */
+        if ((n = recvmsg(rtp_sess->transport.RTP.sock.fd, &msg,
+                         RTP_RECV_FLAGS)) == -1) {
+                err = errno;
+                bpfreen(bp, slots, nslots);
+                if (err == EAGAIN || err == EWOULDBLOCK)
+                        return RTP_RECV_AGAIN;
+                rtp_recv_error("recvmsg", err);
+                return 1;
+        }
+        server.addr = (struct sockaddr *) &serveraddr;
+        server.addr_len = msg.msg_namelen;
+
+#ifdef SO_TIMESTAMPNS
+        if (rtp_sess->rx_timestamps)
+                stamped = !rtp_recv_stamp(&msg, &now);
+#endif
+        if (!stamped)
+                gettimeofday(&now, NULL);
+
+        if ((seg = rtp_gro_size(&msg)) > 0 && seg < n)
+                rtp_sess->gro_size = seg;
+        else
+                seg = n;
+        nsegs = seg ? (n + seg - 1) / seg : 1;
+        got = min(n, max(room, RTP_GRO_STAGE));
+
+        /* the packets are in place if every slot before the last one
+         * was cut at their size, the ones past the slots are in the
+         * stage */
+        for (i = 0; i < nslots && i < nsegs - 1 && iovs[i].iov_len == seg; i++);
+        aligned = i == nslots
+                || (i == nsegs - 1 && n - i * seg <= iovs[i].iov_len);
+
+        if (!aligned) {
+                /* gather the datagram in the stage, in front of its tail */
+                if (got > room)
+                        memmove(stage + room, stage, got - room);
+                for (i = len = 0; i < nslots && len < got; len += iovs[i++].iov_len)
+                        memcpy(stage + len, iovs[i].iov_base,
+                               min(iovs[i].iov_len, got - len));
+                for (i = 0; i < nslots && i < nsegs && i * seg < got; i++)
+                        memcpy(BP_SLOT(bp, slots[i]), stage + i * seg,
+                               min(min(seg, got - i * seg), BP_SLOT_LEN(bp, slots[i])));
+        }
+
+        for (i = 0; i < nsegs; i++) {
+                len = min(seg, n - i * seg);
+                if (i * seg + len > got)
+                        break;
+                if (i < nslots)
+                        err |= rtp_recv_pkt(rtp_sess, slots[i], len, &server, &now);
+                else
+                        err |= rtp_recv_copy(rtp_sess,
+                                             stage + i * seg - (aligned ? room : 0),
+                                             len, &server, &now);
+        }
+        if (i < nslots)
+                bpfreen(bp, slots + i, nslots - i);
+        if (i < nsegs) {
+                nms_printf(NMSML_VERB, "%d coalesced RTP packets truncated\n",
+                           nsegs - i);
+                for (; i < nsegs; i++)
+                        BP_STAT_DROP(bp, BP_DROP_TRUNCATED);
+        }
+
+        return err;
+}
+#endif
+
+/**
+ * Reads a packet from the RTP socket, or a batch of them if the session
+ * has a recv_batch bigger than one, and hands them to rtp_recv_pkt.
+ *
+ * @param rtp_sess The RTP session for which to receive the packet
+ *
+ * @return 0 if the packet was correctly received, RTP_RECV_AGAIN if the
+ * socket is non blocking and had no packet, 1 otherwise.
+ */
+int rtp_recv(rtp_session * rtp_sess)
+{
+        int n;
+        int slot;
+        int stamped = 0;
+        struct timeval now;
+
+        struct sockaddr_storage serveraddr;
+        nms_sockaddr server = { (struct sockaddr *) &serveraddr, sizeof(serveraddr) };
+
+#ifdef UDP_GRO
+        if (rtp_sess->udp_gro)
+                return rtp_recv_gro(rtp_sess);
+#endif
+#ifdef HAVE_RECVMMSG
+        if (rtp_sess->recv_batch > 1)
+                return rtp_recv_batch(rtp_sess);
+#endif
+
+        if ((slot = rtp_recv_slot(rtp_sess)) < 0)
+                return slot == -2 ? RTP_RECV_AGAIN : 0;
+
+        /* MSG_TRUNC makes recvfrom and recvmsg return the real datagram size */
+#ifdef SO_TIMESTAMPNS
+        if (rtp_sess->rx_timestamps) {
+                struct msghdr msg;
+                struct iovec iov;
+                rtp_recv_cmsg ctrl;
+
+                memset(&msg, 0, sizeof(msg));
+                iov.iov_base = BP_SLOT(rtp_sess->bp, slot);
+                iov.iov_len = BP_SLOT_LEN(rtp_sess->bp, slot);
+                msg.msg_name = server.addr;
+                msg.msg_namelen = server.addr_len;
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = &ctrl;
+                msg.msg_controllen = sizeof(ctrl);
+
+                if ((n = recvmsg(rtp_sess->transport.RTP.sock.fd, &msg,
+                                 RTP_RECV_FLAGS)) != -1) {
+                        server.addr_len = msg.msg_namelen;
+                        stamped = !rtp_recv_stamp(&msg, &now);
+                }
+        } else
+#endif
+                n = recvfrom(rtp_sess->transport.RTP.sock.fd,
+                             BP_SLOT(rtp_sess->bp, slot),
+                             BP_SLOT_LEN(rtp_sess->bp, slot), RTP_RECV_FLAGS,
+                             server.addr, &server.addr_len);
+
+        if (n == -1) {
+                int err = errno;
+
+                bpfree(rtp_sess->bp, slot);
+                if (err == EAGAIN || err == EWOULDBLOCK)
+                        return RTP_RECV_AGAIN;
+                rtp_recv_error("recv", err);
+                return 1;
+        }
+
+        if (!stamped)
+                gettimeofday(&now, NULL);
+
+        return rtp_recv_pkt(rtp_sess, slot, n, &server, &now);
+}
+
+/**
+ * Handles a packet read by the caller, from a socket shared by many
+ * sessions, like rtp_recv does: the packet is copied in a bufferpool slot
+ * of the session it was sent to.
+ *
+ * @param rtp_sess The RTP session the packet was sent to
+ * @param data The packet
+ * @param n The size of the datagram, bigger than the data read if truncated
+ * @param server The address of the sender
+ * @param now The reception time
+ *
+ * @return 0 if the packet was correctly received, 1 otherwise.
+ */
+int rtp_recv_copy(rtp_session * rtp_sess, void *data, int n,
+                  nms_sockaddr * server, struct timeval *now)
+{
+        int slot;
+
+        if ((slot = bpget(rtp_sess->bp)) < 0
+                        && (slot = rtp_overflow(rtp_sess)) < 0) {
+                BP_STAT_DROP(rtp_sess->bp, BP_DROP_FULL);
+                nms_printf(NMSML_VERB,
+                           "No more space in Playout Buffer!" BLANK_LINE);
+                return 0;
+        }
+
+        memcpy(BP_SLOT(rtp_sess->bp, slot), data,
+               min(n, BP_SLOT_LEN(rtp_sess->bp, slot)));
+
+        return rtp_recv_pkt(rtp_sess, slot, n, server, now);
+}
+
+/**
+ * Makes the kernel coalesce the datagrams of a session, see rtp_recv_gro.
+ * The io_uring sessions lend single slots to the kernel: they read the
+ * datagrams one by one.
+ *
+ * @param rtp_sess The RTP session which asked for it
+ */
+static void rtp_recv_gro_init(rtp_session * rtp_sess)
+{
+#ifdef UDP_GRO
+        int on = 1;
+
+        if (!rtp_sess->io_uring
+                        && (rtp_sess->gro_stage
+                            || (rtp_sess->gro_stage = malloc(RTP_GRO_STAGE)))
+                        && !setsockopt(rtp_sess->transport.RTP.sock.fd, SOL_UDP,
+                                       UDP_GRO, &on, sizeof(on)))
+                return;
+#endif
+        nms_printf(NMSML_WARN,
+                   "Coalesced receive not available, reading single datagrams\n");
+        rtp_sess->udp_gro = 0;
+}
+
+/**
+ * Makes the kernel take the reception time of the packets of the sessions
+ * which asked for it, see rtp_recv_stamp, and coalesce their datagrams if
+ * they asked for it. Sessions whose socket does not support it go back to
+ * gettimeofday and to single datagrams.
+ *
+ * @param rtp_sess_head The sessions
+ */
+void rtp_recv_init(rtp_session * rtp_sess_head)
+{
+        rtp_session *rtp_sess;
+        int on = 1;
+
+        for (rtp_sess = rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next) {
+                if (rtp_sess->muxed)
+                        continue;
+                if (rtp_sess->udp_gro)
+                        rtp_recv_gro_init(rtp_sess);
+                if (!rtp_sess->rx_timestamps)
+                        continue;
+#ifdef SO_TIMESTAMPNS
+                if (!setsockopt(rtp_sess->transport.RTP.sock.fd, SOL_SOCKET,
+                                SO_TIMESTAMPNS, &on, sizeof(on)))
+                        continue;
+#endif
+                nms_printf(NMSML_WARN,
+                           "Kernel reception times not available, using gettimeofday\n");
+                rtp_sess->rx_timestamps = 0;
+        }
+}
+
+#ifdef SO_TIMESTAMPNS
+/**
+ * Gets the kernel reception time of a datagram.
+ *
+ * @param msg The message the datagram was received with, with room for
+ * an rtp_recv_cmsg
+ * @param tv Where to store the time
+ *
+ * @return 0 if the message carried the time, 1 otherwise
+ */
+int rtp_recv_stamp(struct msghdr *msg, struct timeval *tv)
+{
+        struct cmsghdr *cmsg;
+        struct timespec ts;
+
+        for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+                if (cmsg->cmsg_level == SOL_SOCKET
+                                && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                        tv->tv_sec = ts.tv_sec;
+                        tv->tv_usec = ts.tv_nsec / 1000;
+                        return 0;
+                }
+
+        return 1;
+}
+#endif
@@ -113,7 +113,8 @@ rtp_session *rtp_session_init(nms_sockaddr * local, nms_sockaddr * peer)
 
         // RP Payload types definitions:
         rtpptdefs_new(rtp_sess->ptdefs);
-        rtp_parsers_new(rtp_sess->parsers, rtp_sess->parsers_inits);
+        rtp_parsers_new(rtp_sess->parsers, rtp_sess->parsers_inits,
+                        rtp_sess->parsers_uninits, rtp_sess->parsers_frees);
 
         return rtp_sess;
 }
@@ -137,3 +138,44 @@ rtp_ssrc * rtp_session_get_ssrc(rtp_session *sess, struct rtsp_ctrl_t *ctl)
 
         return NULL;
 }
+
+/**
+ * Makes the RTP thread push the frames of a session to a callback as soon
+ * as they are complete, instead of letting the application pull them with
+ * rtp_fill_buffer. See rtp_frame_cb for what the callback may do.
+ * The frames pushed do not wait for the playout delay.
+ *
+ * @param sess The session, best set up before it starts playing
+ * @param cb The callback, NULL to go back to rtp_fill_buffer
+ * @param arg The last argument of the callback
+ *
+ * @return 0
+ */
+int rtp_set_frame_cb(rtp_session * sess, rtp_frame_cb cb, void *arg)
+{
+        sess->frame_cb_arg = arg;
+        /* the RTP thread must never see cb with the old argument */
+        nms_barrier();
+        sess->frame_cb = cb;
+
+        return 0;
+}
+
+/**
+ * Makes the parsers of a session hand out whole access units: all the
+ * NAL units sharing a timestamp, up to the marker bit, in one frame,
+ * with rtp_frame.nals telling where each one starts. Otherwise every NAL
+ * unit is a frame of its own. Only H.264 supports it for now, the other
+ * payloads are not affected.
+ *
+ * @param sess The session, best set up before it starts playing
+ * @param on 1 for access units, 0 for single NAL units
+ *
+ * @return 0
+ */
+int rtp_set_access_units(rtp_session * sess, int on)
+{
+        sess->access_units = on;
+
+        return 0;
+}
@@ -28,6 +28,120 @@
 #include "bufferpool.h"
 #include "utils.h"
 
+#define RTP_SSRC_TABLE_BITS 4   //!< 16 slots to start with
+
+/**
+ * Open addressing index of the known sources of a session, keyed by SSRC.
+ * Sources are never removed before the session dies, so the readers walk
+ * it without locks: a table that fills up is replaced by one twice as
+ * big and kept around, for the readers still walking it, until
+ * rtp_ssrc_table_free.
+ */
+struct rtp_ssrc_table {
+        unsigned bits;                  //!< the table has 2^bits slots
+        unsigned count;                 //!< sources in the table
+        struct rtp_ssrc_table *old;     //!< the table this one replaced
+        rtp_ssrc *volatile slots[1];
+};
+
+static unsigned rtp_ssrc_hash(uint32_t ssrc, unsigned bits)
+{
+        return (uint32_t) (ssrc * 2654435761U) >> (32 - bits);
+}
+
+/**
+ * Looks up a known source. Does not lock: the sources are only added,
+ * and added only once they are ready.
+ *
+ * @param rtp_sess The session of the source
+ * @param ssrc The SSRC of the source
+ *
+ * @return the source, NULL if it isnt known
+ */
+rtp_ssrc *rtp_ssrc_find(rtp_session * rtp_sess, uint32_t ssrc)
+{
+        struct rtp_ssrc_table *t;
+        rtp_ssrc *stm_src;
+        unsigned i, mask;
+
+        if ((stm_src = rtp_sess->ssrc_last) && stm_src->ssrc == ssrc)
+                return stm_src;
+
+        if (!(t = rtp_sess->ssrc_table))
+                return NULL;
+
+        mask = (1U << t->bits) - 1;
+        for (i = rtp_ssrc_hash(ssrc, t->bits); (stm_src = t->slots[i]);
+                        i = (i + 1) & mask)
+                if (stm_src->ssrc == ssrc) {
+                        rtp_sess->ssrc_last = stm_src;
+                        return stm_src;
+                }
+
+        return NULL;
+}
+
+static void rtp_ssrc_table_put(struct rtp_ssrc_table *t, rtp_ssrc * stm_src)
+{
+        unsigned i, mask = (1U << t->bits) - 1;
+
+        for (i = rtp_ssrc_hash(stm_src->ssrc, t->bits); t->slots[i];
+                        i = (i + 1) & mask);
+
+        /* the source must be complete before the readers can find it */
+        nms_barrier();
+        t->slots[i] = stm_src;
+        t->count++;
+}
+
+/**
+ * Adds a source to the index of the session, growing it to keep it at
+ * most half full. Called with the session syn mutex held.
+ *
+ * @return 0 on success, 1 if the index could not grow
+ */
+static int rtp_ssrc_table_add(rtp_session * rtp_sess, rtp_ssrc * stm_src)
+{
+        struct rtp_ssrc_table *t = rtp_sess->ssrc_table, *grown;
+        unsigned i, bits;
+
+        if (!t || 2 * (t->count + 1) > (1U << t->bits)) {
+                bits = t ? t->bits + 1 : RTP_SSRC_TABLE_BITS;
+                if (!(grown = calloc(1, sizeof(struct rtp_ssrc_table) +
+                                     ((1U << bits) - 1) * sizeof(rtp_ssrc *))))
+                        return 1;
+                grown->bits = bits;
+                grown->old = t;
+                for (i = 0; t && i < (1U << t->bits); i++)
+                        if (t->slots[i])
+                                rtp_ssrc_table_put(grown, t->slots[i]);
+                nms_barrier();
+                rtp_sess->ssrc_table = t = grown;
+        }
+
+        rtp_ssrc_table_put(t, stm_src);
+
+        return 0;
+}
+
+/**
+ * Frees the index of the known sources of a session, with the tables it
+ * replaced. The sources themselves belong to the ssrc_queue.
+ *
+ * @param rtp_sess The session dying
+ */
+void rtp_ssrc_table_free(rtp_session * rtp_sess)
+{
+        struct rtp_ssrc_table *t, *old;
+
+        for (t = rtp_sess->ssrc_table; t; t = old) {
+                old = t->old;
+                free(t);
+        }
+        rtp_sess->ssrc_table = NULL;
+        rtp_sess->ssrc_last = NULL;
+}
+
 /**
  * Gets the queue of active sources
  * @param rtp_sess_head The head of the rtp session queue. Can be retrieved from
@@ -199,6 +313,27 @@ int rtp_ssrc_init(rtp_session * rtp_sess, rtp_ssrc ** stm_src, uint32_t ssrc,
         return 0;
 }
 
+/**
+ * Creates a new source, with its playout buffer, and makes it known.
+ * Called with the session syn mutex held.
+ *
+ * @return 0 on success, -1 on errors
+ */
+static int rtp_ssrc_add(rtp_session * rtp_sess, rtp_ssrc ** stm_src,
+                        uint32_t ssrc, nms_sockaddr * recfrom,
+                        enum rtp_protos proto_type)
+{
+        if (rtp_ssrc_init(rtp_sess, stm_src, ssrc, recfrom, proto_type) < 0)
+                return -nms_printf(NMSML_ERR,
+                                   "Error while setting new Stream Source\n");
+
+        if (poinit((*stm_src)->po, rtp_sess->bp, rtp_sess->reorder_window)
+                        || rtp_ssrc_table_add(rtp_sess, *stm_src))
+                return -nms_printf(NMSML_FATAL, "Cannot allocate memory\n");
+
+        return 0;
+}
+
 /**
  * Checks the ssrc of incoming packets and creates a new synchronization source
  * if it wasn't already known.
@@ -217,152 +352,142 @@ int rtp_ssrc_check(rtp_session * rtp_sess, uint32_t ssrc, rtp_ssrc ** stm_src,
         struct sockaddr_storage sockaddr;
         nms_sockaddr sock = { (struct sockaddr *) &sockaddr, sizeof(sockaddr) };
         int local_collision;
-
+        int ret;
 
         local_collision = (rtp_sess->local_ssrc == ssrc) ? SSRC_COLLISION : 0;
-        pthread_mutex_lock(&rtp_sess->syn);
-        pthread_mutex_unlock(&rtp_sess->syn);
-        for (*stm_src = rtp_sess->ssrc_queue;
-                        !local_collision && *stm_src && ((*stm_src)->ssrc != ssrc);
-                        *stm_src = (*stm_src)->next);
+        *stm_src = local_collision ? NULL : rtp_ssrc_find(rtp_sess, ssrc);
         if (!*stm_src && !local_collision) {
-                /* new SSRC */
                 pthread_mutex_lock(&rtp_sess->syn);
-                nms_printf(NMSML_DBG3, "new SSRC\n");
-                if (rtp_ssrc_init(rtp_sess, stm_src, ssrc, recfrom, proto_type)
-                                < 0) {
+                /* the RTP and RTCP threads may race to add the same source */
+                if (!(*stm_src = rtp_ssrc_find(rtp_sess, ssrc))) {
+                        nms_printf(NMSML_DBG3, "new SSRC\n");
+                        ret = rtp_ssrc_add(rtp_sess, stm_src, ssrc, recfrom,
+                                           proto_type);
                         pthread_mutex_unlock(&rtp_sess->syn);
-                        return -nms_printf(NMSML_ERR,
-                                           "Error while setting new Stream Source\n");
+                        return ret < 0 ? ret : SSRC_NEW;
                 }
-
-                poinit((*stm_src)->po, rtp_sess->bp);
                 pthread_mutex_unlock(&rtp_sess->syn);
-                return SSRC_NEW;
-        } else {
-                if (local_collision) {
+        }
 
-                        if (proto_type == RTP)
-                                getsockname(rtp_sess->transport.RTP.sock.fd, sock.addr,
-                                            &sock.addr_len);
-                        else
-                                getsockname(rtp_sess->transport.RTCP.sock.fd, sock.addr,
-                                            &sock.addr_len);
+        if (local_collision) {
 
-                } else if (proto_type == RTP) {
+                if (proto_type == RTP)
+                        getsockname(rtp_sess->transport.RTP.sock.fd, sock.addr,
+                                    &sock.addr_len);
+                else
+                        getsockname(rtp_sess->transport.RTCP.sock.fd, sock.addr,
+                                    &sock.addr_len);
 
-                        if (!(*stm_src)->rtp_from.addr) {
-                                nms_sockaddr_dup(&(*stm_src)->rtp_from, recfrom);
-                                nms_printf(NMSML_DBG3, "new SSRC for RTP\n");
-                                local_collision = SSRC_RTPNEW;
-                        }
-                        sock.addr = (*stm_src)->rtp_from.addr;
-                        sock.addr_len = (*stm_src)->rtp_from.addr_len;
+        } else if (proto_type == RTP) {
 
-                } else {    /* if (proto_type == RTCP) */
+                if (!(*stm_src)->rtp_from.addr) {
+                        nms_sockaddr_dup(&(*stm_src)->rtp_from, recfrom);
+                        nms_printf(NMSML_DBG3, "new SSRC for RTP\n");
+                        local_collision = SSRC_RTPNEW;
+                }
+                sock.addr = (*stm_src)->rtp_from.addr;
+                sock.addr_len = (*stm_src)->rtp_from.addr_len;
 
+        } else {    /* if (proto_type == RTCP) */
 
-                        if (!(*stm_src)->rtcp_from.addr) {
-                                nms_sockaddr_dup(&(*stm_src)->rtcp_from, recfrom);
-                                nms_printf(NMSML_DBG3, "new SSRC for RTCP\n");
-                                local_collision = SSRC_RTCPNEW;
-                        }
-                        sock.addr = (*stm_src)->rtcp_from.addr;
-                        sock.addr_len = (*stm_src)->rtcp_from.addr_len;
 
-                        if (rtp_sess->transport.type != UDP)
-                                return local_collision;
+                if (!(*stm_src)->rtcp_from.addr) {
+                        nms_sockaddr_dup(&(*stm_src)->rtcp_from, recfrom);
+                        nms_printf(NMSML_DBG3, "new SSRC for RTCP\n");
+                        local_collision = SSRC_RTCPNEW;
+                }
+                sock.addr = (*stm_src)->rtcp_from.addr;
+                sock.addr_len = (*stm_src)->rtcp_from.addr_len;
 
-                        if (!(*stm_src)->rtcp_to.addr) {
-                                nms_addr nms_address;
+                if (rtp_sess->transport.type != UDP)
+                        return local_collision;
 
-                                if (sockaddr_get_nms_addr(recfrom->addr, &nms_address))
-                                        return -nms_printf(NMSML_ERR,
-                                                           "Invalid address for received packet\n");
+                if (!(*stm_src)->rtcp_to.addr) {
+                        nms_addr nms_address;
 
-                                // if ( rtcp_to_connect(*stm_src, recfrom, (rtp_sess->transport).RTCP.remote_port) < 0 )
-                                if (rtcp_to_connect
-                                                (*stm_src, &nms_address,
-                                                 (rtp_sess->transport).RTCP.sock.remote_port) < 0)
-                                        return -1;
-                        }
+                        if (sockaddr_get_nms_addr(recfrom->addr, &nms_address))
+                                return -nms_printf(NMSML_ERR,
+                                                   "Invalid address for received packet\n");
+
+                        // if ( rtcp_to_connect(*stm_src, recfrom, (rtp_sess->transport).RTCP.remote_port) < 0 )
+                        if (rtcp_to_connect
+                                        (*stm_src, &nms_address,
+                                         (rtp_sess->transport).RTCP.sock.remote_port) < 0)
+                                return -1;
+                }
+        }
+
+        if ((rtp_sess->transport.type == UDP) && sockaddr_cmp
+                        (sock.addr, sock.addr_len, recfrom->addr,
+                         recfrom->addr_len)) {
+                nms_printf(NMSML_ERR,
+                           "An identifier collision or a loop is indicated\n");
+
+                /* An identifier collision or a loop is indicated */
+
+                if (ssrc != rtp_sess->local_ssrc) {
+                        /* OPTIONAL error counter step not implemented */
+                        nms_printf(NMSML_VERB,
+                                   "Warning! An identifier collision or a loop is indicated.\n");
+                        return SSRC_COLLISION;
                 }
 
-                if ((rtp_sess->transport.type == UDP) && sockaddr_cmp
-                                (sock.addr, sock.addr_len, recfrom->addr,
-                                 recfrom->addr_len)) {
-                        nms_printf(NMSML_ERR,
-                                   "An identifier collision or a loop is indicated\n");
+                /* A collision or loop of partecipants's own packets */
 
-                        /* An identifier collision or a loop is indicated */
+                else {
+                        while (stm_conf
+                                        && sockaddr_cmp(stm_conf->transaddr.addr,
+                                                        stm_conf->transaddr.
+                                                        addr_len, recfrom->addr,
+                                                        recfrom->addr_len))
+                                stm_conf = stm_conf->next;
+
+                        if (stm_conf) {
 
-                        if (ssrc != rtp_sess->local_ssrc) {
                                 /* OPTIONAL error counter step not implemented */
-                                nms_printf(NMSML_VERB,
-                                           "Warning! An identifier collision or a loop is indicated.\n");
+
+                                stm_conf->time = time(NULL);
                                 return SSRC_COLLISION;
-                        }
+                        } else {
 
-                        /* A collision or loop of partecipants's own packets */
-
-                        else {
-                                while (stm_conf
-                                                && sockaddr_cmp(stm_conf->transaddr.addr,
-                                                                stm_conf->transaddr.
-                                                                addr_len, recfrom->addr,
-                                                                recfrom->addr_len))
-                                        stm_conf = stm_conf->next;
-
-                                if (stm_conf) {
-
-                                        /* OPTIONAL error counter step not implemented */
-
-                                        stm_conf->time = time(NULL);
-                                        return SSRC_COLLISION;
-                                } else {
-
-                                        /* New collision, change SSRC identifier */
-
-                                        nms_printf(NMSML_VERB,
-                                                   "SSRC collision detected: getting new!\n");
-
-
-                                        /* Send RTCP BYE pkt */
-                                        /*       TODO        */
-
-                                        /* choosing new ssrc */
-                                        rtp_sess->local_ssrc = random32(0);
-                                        rtp_sess->transport.ssrc =
-                                                rtp_sess->local_ssrc;
-
-                                        /* New entry in SSRC queue with conflicting ssrc */
-                                        if ((stm_conf = (struct rtp_conflict *)
-                                                        malloc(sizeof
-                                                               (struct rtp_conflict))) ==
-                                                        NULL)
-                                                return -nms_printf(NMSML_FATAL,
-                                                                   "Cannot allocate memory!\n");
-
-                                        /* insert at the beginning of Stream Sources queue */
-                                        pthread_mutex_lock(&rtp_sess->syn);
-                                        if (rtp_ssrc_init(rtp_sess, stm_src, ssrc, recfrom,
-                                                         proto_type) < 0) {
-                                                pthread_mutex_unlock(&rtp_sess->syn);
-                                                return -nms_printf(NMSML_ERR,
-                                                                   "Error while setting new Stream Source\n");
-                                        }
-                                        poinit((*stm_src)->po, rtp_sess->bp);
-                                        pthread_mutex_unlock(&rtp_sess->syn);
-
-                                        /* New entry in SSRC rtp_conflict queue */
-                                        nms_sockaddr_dup(&stm_conf->transaddr,
-                                                         &sock);
-                                        stm_conf->time = time(NULL);
-                                        stm_conf->next = rtp_sess->conf_queue;
-                                        rtp_sess->conf_queue = stm_conf;
-                                }
+                                /* New collision, change SSRC identifier */
 
+                                nms_printf(NMSML_VERB,
+                                           "SSRC collision detected: getting new!\n");
+
+
+                                /* Send RTCP BYE pkt */
+                                /*       TODO        */
+
+                                /* choosing new ssrc */
+                                rtp_sess->local_ssrc = random32(0);
+                                rtp_sess->transport.ssrc =
+                                        rtp_sess->local_ssrc;
+
+                                /* New entry in SSRC queue with conflicting ssrc */
+                                if ((stm_conf = (struct rtp_conflict *)
+                                                malloc(sizeof
+                                                       (struct rtp_conflict))) ==
+                                                NULL)
+                                        return -nms_printf(NMSML_FATAL,
+                                                           "Cannot allocate memory!\n");
+
+                                /* insert at the beginning of Stream Sources queue */
+                                pthread_mutex_lock(&rtp_sess->syn);
+                                ret = rtp_ssrc_add(rtp_sess, stm_src, ssrc,
+                                                   recfrom, proto_type);
+                                pthread_mutex_unlock(&rtp_sess->syn);
+                                if (ret < 0)
+                                        return ret;
+
+                                /* New entry in SSRC rtp_conflict queue */
+                                nms_sockaddr_dup(&stm_conf->transaddr,
+                                                 &sock);
+                                stm_conf->time = time(NULL);
+                                stm_conf->next = rtp_sess->conf_queue;
+                                rtp_sess->conf_queue = stm_conf;
                         }
+
                 }
         }
 
@@ -31,16 +31,26 @@
 #include "parsers/rtpparsers.h"
 #include "utils.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <fcntl.h>
+#endif
+
 #define PO_BUFF_SIZE_SEC 0
 #define PO_BUFF_SIZE_MSEC 700
 
+#define RTP_EPOLL_EVENTS 64     //!< events taken by a single epoll_wait
+#define RTP_EPOLL_BUDGET 32     //!< rtp_recv calls per ready session and round
+
 /**
  * Given an rtp_thread deallocates the binded payload parsers, the transport informations
  * and every session of the thread.
+ * It is the cleanup handler of the RTP thread, called directly when the
+ * sessions are detached from a worker.
  *
  * @param thrd The thread to clean
  */
-static void rtp_clean(void * thrd)
+void rtp_clean(void * thrd)
 {
         rtp_thread *rtp_th = (rtp_thread *) thrd;
         rtp_session *rtp_sess = rtp_th->rtp_sess_head;
@@ -51,12 +61,17 @@ static void rtp_clean(void * thrd)
         int i;
 
         nms_printf(NMSML_DBG1, "RTP Thread is dying suicide!\n");
+        rtp_uring_free(rtp_th);
+        if (rtp_th->rtp_epfd >= 0)
+                close(rtp_th->rtp_epfd);
 //      pthread_mutex_lock(&rtp_th->syn);
 //      pthread_mutex_trylock(&rtp_th->syn);
 
         while (rtp_sess != NULL) {
-                close(rtp_sess->transport.RTP.sock.fd);
-                close(rtp_sess->transport.RTCP.sock.fd);
+                if (!rtp_sess->muxed) {
+                        close(rtp_sess->transport.RTP.sock.fd);
+                        close(rtp_sess->transport.RTCP.sock.fd);
+                }
 
                 csrc = rtp_sess->ssrc_queue;
 
@@ -71,9 +86,15 @@ static void rtp_clean(void * thrd)
                         for (i = 0; i < 128; i++)
                                 if (rtp_sess->parsers_uninits[i])
                                         rtp_sess->parsers_uninits[i] (psrc, i);
+                        pokill(psrc->po);
                         free(psrc->po);
                         free(psrc);
                 }
+                for (i = 0; i < 128; i++)
+                        if (rtp_sess->parsers_frees[i])
+                                rtp_sess->parsers_frees[i] (rtp_sess, i);
+                rtp_ssrc_table_free(rtp_sess);
+                free(rtp_sess->gro_stage);
                 bpkill(rtp_sess->bp);
                 free(rtp_sess->bp);
 
@@ -109,10 +130,195 @@ static void rtp_clean(void * thrd)
         rtp_th->rtp_sess_head = NULL;
 
 //      pthread_mutex_unlock(&rtp_th->syn);
+        rtp_wait_destroy(&rtp_th->wait);
         free(rtp_th);
         nms_printf(NMSML_DBG1, "RTP Thread R.I.P.\n");
 }
 
+/**
+ * Tells if an audio payload type is a narrowband mono codec, whose
+ * packets fit BP_CLASS_AUDIO: G.711 and G.722 take 172 bytes every 20 msec.
+ * Linear PCM is twice as big even at 8 kHz.
+ *
+ * @param rtppt The payload type, of AU media type
+ */
+static int rtp_pt_narrowband(rtp_pt * rtppt)
+{
+        return rtppt->rate && rtppt->rate <= 8000
+            && RTP_AUDIO(rtppt)->channels <= 1
+            && strcasecmp(rtppt->name, "L16");
+}
+
+/**
+ * Guesses the size of the packets of an RTP session from the media type of
+ * the payloads announced in the SDP, so that its bufferpool starts with a
+ * fitting slot class. Bigger packets make the bufferpool raise it later.
+ *
+ * @param rtp_sess The RTP session
+ *
+ * @return the expected packet size in bytes
+ */
+static int rtp_pkt_size_hint(rtp_session * rtp_sess)
+{
+        rtp_fmts_list *fmt;
+        int narrowband = 1;
+
+        if (!rtp_sess->announced_fmts)
+                return BP_CLASS_MTU;
+
+        for (fmt = rtp_sess->announced_fmts; fmt; fmt = fmt->next) {
+                if (!fmt->rtppt || fmt->rtppt->type != AU)
+                        return BP_CLASS_MTU;
+                if (!rtp_pt_narrowband(fmt->rtppt))
+                        narrowband = 0;
+        }
+
+        return narrowband ? BP_CLASS_AUDIO : BP_CLASS_SMALL;
+}
+
+/**
+ * Initializes the bufferpool of every session, once they all know
+ * their payloads. The sessions receiving through io_uring get the
+ * headroom it needs in front of the slots.
+ *
+ * @param rtp_sess_head The sessions
+ *
+ * @return 0, 1 if a bufferpool could not be initialized
+ */
+int rtp_bp_init(rtp_session * rtp_sess_head)
+{
+        rtp_session *rtp_sess;
+
+        for (rtp_sess = rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next)
+                if (bpinit(rtp_sess->bp, rtp_pkt_size_hint(rtp_sess),
+                           rtp_sess->bp_mem_flags
+                           | (rtp_sess->io_uring ? BP_MEM_HEADROOM : 0)))
+                        return 1;
+
+        return 0;
+}
+
+/**
+ * Lets the application in, once the first packet arrived: it waits on
+ * syn while the RTP thread is buffering.
+ *
+ * @param thread The rtp_thread
+ */
+void rtp_buffering_end(rtp_thread * thread)
+{
+        if (thread->buffering) {
+                pthread_mutex_unlock(&thread->syn);
+                thread->buffering = 0;
+        }
+}
+
+/**
+ * Sleeps a little after rtp_recv failed, waiting for the decoder.
+ */
+static void rtp_recv_backoff(void)
+{
+        struct timespec ts;
+
+        /* Waiting 20 msec for decoder ready */
+        nms_printf(NMSML_NORM, "Waiting for decoder ready!\n");
+        ts.tv_sec = 0;
+        ts.tv_nsec = 20 * (1000);
+        nanosleep(&ts, NULL);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * Registers the RTP socket of every session of the thread not receiving
+ * through io_uring, switched to non blocking mode, in an edge triggered
+ * epoll set.
+ *
+ * @param thread The rtp_thread
+ *
+ * @return the epoll descriptor, -1 on error.
+ */
+static int rtp_epoll_create(rtp_thread * thread)
+{
+        rtp_session *rtp_sess;
+        struct epoll_event ev;
+        int epfd, fd;
+
+        if ((epfd = epoll_create(RTP_EPOLL_EVENTS)) < 0)
+                return -1;
+
+        thread->rtp_ready = NULL;
+        for (rtp_sess = thread->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next) {
+                if (rtp_sess->io_uring)
+                        continue;
+                fd = rtp_sess->transport.RTP.sock.fd;
+                ev.events = EPOLLIN | EPOLLET;
+                ev.data.ptr = rtp_sess;
+                if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0
+                                || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                        close(epfd);
+                        return -1;
+                }
+                rtp_sess->ready = 0;
+        }
+
+        return epfd;
+}
+
+/**
+ * A round of the RTP loop on epoll: only the sessions with packets queued
+ * are visited. Being edge triggered, a session stays in the ready list
+ * until rtp_recv drained its socket, in turns of RTP_EPOLL_BUDGET reads
+ * so that a busy stream does not starve the others.
+ *
+ * @param thread The rtp_thread, with the epoll set from rtp_epoll_create
+ * @param timeout The longest wait for a session to be ready, in msec,
+ * -1 to wait forever. There is no wait while sessions are left ready.
+ *
+ * @return 1 if sessions are left ready for the next round, 0 otherwise
+ */
+int rtp_epoll_round(rtp_thread * thread, int timeout)
+{
+        struct epoll_event events[RTP_EPOLL_EVENTS];
+        rtp_session *rtp_sess, **prev;
+        int i, n, ret;
+
+        if ((n = epoll_wait(thread->rtp_epfd, events, RTP_EPOLL_EVENTS,
+                            thread->rtp_ready ? 0 : timeout)) < 0) {
+                if (errno != EINTR)
+                        nms_printf(NMSML_ERR, "%s: epoll_wait error\n",
+                                   __FUNCTION__);
+                n = 0;
+        }
+
+        for (i = 0; i < n; i++) {
+                rtp_sess = events[i].data.ptr;
+                if (!rtp_sess->ready) {
+                        rtp_sess->ready = 1;
+                        rtp_sess->next_ready = thread->rtp_ready;
+                        thread->rtp_ready = rtp_sess;
+                }
+        }
+
+        if (thread->rtp_ready)
+                rtp_buffering_end(thread);
+
+        for (prev = &thread->rtp_ready; (rtp_sess = *prev);) {
+                for (i = 0; i < RTP_EPOLL_BUDGET
+                                && (ret = rtp_recv(rtp_sess)) != RTP_RECV_AGAIN;
+                                i++)
+                        if (ret)
+                                rtp_recv_backoff();
+                if (i < RTP_EPOLL_BUDGET) {
+                        rtp_sess->ready = 0;
+                        *prev = rtp_sess->next_ready;
+                } else {
+                        prev = &rtp_sess->next_ready;
+                }
+        }
+
+        return thread->rtp_ready != NULL;
+}
+#endif
+
 /**
  * The RTP thread main loop, continuously calls rtp_recv every time there is data available.
  *
@@ -122,22 +328,42 @@ static void *rtp(void *args)
 {
         rtp_thread *thread = args;
         rtp_session *rtp_sess_head = thread->rtp_sess_head;
-        pthread_mutex_t *syn = &thread->syn;
         rtp_session *rtp_sess;
-        struct timespec ts;
         int maxfd = 0;
 
         fd_set readset;
-        char buffering = 1;
+        int uring;
 
-        for (rtp_sess = rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next)
-                bpinit(rtp_sess->bp);
+        /* rtp_uring_create and rtp_bp_init ran in rtp_thread_create */
+        uring = thread->uring != NULL;
+        rtp_recv_init(rtp_sess_head);
 
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
         pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
         /*    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL); */
         pthread_cleanup_push(rtp_clean, args);
 
+#ifdef HAVE_SYS_EPOLL_H
+        /* the sessions left out of io_uring, polled by its loop */
+        thread->rtp_epfd = rtp_epoll_create(thread);
+#endif
+
+        if (uring && rtp_uring_loop(thread)) {
+                nms_printf(NMSML_WARN, "Cannot use io_uring for RTP, using epoll\n");
+#ifdef HAVE_SYS_EPOLL_H
+                if (thread->rtp_epfd >= 0)
+                        close(thread->rtp_epfd);
+                thread->rtp_epfd = rtp_epoll_create(thread);
+#endif
+        }
+
+#ifdef HAVE_SYS_EPOLL_H
+        if (thread->rtp_epfd >= 0)
+                while (1)
+                        rtp_epoll_round(thread, -1);
+        nms_printf(NMSML_WARN, "Cannot use epoll for RTP, using select\n");
+#endif
+
         /* Playout Buffer Size */
         /*
            dec_args->startime.tv_sec=0;
@@ -163,30 +389,11 @@ static void *rtp(void *args)
                 for (rtp_sess = rtp_sess_head; rtp_sess;
                                 rtp_sess = rtp_sess->next)
                         if (FD_ISSET(rtp_sess->transport.RTP.sock.fd, &readset)) {
-                                if (buffering) {
-#if 0 //lchen, 2010.11, needn't prebuffer
-                                        if (rtp_sess->bp->flcount >= thread->prebuffer_size) {
-                                                pthread_mutex_unlock(syn);
-                                                buffering = 0;
-                                                nms_printf(NMSML_NORM, "\rPrebuffer complete.\n");
-                                        } else {    // TODO: buffering based on rtp jitter
-                                                nms_printf(NMSML_NORM, "\rBuffering (%d%%)\t",
-                                                           (100 * rtp_sess->bp->flcount) /
-                                                           thread->prebuffer_size);
-                                        }
-#else
-                                        pthread_mutex_unlock(syn);
-                                        buffering = 0;
-#endif
-                                }
-                                if (rtp_recv(rtp_sess)) {
-                                        /* Waiting 20 msec for decoder ready */
-                                        nms_printf(NMSML_NORM,
-                                                   "Waiting for decoder ready!\n");
-                                        ts.tv_sec = 0;
-                                        ts.tv_nsec = 20 * (1000);
-                                        nanosleep(&ts, NULL);
-                                }
+                                /* buffering is done per source by the
+                                 * playout delay, see rtp_playout_due */
+                                rtp_buffering_end(thread);
+                                if (rtp_recv(rtp_sess) == 1)
+                                        rtp_recv_backoff();
                         }
         }
 
@@ -214,8 +421,29 @@ rtp_thread *rtp_init(void)
                 return NULL;
         }
 
+        if (rtp_wait_init(&rtp_th->wait)) {
+                pthread_mutex_destroy(&(rtp_th->syn));
+                free(rtp_th);
+                return NULL;
+        }
+
         // use a safe default
         rtp_th->prebuffer_size = BP_SLOT_NUM / 2;
+        rtp_th->reorder_window = PO_DEFAULT_WINDOW;
+        rtp_th->overflow_policy = RTP_OVF_DROP_NEWEST;
+        rtp_th->overflow_timeout = RTP_OVF_DEF_TIMEOUT;
+        rtp_th->bp_mem_flags = 0;
+        rtp_th->playout_delay_min = 0;
+        rtp_th->playout_delay_max = 0;
+        rtp_th->recv_batch = 1;
+        rtp_th->rx_timestamps = 0;
+        rtp_th->io_uring = 0;
+        rtp_th->udp_gro = 0;
+        rtp_th->uring = NULL;
+        rtp_th->rtp_epfd = -1;
+        rtp_th->rtp_ready = NULL;
+        rtp_th->buffering = 1;
+        rtp_th->worker = NULL;
 
         /* Decoder blocked 'till buffering is complete */
         pthread_mutex_lock(&(rtp_th->syn));
@@ -238,14 +466,31 @@ int rtp_thread_create(rtp_thread * rtp_th)
         rtp_session *rtp_sess;
         rtp_fmts_list *fmt;
 
-        pthread_attr_init(&rtp_attr);
-        if (pthread_attr_setdetachstate(&rtp_attr, PTHREAD_CREATE_JOINABLE) != 0)
-                return nms_printf(NMSML_FATAL,
-                                  "Cannot set RTP Thread attributes (detach state)\n");
+        if (rtp_workers_active()) {
+                /* the workers receive on epoll */
+                for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess;
+                                rtp_sess = rtp_sess->next)
+                        rtp_sess->io_uring = 0;
+                if (rtp_worker_attach(rtp_th))
+                        return nms_printf(NMSML_FATAL,
+                                          "Cannot attach the RTP sessions to a worker\n");
+        } else {
+                rtp_uring_create(rtp_th);
+                if (rtp_bp_init(rtp_th->rtp_sess_head)) {
+                        rtp_uring_free(rtp_th);
+                        return nms_printf(NMSML_FATAL,
+                                          "Cannot initialize the RTP bufferpools\n");
+                }
 
-        if ((err = pthread_create(&rtp_th->rtp_tid,
-                                  &rtp_attr, &rtp, (void *) rtp_th)) > 0)
-                return nms_printf(NMSML_FATAL, "%s\n", strerror(err));
+                pthread_attr_init(&rtp_attr);
+                if (pthread_attr_setdetachstate(&rtp_attr, PTHREAD_CREATE_JOINABLE) != 0)
+                        return nms_printf(NMSML_FATAL,
+                                          "Cannot set RTP Thread attributes (detach state)\n");
+
+                if ((err = pthread_create(&rtp_th->rtp_tid,
+                                          &rtp_attr, &rtp, (void *) rtp_th)) > 0)
+                        return nms_printf(NMSML_FATAL, "%s\n", strerror(err));
+        }
 
         for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess;
                         rtp_sess = rtp_sess->next) {
@@ -0,0 +1,430 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+/** @file rtp_uring.c
+ * This file contains the RTP thread loop on io_uring.
+ *
+ * Every session lends some free slots of its bufferpool to the kernel as a
+ * ring of provided buffers, the buffer id being the slot index, and keeps
+ * a multishot recvmsg armed on its RTP socket: the datagrams are written
+ * straight into the slots, with no system call per packet.
+ *
+ * The kernel puts the io_uring_recvmsg_out header, the sender address and
+ * the control messages before the payload: the slots are lent with the
+ * BP_HEADROOM bytes in front of them, sized so that the payload lands
+ * exactly where BP_SLOT points and rtp_recv_pkt takes the slot as usual.
+ *
+ * The RTCP sockets, the workers and the shared sockets stay on epoll, as
+ * the interleaved and shared RTP sessions of the thread: the loop keeps a
+ * poll armed on their epoll set and serves them with rtp_epoll_round.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "rtp.h"
+#include "bufferpool.h"
+#include "utils.h"
+
+#if defined(HAVE_LIBURING_H) && defined(HAVE_LIBURING)
+#define RTP_URING
+#endif
+
+#ifdef RTP_URING
+#include <poll.h>
+#include <liburing.h>
+
+#define RTP_URING_DEPTH 64      //!< submission queue entries
+#define RTP_URING_BUFS 64       //!< slots lent to the kernel by every session
+#define RTP_URING_IDLE 20       //!< msec between refills while a session has no slots
+
+#ifdef MSG_TRUNC
+#define RTP_URING_FLAGS MSG_TRUNC
+#else
+#define RTP_URING_FLAGS 0
+#endif
+
+struct rtp_uring_sess {
+        rtp_session *rtp_sess;
+        struct io_uring_buf_ring *br;
+        struct msghdr msg;      //!< sizes of the name and control areas
+        int lent[RTP_URING_BUFS];       //!< the lent slots, in ring order
+        unsigned added;         //!< slots given to the ring
+        unsigned used;          //!< slots filled by the kernel
+        int armed;              //!< a multishot recvmsg is pending
+};
+
+struct rtp_uring {
+        struct io_uring ring;
+        int received;           //!< a packet arrived, the kernel can do it
+        int unsupported;        //!< the kernel refused the multishot recvmsg
+        int epoll_armed;        //!< a poll on the epoll set of the thread is pending
+        int nsess;
+        struct rtp_uring_sess sess[1];
+};
+
+/**
+ * Gives back to the bufferpool the slots still lent to the kernel.
+ */
+static void rtp_uring_reclaim(struct rtp_uring_sess *s)
+{
+        for (; s->used != s->added; s->used++)
+                bpfree(s->rtp_sess->bp, s->lent[s->used % RTP_URING_BUFS]);
+}
+
+/**
+ * Lends free slots to the buffer ring of a session, up to RTP_URING_BUFS.
+ * When the ring is dry and the bufferpool full, the overflow policy of the
+ * session gets one.
+ */
+static void rtp_uring_refill(struct rtp_uring_sess *s)
+{
+        buffer_pool *bp = s->rtp_sess->bp;
+        int mask = io_uring_buf_ring_mask(RTP_URING_BUFS);
+        int slot, n = 0;
+
+        while (s->added - s->used < RTP_URING_BUFS) {
+                if ((slot = bpget(bp)) < 0
+                                && (s->added != s->used
+                                    || (slot = rtp_overflow(s->rtp_sess)) < 0))
+                        break;
+                io_uring_buf_ring_add(s->br, BP_SLOT(bp, slot) - BP_HEADROOM,
+                                      BP_SLOT_LEN(bp, slot) + BP_HEADROOM,
+                                      slot, mask, n++);
+                s->lent[s->added++ % RTP_URING_BUFS] = slot;
+        }
+        if (n)
+                io_uring_buf_ring_advance(s->br, n);
+}
+
+/**
+ * Arms the multishot recvmsg of a session, if it has slots lent.
+ *
+ * @return 0 on success, 1 if the submission queue is full
+ */
+static int rtp_uring_arm(struct rtp_uring *u, struct rtp_uring_sess *s)
+{
+        struct io_uring_sqe *sqe;
+
+        if (s->armed || s->added == s->used)
+                return 0;
+        if (!(sqe = io_uring_get_sqe(&u->ring)))
+                return 1;
+
+        io_uring_prep_recvmsg_multishot(sqe, s->rtp_sess->transport.RTP.sock.fd,
+                                        &s->msg, RTP_URING_FLAGS);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = s - u->sess;
+        io_uring_sqe_set_data(sqe, s);
+        s->armed = 1;
+
+        return 0;
+}
+
+/**
+ * Arms a poll on the epoll set of the sessions of the thread left out of
+ * io_uring. Its completion carries the rtp_uring itself.
+ *
+ * @return 0 on success, 1 if the submission queue is full
+ */
+static int rtp_uring_arm_epoll(struct rtp_uring *u, int epfd)
+{
+        struct io_uring_sqe *sqe;
+
+        if (u->epoll_armed)
+                return 0;
+        if (!(sqe = io_uring_get_sqe(&u->ring)))
+                return 1;
+
+        io_uring_prep_poll_add(sqe, epfd, POLLIN);
+        io_uring_sqe_set_data(sqe, u);
+        u->epoll_armed = 1;
+
+        return 0;
+}
+
+/**
+ * Hands the datagram of a completion to rtp_recv_pkt.
+ */
+static void rtp_uring_cqe(struct rtp_uring *u, struct io_uring_cqe *cqe,
+                          struct timeval *now)
+{
+        struct rtp_uring_sess *s = io_uring_cqe_get_data(cqe);
+        rtp_session *rtp_sess = s->rtp_sess;
+        struct io_uring_recvmsg_out *out;
+        nms_sockaddr server;
+        struct timeval stamp;
+        char *head;
+        int slot;
+
+        /* ended by an error or by a dry ring: armed again by the loop */
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+                s->armed = 0;
+
+        if (cqe->res < 0) {
+                if (cqe->res == -EINVAL && !u->received)
+                        u->unsupported = 1;
+                else if (cqe->res != -ENOBUFS)
+                        nms_printf(NMSML_ERR, "RTP io_uring receive error: %s\n",
+                                   strerror(-cqe->res));
+                return;
+        }
+        if (!(cqe->flags & IORING_CQE_F_BUFFER))
+                return;
+
+        /* the ring is consumed in order */
+        slot = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        s->used++;
+        u->received = 1;
+
+        head = BP_SLOT(rtp_sess->bp, slot) - BP_HEADROOM;
+        if (!(out = io_uring_recvmsg_validate(head, cqe->res, &s->msg))
+                        || io_uring_recvmsg_payload(out, &s->msg)
+                        != (void *) BP_SLOT(rtp_sess->bp, slot)) {
+                bpfree(rtp_sess->bp, slot);
+                return;
+        }
+
+        server.addr = io_uring_recvmsg_name(out);
+        server.addr_len = min(out->namelen, s->msg.msg_namelen);
+
+#ifdef SO_TIMESTAMPNS
+        if (rtp_sess->rx_timestamps) {
+                struct msghdr ctrl;
+
+                memset(&ctrl, 0, sizeof(ctrl));
+                ctrl.msg_control = (char *) server.addr + s->msg.msg_namelen;
+                ctrl.msg_controllen = out->controllen;
+                if (!rtp_recv_stamp(&ctrl, &stamp))
+                        now = &stamp;
+        }
+#endif
+
+        /* with MSG_TRUNC payloadlen is the datagram size, even if bigger */
+        rtp_recv_pkt(rtp_sess, slot, out->payloadlen, &server, now);
+}
+
+/**
+ * Sets up the io_uring of an RTP thread with a buffer ring for every
+ * session asking for it. It must run before the bufferpools are
+ * initialized, they need BP_MEM_HEADROOM. The interleaved and shared
+ * sessions are left without io_uring, and so are all the sessions if it
+ * cannot be used.
+ *
+ * @param rtp_th The rtp_thread
+ *
+ * @return 0 on success, 1 if the thread must loop on epoll
+ */
+int rtp_uring_create(rtp_thread * rtp_th)
+{
+        struct rtp_uring *u;
+        struct rtp_uring_sess *s;
+        rtp_session *rtp_sess;
+        int n = 0, ret;
+
+        for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next) {
+                if (rtp_sess->muxed || rtp_sess->transport.type != UDP)
+                        rtp_sess->io_uring = 0;
+                if (rtp_sess->io_uring)
+                        n++;
+        }
+        if (!n)
+                return 1;
+
+        if (!(u = calloc(1, sizeof(*u) + (n - 1) * sizeof(*s))))
+                goto unused;
+        if ((ret = io_uring_queue_init(RTP_URING_DEPTH, &u->ring, 0)) < 0) {
+                nms_printf(NMSML_VERB, "io_uring_queue_init: %s\n", strerror(-ret));
+                free(u);
+                goto unused;
+        }
+        rtp_th->uring = u;
+
+        for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next) {
+                if (!rtp_sess->io_uring)
+                        continue;
+                s = &u->sess[u->nsess];
+                s->rtp_sess = rtp_sess;
+                if (!(s->br = io_uring_setup_buf_ring(&u->ring, RTP_URING_BUFS,
+                                                      u->nsess, 0, &ret))) {
+                        nms_printf(NMSML_VERB, "io_uring_setup_buf_ring: %s\n",
+                                   strerror(-ret));
+                        rtp_uring_free(rtp_th);
+                        goto unused;
+                }
+                u->nsess++;
+
+                /* the header, the name and the control messages fill the
+                 * headroom, see rtp_uring.c */
+                s->msg.msg_namelen = sizeof(struct sockaddr_storage);
+                s->msg.msg_controllen = BP_HEADROOM - s->msg.msg_namelen
+                        - sizeof(struct io_uring_recvmsg_out);
+        }
+
+        return 0;
+
+unused:
+        for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next)
+                rtp_sess->io_uring = 0;
+        return 1;
+}
+
+/**
+ * Frees the io_uring and takes every session of the thread off it, once
+ * the slots lent were given back.
+ *
+ * @return 1, the thread must loop on epoll
+ */
+static int rtp_uring_unused(rtp_thread * rtp_th)
+{
+        rtp_session *rtp_sess;
+
+        rtp_uring_free(rtp_th);
+        for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next)
+                rtp_sess->io_uring = 0;
+
+        return 1;
+}
+
+/**
+ * The RTP thread main loop on io_uring. Each round lends the freed slots
+ * again, arms the sessions left without a recvmsg, then hands every
+ * completed packet to rtp_recv_pkt. The sessions left out of io_uring
+ * are served from the epoll set of the thread when it is ready.
+ *
+ * @param thread The rtp_thread for which to loop, after rtp_uring_create,
+ * rtp_bp_init and, if some sessions are left out, rtp_epoll_create
+ *
+ * @return 1 if the kernel cannot receive this way, or the sessions left
+ * out cannot be polled: the lent slots are given back and the io_uring
+ * freed, the thread must loop on epoll
+ */
+int rtp_uring_loop(rtp_thread * thread)
+{
+        struct rtp_uring *u = thread->uring;
+        struct io_uring_cqe *cqe;
+        struct __kernel_timespec idle, busy;
+        rtp_session *rtp_sess;
+        struct timeval now;
+        unsigned head, n;
+        int i, dry, ret, mixed = 0, epfd = -1, epoll_ready;
+
+        for (rtp_sess = thread->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next)
+                if (!rtp_sess->io_uring)
+                        mixed = 1;
+        if (mixed && (epfd = thread->rtp_epfd) < 0)
+                return rtp_uring_unused(thread);
+
+        idle.tv_sec = busy.tv_sec = 0;
+        idle.tv_nsec = RTP_URING_IDLE * 1000000L;
+        busy.tv_nsec = 0;
+
+        while (1) {
+                for (i = dry = 0; i < u->nsess; i++) {
+                        rtp_uring_refill(&u->sess[i]);
+                        rtp_uring_arm(u, &u->sess[i]);
+                        dry |= !u->sess[i].armed;
+                }
+                if (epfd >= 0)
+                        rtp_uring_arm_epoll(u, epfd);
+
+                /* nobody wakes us when the application frees slots, and
+                 * the epoll set is not ready again for the sessions it
+                 * left with datagrams */
+                if (dry || thread->rtp_ready) {
+                        io_uring_submit(&u->ring);
+                        ret = io_uring_wait_cqe_timeout(&u->ring, &cqe,
+                                                        thread->rtp_ready ? &busy : &idle);
+                } else
+                        ret = io_uring_submit_and_wait(&u->ring, 1);
+                if (ret < 0 && ret != -EINTR && ret != -ETIME)
+                        nms_printf(NMSML_ERR, "%s: io_uring wait error: %s\n",
+                                   __FUNCTION__, strerror(-ret));
+
+                gettimeofday(&now, NULL);
+                n = epoll_ready = 0;
+                io_uring_for_each_cqe(&u->ring, head, cqe) {
+                        if (io_uring_cqe_get_data(cqe) == u) {
+                                u->epoll_armed = 0;
+                                epoll_ready = 1;
+                        } else
+                                rtp_uring_cqe(u, cqe, &now);
+                        n++;
+                }
+                io_uring_cq_advance(&u->ring, n);
+
+                if (u->unsupported) {
+                        for (i = 0; i < u->nsess; i++)
+                                rtp_uring_reclaim(&u->sess[i]);
+                        return rtp_uring_unused(thread);
+                }
+
+                if (u->received)
+                        rtp_buffering_end(thread);
+
+                if (epoll_ready || thread->rtp_ready)
+                        rtp_epoll_round(thread, 0);
+        }
+}
+
+/**
+ * Frees the io_uring of an RTP thread, if any. The slots still lent are
+ * not given back: it runs before the bufferpools are killed.
+ */
+void rtp_uring_free(rtp_thread * rtp_th)
+{
+        struct rtp_uring *u = rtp_th->uring;
+        int i;
+
+        if (!u)
+                return;
+
+        for (i = 0; i < u->nsess; i++)
+                io_uring_free_buf_ring(&u->ring, u->sess[i].br,
+                                       RTP_URING_BUFS, i);
+        io_uring_queue_exit(&u->ring);
+        free(u);
+        rtp_th->uring = NULL;
+}
+
+#else
+
+int rtp_uring_create(rtp_thread * rtp_th)
+{
+        rtp_session *rtp_sess;
+
+        for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess; rtp_sess = rtp_sess->next)
+                rtp_sess->io_uring = 0;
+
+        return 1;
+}
+
+int rtp_uring_loop(rtp_thread * rtp_th)
+{
+        return 1;
+}
+
+void rtp_uring_free(rtp_thread * rtp_th)
+{
+}
+
+#endif
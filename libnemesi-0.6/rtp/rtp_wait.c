@@ -0,0 +1,331 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+/** @file rtp_wait.c
+ * This file contains the functions that let the application sleep until
+ * the RTP thread completes a frame, instead of polling the playout buffers.
+ */
+
+#include <errno.h>
+
+#include "rtp.h"
+#include "rtpptdefs.h"
+#include "bufferpool.h"
+#include "utils.h"
+
+/**
+ * Initializes the frame wait of an rtp_thread.
+ *
+ * @return 0 on success, 1 otherwise
+ */
+int rtp_wait_init(rtp_wait * w)
+{
+        if (pthread_mutex_init(&w->lock, NULL))
+                return 1;
+        if (pthread_cond_init(&w->cond, NULL)) {
+                pthread_mutex_destroy(&w->lock);
+                return 1;
+        }
+        w->seq = 0;
+        w->waiters = 0;
+        w->done = 0;
+        w->next = NULL;
+
+        return 0;
+}
+
+/**
+ * Frees the frame wait of an rtp_thread. Nobody must be waiting.
+ */
+void rtp_wait_destroy(rtp_wait * w)
+{
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+}
+
+static void rtp_wait_wake(rtp_wait * w)
+{
+        /* the waiters count themselves before looking at the queues */
+        nms_barrier();
+        if (!w->waiters)
+                return;
+
+        pthread_mutex_lock(&w->lock);
+        w->seq++;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Wakes for good the threads waiting for frames: the stream is over.
+ */
+void rtp_wait_end(rtp_wait * w)
+{
+        w->done = 1;
+        rtp_wait_wake(w);
+}
+
+/**
+ * Tracks the frame boundaries of a source as its packets are queued, and
+ * wakes the waiting threads when a frame is complete: at its marker bit,
+ * or when the next frame starts for the payloads which do not mark the
+ * last packet. Every audio packet is a frame of its own.
+ *
+ * @param stm_src The source of the packet
+ * @param pkt The packet just queued
+ *
+ * @return 1 if the packet completed a frame, 0 otherwise
+ */
+int rtp_wait_frame_end(rtp_ssrc * stm_src, rtp_pkt * pkt)
+{
+        rtp_pt *pt = stm_src->rtp_sess->ptdefs[pkt->pt];
+        int complete;
+
+        if (RTP_PKT_MARK(pkt) || (pt && pt->type == AU)) {
+                complete = 1;
+                stm_src->frame_ts = RTP_PKT_TS(pkt);
+                stm_src->frame_open = 0;
+        } else if (RTP_PKT_TS(pkt) != stm_src->frame_ts) {
+                complete = stm_src->frame_open;
+                /* a reader seeing the new timestamp first only wakes early */
+                stm_src->frame_ts = RTP_PKT_TS(pkt);
+                nms_barrier();
+                stm_src->frame_open = 1;
+        } else
+                complete = 0;
+
+        if (complete && stm_src->rtp_sess->wait && !stm_src->rtp_sess->frame_cb)
+                rtp_wait_wake(stm_src->rtp_sess->wait);
+
+        return complete;
+}
+
+/**
+ * Tells if the oldest packet of a source belongs to a complete frame.
+ *
+ * @param stm_src an active ssrc
+ *
+ * @return 1 if it does, 0 otherwise
+ */
+int rtp_frame_ready(rtp_ssrc * stm_src)
+{
+        rtp_pkt *pkt;
+
+        if (stm_src->done_seek || !(pkt = rtp_get_pkt(stm_src, NULL)))
+                return 0;
+
+        return !stm_src->frame_open || RTP_PKT_TS(pkt) != stm_src->frame_ts;
+}
+
+/**
+ * Tells if the stream of a source is over: no packet is left and no more
+ * will come, so the parsers must hand out what they hold back.
+ *
+ * @param stm_src an active ssrc
+ *
+ * @return 1 if it is, 0 otherwise
+ */
+int rtp_stream_over(rtp_ssrc * stm_src)
+{
+        rtp_wait *w = stm_src->rtp_sess->wait;
+
+        return w && w->done && !rtp_get_pkt(stm_src, NULL);
+}
+
+/**
+ * Tells if the oldest packet of a source belongs to a complete frame
+ * and is due for playout. The frames of a session with a frame callback
+ * are taken by the RTP thread alone, so they are never ready here: their
+ * queue must not be looked at from another thread.
+ *
+ * @return 0 if it is, the msec to wait for it to be due, -1 if there is
+ * no complete frame
+ */
+static int rtp_wait_ready(rtp_ssrc * stm_src)
+{
+        if (stm_src->rtp_sess->frame_cb || !rtp_frame_ready(stm_src))
+                return -1;
+
+        return rtp_playout_wait(stm_src, rtp_get_pkt(stm_src, NULL));
+}
+
+/**
+ * Sleeps on the frame wait until it is woken, until the deadline or for
+ * at most the given msec.
+ *
+ * @return 1 if the deadline expired, 0 otherwise
+ */
+static int rtp_wait_sleep(rtp_wait * w, unsigned seq,
+                          const struct timeval *deadline, int ms)
+{
+        struct timeval now, until;
+        struct timespec ts;
+        int ret = 0;
+
+        gettimeofday(&now, NULL);
+        if (ms >= 0) {
+                until.tv_sec = now.tv_sec + ms / 1000;
+                until.tv_usec = now.tv_usec + (ms % 1000) * 1000;
+                if (until.tv_usec >= 1000000) {
+                        until.tv_sec++;
+                        until.tv_usec -= 1000000;
+                }
+                if (deadline && timercmp(deadline, &until, <))
+                        until = *deadline;
+        } else if (deadline)
+                until = *deadline;
+
+        pthread_mutex_lock(&w->lock);
+        if (ms < 0 && !deadline)
+                while (w->seq == seq && !w->done)
+                        pthread_cond_wait(&w->cond, &w->lock);
+        else {
+                ts.tv_sec = until.tv_sec;
+                ts.tv_nsec = until.tv_usec * 1000;
+                while (w->seq == seq && !w->done && ret != ETIMEDOUT)
+                        ret = pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+        }
+        w->waiters--;
+        pthread_mutex_unlock(&w->lock);
+
+        if (!deadline)
+                return 0;
+        gettimeofday(&now, NULL);
+
+        return !timercmp(&now, deadline, <);
+}
+
+static void rtp_wait_deadline(struct timeval *deadline, int timeout)
+{
+        gettimeofday(deadline, NULL);
+        deadline->tv_sec += timeout / 1000;
+        deadline->tv_usec += (timeout % 1000) * 1000;
+        if (deadline->tv_usec >= 1000000) {
+                deadline->tv_sec++;
+                deadline->tv_usec -= 1000000;
+        }
+}
+
+/**
+ * Waits until a source has a complete frame due for playout, so that
+ * rtp_fill_buffer will not find its buffer empty.
+ *
+ * @param stm_src an active ssrc
+ * @param timeout The longest wait, in msec, negative to wait forever
+ *
+ * @return 0 if a frame is ready, 1 on timeout, -1 at the end of the stream
+ */
+int rtp_wait_frame(rtp_ssrc * stm_src, int timeout)
+{
+        rtp_wait *w = stm_src->rtp_sess->wait;
+        struct timeval deadline;
+        unsigned seq;
+        int ms;
+
+        if (!w) {
+                /* nobody wakes us: poll the buffer once more after the timeout */
+                if (rtp_wait_ready(stm_src) && timeout > 0)
+                        usleep(timeout * 1000);
+                return rtp_wait_ready(stm_src) != 0;
+        }
+
+        if (timeout >= 0)
+                rtp_wait_deadline(&deadline, timeout);
+
+        for (;;) {
+                pthread_mutex_lock(&w->lock);
+                w->waiters++;
+                seq = w->seq;
+                pthread_mutex_unlock(&w->lock);
+                nms_barrier();
+
+                if (!(ms = rtp_wait_ready(stm_src)) || w->done
+                                || (!timeout && ms)) {
+                        pthread_mutex_lock(&w->lock);
+                        w->waiters--;
+                        pthread_mutex_unlock(&w->lock);
+                        return ms ? (w->done ? -1 : 1) : 0;
+                }
+
+                if (rtp_wait_sleep(w, seq, timeout >= 0 ? &deadline : NULL, ms))
+                        return rtp_wait_ready(stm_src) ? 1 : 0;
+        }
+}
+
+/**
+ * Waits until any of the sources of an rtp_thread has a complete frame
+ * due for playout. The sources are looked at in turn, so that a busy one
+ * does not starve the others.
+ *
+ * @param rtp_th The rtp_thread of the sources
+ * @param timeout The longest wait, in msec, negative to wait forever
+ *
+ * @return the source to call rtp_fill_buffer on, NULL on timeout or at
+ * the end of the stream
+ */
+rtp_ssrc *rtp_wait_frames(rtp_thread * rtp_th, int timeout)
+{
+        rtp_wait *w = &rtp_th->wait;
+        rtp_ssrc *first, *stm_src;
+        struct timeval deadline;
+        unsigned seq;
+        int ms, wait;
+
+        if (timeout >= 0)
+                rtp_wait_deadline(&deadline, timeout);
+
+        for (;;) {
+                pthread_mutex_lock(&w->lock);
+                w->waiters++;
+                seq = w->seq;
+                pthread_mutex_unlock(&w->lock);
+                nms_barrier();
+
+                if (!(first = w->next))
+                        first = rtp_active_ssrc_queue(rtp_th->rtp_sess_head);
+
+                wait = -1;
+                stm_src = first;
+                while (stm_src) {
+                        if (!(ms = rtp_wait_ready(stm_src)))
+                                break;
+                        if (ms > 0 && (wait < 0 || ms < wait))
+                                wait = ms;
+                        if (!(stm_src = rtp_next_active_ssrc(stm_src)))
+                                stm_src = rtp_active_ssrc_queue(rtp_th->rtp_sess_head);
+                        if (stm_src == first)
+                                stm_src = NULL;
+                }
+
+                if (stm_src || w->done || !timeout) {
+                        pthread_mutex_lock(&w->lock);
+                        w->waiters--;
+                        if (stm_src)
+                                w->next = rtp_next_active_ssrc(stm_src);
+                        pthread_mutex_unlock(&w->lock);
+                        return stm_src;
+                }
+
+                if (rtp_wait_sleep(w, seq, timeout >= 0 ? &deadline : NULL, wait))
+                        timeout = 0;
+        }
+}
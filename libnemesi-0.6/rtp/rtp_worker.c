@@ -0,0 +1,748 @@
+/* *
+ * This file is part of libnemesi
+ *
+ * Copyright (C) 2007 by LScube team <team@streaming.polito.it>
+ * See AUTHORS for more details
+ *
+ * libnemesi is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libnemesi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libnemesi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * */
+
+/** @file rtp_worker.c
+ * This file contains the optional process-wide pool of RTP workers.
+ * Each worker serves the RTP and RTCP sockets and the RTCP events of the
+ * RTSP controllers attached to it, on an epoll set. A controller sticks
+ * to the least loaded worker at the time it is attached.
+ * With rtp_workers_mux the unicast sessions have no sockets of their own:
+ * every worker reads its shared sockets and hands the datagrams to any
+ * session, see rtp_mux.c.
+ *
+ * Without rtp_workers_init every controller keeps its own RTP and RTCP
+ * threads.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* recvmmsg */
+#endif
+
+#include "rtp.h"
+#include "rtcp.h"
+#include "bufferpool.h"
+#include "utils.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define RTP_WORKERS
+#endif
+
+#ifdef RTP_WORKERS
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+
+#define RTP_WORKERS_MAX 64
+#define RTP_WORKER_EVENTS 64    //!< events taken by a single epoll_wait
+#define RTP_WORKER_BUDGET 32    //!< rtp_recv and rtcp_recv calls per ready source and round
+#define RTP_MUX_BATCH 16        //!< datagrams read at once from a shared socket
+#define RTP_MUX_STAGE BP_MAX_SLOT_SIZE  //!< room for each of them
+
+#ifdef MSG_TRUNC
+#define RTP_MUX_FLAGS (MSG_TRUNC | MSG_DONTWAIT)
+#else
+#define RTP_MUX_FLAGS MSG_DONTWAIT
+#endif
+
+#ifdef HAVE_RECVMMSG
+typedef struct mmsghdr rtp_mux_msg;
+#else
+typedef struct {                        //!< what recvmmsg fills, for a loop of recvmsg
+        struct msghdr msg_hdr;
+        unsigned int msg_len;
+} rtp_mux_msg;
+#endif
+
+enum rtp_worker_src_type {
+        RTP_WSRC_RTP,
+        RTP_WSRC_RTCP,
+        RTP_WSRC_TIMER,
+        RTP_WSRC_MUX_RTP,               //!< shared sockets, see rtp_mux.c
+        RTP_WSRC_MUX_RTCP
+};
+
+/**
+ * A descriptor registered in the epoll set of a worker.
+ * Sources of a detached controller are marked dead and freed by the
+ * worker at the end of its round, since events already taken from epoll
+ * may still point to them.
+ */
+struct rtp_worker_src {
+        enum rtp_worker_src_type type;
+        int fd;
+        rtp_session *rtp_sess;
+        struct rtp_worker_ctl *ctl;
+        int dead;
+        int ready;                              //!< set while in the ready list
+        struct rtp_worker_src *next_ready;
+        struct rtp_worker_src *next;
+};
+
+struct rtp_worker {
+        pthread_t tid;
+        int epfd;
+        pthread_mutex_t lock;                   //!< held while a round is served
+        int load;                               //!< sessions attached
+        struct rtp_worker_src *ready;           //!< sources with datagrams left
+        struct rtp_worker_src *dead;            //!< sources to free
+        struct rtp_worker_src *mux;             //!< shared sockets
+        uint8_t *stage;                         //!< datagrams read from the shared sockets
+};
+
+/**
+ * An RTSP controller, that is an rtp_thread, attached to a worker.
+ */
+struct rtp_worker_ctl {
+        rtp_thread *rtp_th;
+        struct rtp_worker *worker;
+        struct rtcp_event *head;                //!< scheduled RTCP events
+        int tfd;                                //!< timer of the first event
+        int sessions;
+        volatile int buffering;                 //!< set until the first packet
+        struct rtp_worker_src *srcs;
+};
+
+static struct rtp_worker rtp_workers[RTP_WORKERS_MAX];
+static int rtp_workers_num;
+static pthread_mutex_t rtp_workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Lets the application in, on the first packet for a controller.
+ * Sessions on the shared sockets get it from any worker.
+ */
+static void rtp_worker_started(struct rtp_worker_ctl *ctl)
+{
+        if (ctl->buffering && nms_cas(&ctl->buffering, 1, 0))
+                pthread_mutex_unlock(&ctl->rtp_th->syn);
+}
+
+/**
+ * Reads a batch of datagrams from a shared socket and hands them to their
+ * sessions. Datagrams from unknown senders are discarded.
+ *
+ * @return 1 if the socket was drained, 0 if there may be datagrams left.
+ */
+static int rtp_worker_mux_read(struct rtp_worker *w,
+                               struct rtp_worker_src *src)
+{
+        rtp_mux_msg msgs[RTP_MUX_BATCH];
+        struct iovec iovs[RTP_MUX_BATCH];
+        struct sockaddr_storage addrs[RTP_MUX_BATCH];
+#ifdef SO_TIMESTAMPNS
+        rtp_recv_cmsg ctrls[RTP_MUX_BATCH];
+        struct timeval stamp;
+#endif
+        struct rtp_worker_src *dst;
+        struct timeval now, *tv;
+        nms_sockaddr from;
+        uint8_t *data;
+        int i, n, len;
+
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < RTP_MUX_BATCH; i++) {
+                iovs[i].iov_base = w->stage + i * RTP_MUX_STAGE;
+                iovs[i].iov_len = RTP_MUX_STAGE;
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_TIMESTAMPNS
+                msgs[i].msg_hdr.msg_control = &ctrls[i];
+                msgs[i].msg_hdr.msg_controllen = sizeof(ctrls[i]);
+#endif
+        }
+#ifdef HAVE_RECVMMSG
+        if ((n = recvmmsg(src->fd, msgs, RTP_MUX_BATCH, RTP_MUX_FLAGS,
+                          NULL)) < 0)
+                n = 0;
+#else
+        for (n = 0; n < RTP_MUX_BATCH; n++) {
+                if ((len = recvmsg(src->fd, &msgs[n].msg_hdr, RTP_MUX_FLAGS)) < 0)
+                        break;
+                msgs[n].msg_len = len;
+        }
+#endif
+        if (!n)
+                return 1;
+
+        gettimeofday(&now, NULL);
+
+        rtp_mux_rdlock();
+        for (i = 0; i < n; i++) {
+                data = w->stage + i * RTP_MUX_STAGE;
+                len = msgs[i].msg_len;
+                from.addr = (struct sockaddr *) &addrs[i];
+                from.addr_len = msgs[i].msg_hdr.msg_namelen;
+                if (src->type == RTP_WSRC_MUX_RTP) {
+                        rtp_pkt *pkt = (rtp_pkt *) data;
+
+                        if (len < 12
+                                        || !(dst = rtp_mux_find(&from, RTP_PKT_SSRC(pkt),
+                                                                pkt->pt, RTP))) {
+                                nms_printf(NMSML_VERB,
+                                           "RTP packet from unknown sender discarded\n");
+                                continue;
+                        }
+                        tv = &now;
+#ifdef SO_TIMESTAMPNS
+                        if (!rtp_recv_stamp(&msgs[i].msg_hdr, &stamp))
+                                tv = &stamp;
+#endif
+                        rtp_worker_started(dst->ctl);
+                        rtp_recv_copy(dst->rtp_sess, data, len, &from, tv);
+                } else {
+                        if (len < 8
+                                        || !(dst = rtp_mux_find(&from,
+                                                                ntohl(((uint32_t *) data)[1]),
+                                                                -1, RTCP)))
+                                continue;
+                        rtcp_recv_pkt(dst->rtp_sess, data,
+                                      min(len, RTP_MUX_STAGE), &from);
+                }
+        }
+        rtp_mux_unlock();
+
+        return n < RTP_MUX_BATCH;
+}
+
+/**
+ * Reads the socket of a ready source, at most RTP_WORKER_BUDGET times.
+ * A failing RTCP socket is given up until its next event.
+ *
+ * @return 1 if the socket was drained, 0 if there may be datagrams left.
+ */
+static int rtp_worker_read(struct rtp_worker *w, struct rtp_worker_src *src)
+{
+        int i, ret;
+
+        for (i = 0; i < RTP_WORKER_BUDGET; i++)
+                if (src->type == RTP_WSRC_RTP) {
+                        if (rtp_recv(src->rtp_sess) == RTP_RECV_AGAIN)
+                                return 1;
+                } else if (src->type == RTP_WSRC_RTCP) {
+                        if ((ret = rtcp_recv(src->rtp_sess)) == RTP_RECV_AGAIN
+                                        || ret < 0)
+                                return 1;
+                } else if (rtp_worker_mux_read(w, src)) {
+                        return 1;
+                }
+
+        return 0;
+}
+
+/**
+ * Handles an event taken from the epoll set, with the worker lock held.
+ */
+static void rtp_worker_event(struct rtp_worker *w, struct rtp_worker_src *src)
+{
+        struct rtp_worker_ctl *ctl = src->ctl;
+        uint64_t expired;
+
+        switch (src->type) {
+        case RTP_WSRC_RTP:
+                rtp_worker_started(ctl);
+                /* fall through */
+        case RTP_WSRC_RTCP:
+        case RTP_WSRC_MUX_RTP:
+        case RTP_WSRC_MUX_RTCP:
+                if (!src->ready) {
+                        src->ready = 1;
+                        src->next_ready = w->ready;
+                        w->ready = src;
+                }
+                break;
+        case RTP_WSRC_TIMER:
+                if (read(src->fd, &expired, sizeof(expired)) <= 0 || !ctl->head)
+                        break;
+                if ((ctl->head = rtcp_handle_event(ctl->head)))
+                        rtcp_timer_set(src->fd, &ctl->head->tv);
+                break;
+        }
+}
+
+/**
+ * The worker main loop: the round is served with the worker lock held and
+ * cancellation disabled, so that controllers are attached and detached
+ * between rounds only.
+ *
+ * @param args The rtp_worker
+ */
+static void *rtp_worker_loop(void *args)
+{
+        struct rtp_worker *w = args;
+        struct epoll_event events[RTP_WORKER_EVENTS];
+        struct rtp_worker_src *src, **prev;
+        int i, n;
+
+        pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+        while (1) {
+                if ((n = epoll_wait(w->epfd, events, RTP_WORKER_EVENTS,
+                                    w->ready ? 0 : -1)) < 0)
+                        n = 0;
+
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+                pthread_mutex_lock(&w->lock);
+
+                for (i = 0; i < n; i++)
+                        if (!(src = events[i].data.ptr)->dead)
+                                rtp_worker_event(w, src);
+
+                for (prev = &w->ready; (src = *prev);) {
+                        if (rtp_worker_read(w, src)) {
+                                src->ready = 0;
+                                *prev = src->next_ready;
+                        } else {
+                                prev = &src->next_ready;
+                        }
+                }
+
+                while ((src = w->dead)) {
+                        w->dead = src->next;
+                        free(src);
+                }
+
+                pthread_mutex_unlock(&w->lock);
+                pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+                pthread_testcancel();
+        }
+
+        return NULL;
+}
+
+/**
+ * Registers the descriptor of a source in the epoll set of a worker.
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+static int rtp_worker_watch(struct rtp_worker *w, struct rtp_worker_src *src)
+{
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = src;
+        if (src->type != RTP_WSRC_TIMER
+                        && fcntl(src->fd, F_SETFL,
+                                 fcntl(src->fd, F_GETFL) | O_NONBLOCK) < 0)
+                return 1;
+
+        return epoll_ctl(w->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0;
+}
+
+/**
+ * Adds a source to a controller and registers it. The sources of the
+ * sessions on the shared sockets go in the demultiplexing table instead.
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+static int rtp_worker_add(struct rtp_worker_ctl *ctl,
+                          enum rtp_worker_src_type type, int fd,
+                          rtp_session * rtp_sess)
+{
+        struct rtp_worker_src *src;
+
+        if (!(src = calloc(1, sizeof(struct rtp_worker_src))))
+                return 1;
+        src->type = type;
+        src->fd = fd;
+        src->rtp_sess = rtp_sess;
+        src->ctl = ctl;
+        src->next = ctl->srcs;
+        ctl->srcs = src;
+
+        if (rtp_sess && rtp_sess->muxed) {
+                src->fd = -1;
+                return rtp_mux_add(rtp_sess, type == RTP_WSRC_RTP ? RTP : RTCP,
+                                   src);
+        }
+
+        return rtp_worker_watch(ctl->worker, src);
+}
+
+/**
+ * Unregisters a list of sources, with the worker lock held, and hands
+ * them to the worker to be freed.
+ */
+static void rtp_worker_retire(struct rtp_worker *w, struct rtp_worker_src *srcs)
+{
+        struct rtp_worker_src *src, **prev;
+
+        if (!srcs)
+                return;
+
+        for (src = srcs; src; src = src->next) {
+                if (src->fd >= 0)
+                        epoll_ctl(w->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+                src->dead = 1;
+        }
+        for (prev = &w->ready; (src = *prev);)
+                if (src->dead)
+                        *prev = src->next_ready;
+                else
+                        prev = &src->next_ready;
+
+        for (src = srcs; src->next; src = src->next);
+        src->next = w->dead;
+        w->dead = srcs;
+}
+
+/**
+ * Unregisters the descriptors of a controller, with the worker lock held.
+ */
+static void rtp_worker_remove(struct rtp_worker_ctl *ctl)
+{
+        struct rtp_worker *w = ctl->worker;
+        rtp_session *rtp_sess;
+
+        for (rtp_sess = ctl->rtp_th->rtp_sess_head; rtp_sess;
+                        rtp_sess = rtp_sess->next)
+                if (rtp_sess->muxed)
+                        rtp_mux_del(rtp_sess);
+
+        rtp_worker_retire(w, ctl->srcs);
+        ctl->srcs = NULL;
+        w->load -= ctl->sessions;
+}
+
+/**
+ * Registers a shared socket in a worker, with the worker lock held.
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+static int rtp_worker_mux_add(struct rtp_worker *w,
+                              enum rtp_worker_src_type type, int fd)
+{
+        struct rtp_worker_src *src;
+
+        if (!(src = calloc(1, sizeof(struct rtp_worker_src))))
+                return 1;
+        src->type = type;
+        src->fd = fd;
+        src->next = w->mux;
+        w->mux = src;
+
+        return rtp_worker_watch(w, src);
+}
+
+/**
+ * Frees what the worker had for the shared sockets, once it is stopped.
+ */
+static void rtp_worker_unmux(struct rtp_worker *w)
+{
+        struct rtp_worker_src *src;
+
+        while ((src = w->mux)) {
+                w->mux = src->next;
+                free(src);
+        }
+        free(w->stage);
+        w->stage = NULL;
+}
+#endif
+
+/**
+ * Starts the process-wide pool of RTP workers. RTSP controllers which
+ * set up their media afterwards are served by the pool instead of having
+ * their own RTP and RTCP threads.
+ *
+ * The overflow policy RTP_OVF_BLOCK stalls every session of a worker.
+ *
+ * @param n Number of workers, 0 for one per online core
+ *
+ * @return 0 if everything was ok, 1 otherwise (workers need epoll and
+ * timerfd)
+ */
+int rtp_workers_init(int n)
+{
+#ifdef RTP_WORKERS
+        struct rtp_worker *w;
+        int i;
+
+        if (n <= 0 && (n = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+                n = 1;
+        n = min(n, RTP_WORKERS_MAX);
+
+        pthread_mutex_lock(&rtp_workers_lock);
+        if (rtp_workers_num) {
+                pthread_mutex_unlock(&rtp_workers_lock);
+                return nms_printf(NMSML_ERR, "RTP workers already running\n");
+        }
+
+        for (i = 0; i < n; i++) {
+                w = &rtp_workers[i];
+                memset(w, 0, sizeof(struct rtp_worker));
+                pthread_mutex_init(&w->lock, NULL);
+                if ((w->epfd = epoll_create(RTP_WORKER_EVENTS)) < 0
+                                || pthread_create(&w->tid, NULL, rtp_worker_loop, w)) {
+                        if (w->epfd >= 0)
+                                close(w->epfd);
+                        pthread_mutex_destroy(&w->lock);
+                        break;
+                }
+        }
+        rtp_workers_num = i;
+        pthread_mutex_unlock(&rtp_workers_lock);
+
+        if (i < n) {
+                rtp_workers_uninit();
+                return nms_printf(NMSML_ERR, "Cannot start the RTP workers\n");
+        }
+        nms_printf(NMSML_DBG1, "%d RTP workers started\n", n);
+
+        return 0;
+#else
+        return nms_printf(NMSML_ERR, "RTP workers not supported\n");
+#endif
+}
+
+/**
+ * Stops the pool of RTP workers. All the controllers must be detached.
+ *
+ * @return 0 if everything was ok, 1 if some sessions are still attached
+ */
+int rtp_workers_uninit(void)
+{
+#ifdef RTP_WORKERS
+        struct rtp_worker *w;
+        int i;
+
+        pthread_mutex_lock(&rtp_workers_lock);
+        for (i = 0; i < rtp_workers_num; i++)
+                if (rtp_workers[i].load) {
+                        pthread_mutex_unlock(&rtp_workers_lock);
+                        return nms_printf(NMSML_ERR,
+                                          "RTP workers still serving sessions\n");
+                }
+
+        for (i = 0; i < rtp_workers_num; i++) {
+                w = &rtp_workers[i];
+                pthread_cancel(w->tid);
+                pthread_join(w->tid, NULL);
+                close(w->epfd);
+                while (w->dead) {
+                        struct rtp_worker_src *src = w->dead;
+
+                        w->dead = src->next;
+                        free(src);
+                }
+                rtp_worker_unmux(w);
+                pthread_mutex_destroy(&w->lock);
+        }
+        rtp_mux_close();
+        rtp_workers_num = 0;
+        pthread_mutex_unlock(&rtp_workers_lock);
+#endif
+        return 0;
+}
+
+/**
+ * @return 1 if the pool of RTP workers is running, 0 otherwise
+ */
+int rtp_workers_active(void)
+{
+#ifdef RTP_WORKERS
+        return rtp_workers_num > 0;
+#else
+        return 0;
+#endif
+}
+
+/**
+ * Attaches the sessions of an RTSP controller to the least loaded worker,
+ * which serves their RTP and RTCP sockets and RTCP events from now on.
+ *
+ * @param rtp_th The rtp_thread of the controller, with all its sessions
+ *
+ * @return 0 if everything was ok, 1 otherwise
+ */
+int rtp_worker_attach(rtp_thread * rtp_th)
+{
+#ifdef RTP_WORKERS
+        struct rtp_worker_ctl *ctl;
+        struct rtp_worker *w = NULL;
+        rtp_session *rtp_sess;
+        int i, err = 0;
+
+        if (!(ctl = calloc(1, sizeof(struct rtp_worker_ctl))))
+                return 1;
+
+        if (rtp_bp_init(rtp_th->rtp_sess_head)) {
+                free(ctl);
+                return 1;
+        }
+        rtp_recv_init(rtp_th->rtp_sess_head);
+
+        ctl->rtp_th = rtp_th;
+        ctl->buffering = 1;
+        if ((ctl->tfd = timerfd_create(CLOCK_REALTIME, 0)) < 0
+                        || !(ctl->head = rtcp_schedule_sessions(rtp_th->rtp_sess_head))) {
+                if (ctl->tfd >= 0)
+                        close(ctl->tfd);
+                free(ctl);
+                return 1;
+        }
+
+        pthread_mutex_lock(&rtp_workers_lock);
+        for (i = 0; i < rtp_workers_num; i++)
+                if (!w || rtp_workers[i].load < w->load)
+                        w = &rtp_workers[i];
+        if (!w) {
+                pthread_mutex_unlock(&rtp_workers_lock);
+                rtcp_clean_events(&ctl->head);
+                close(ctl->tfd);
+                free(ctl);
+                return 1;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        ctl->worker = w;
+        for (rtp_sess = rtp_th->rtp_sess_head; rtp_sess && !err;
+                        rtp_sess = rtp_sess->next) {
+                err = rtp_worker_add(ctl, RTP_WSRC_RTP,
+                                     rtp_sess->transport.RTP.sock.fd, rtp_sess)
+                      || rtp_worker_add(ctl, RTP_WSRC_RTCP,
+                                        rtp_sess->transport.RTCP.sock.fd, rtp_sess);
+                ctl->sessions++;
+        }
+        w->load += ctl->sessions;
+        if (!err)
+                err = rtp_worker_add(ctl, RTP_WSRC_TIMER, ctl->tfd, NULL);
+        if (err) {
+                rtp_worker_remove(ctl);
+        } else {
+                rtcp_timer_set(ctl->tfd, &ctl->head->tv);
+                rtp_th->worker = ctl;
+        }
+        pthread_mutex_unlock(&w->lock);
+        pthread_mutex_unlock(&rtp_workers_lock);
+
+        if (err) {
+                rtcp_clean_events(&ctl->head);
+                close(ctl->tfd);
+                free(ctl);
+                return 1;
+        }
+        nms_printf(NMSML_DBG1, "RTP sessions attached to worker %d\n",
+                   (int) (w - rtp_workers));
+
+        return 0;
+#else
+        return 1;
+#endif
+}
+
+/**
+ * Detaches the sessions of an RTSP controller from their worker and frees
+ * them, like the cancellation of its RTP and RTCP threads does.
+ *
+ * @param rtp_th The rtp_thread of the controller
+ *
+ * @return 0 if everything was ok, 1 if it was not attached
+ */
+int rtp_worker_detach(rtp_thread * rtp_th)
+{
+#ifdef RTP_WORKERS
+        struct rtp_worker_ctl *ctl = rtp_th->worker;
+        struct rtp_worker *w;
+
+        if (!ctl)
+                return 1;
+        w = ctl->worker;
+
+        pthread_mutex_lock(&rtp_workers_lock);
+        pthread_mutex_lock(&w->lock);
+        rtp_worker_remove(ctl);
+        pthread_mutex_unlock(&w->lock);
+        pthread_mutex_unlock(&rtp_workers_lock);
+
+        close(ctl->tfd);
+        rtcp_clean_events(&ctl->head);
+        free(ctl);
+
+        rtp_th->worker = NULL;
+        rtp_clean(rtp_th);
+
+        return 0;
+#else
+        return 1;
+#endif
+}
+
+/**
+ * Makes the unicast RTP sessions set up from now on share a single local
+ * port pair instead of binding one each: every worker receives on its own
+ * RTP and RTCP sockets bound to the pair with SO_REUSEPORT, and hands the
+ * datagrams to their sessions by the address of the sender and by SSRC.
+ *
+ * @param port The even local RTP port, port + 1 is used for RTCP
+ *
+ * @return 0 if everything was ok, 1 otherwise (it needs the workers)
+ */
+int rtp_workers_mux(int port)
+{
+#ifdef RTP_WORKERS
+        struct rtp_worker *w;
+        int i, err = 0;
+
+        pthread_mutex_lock(&rtp_workers_lock);
+        if (!rtp_workers_num) {
+                pthread_mutex_unlock(&rtp_workers_lock);
+                return nms_printf(NMSML_ERR,
+                                  "RTP shared ports need the RTP workers\n");
+        }
+        if (rtp_mux_open(port, rtp_workers_num)) {
+                pthread_mutex_unlock(&rtp_workers_lock);
+                return 1;
+        }
+
+        for (i = 0; i < rtp_workers_num && !err; i++) {
+                w = &rtp_workers[i];
+                pthread_mutex_lock(&w->lock);
+                if (!(w->stage = malloc(RTP_MUX_BATCH * RTP_MUX_STAGE)))
+                        err = 1;
+                err = err || rtp_worker_mux_add(w, RTP_WSRC_MUX_RTP,
+                                                rtp_mux_fd(i, RTP))
+                      || rtp_worker_mux_add(w, RTP_WSRC_MUX_RTCP,
+                                            rtp_mux_fd(i, RTCP));
+                pthread_mutex_unlock(&w->lock);
+        }
+
+        if (err) {
+                /* stop using the shared sockets before closing them */
+                for (i = 0; i < rtp_workers_num; i++) {
+                        w = &rtp_workers[i];
+                        pthread_mutex_lock(&w->lock);
+                        rtp_worker_retire(w, w->mux);
+                        w->mux = NULL;
+                        free(w->stage);
+                        w->stage = NULL;
+                        pthread_mutex_unlock(&w->lock);
+                }
+                rtp_mux_close();
+        }
+        pthread_mutex_unlock(&rtp_workers_lock);
+
+        return err ? nms_printf(NMSML_ERR, "Cannot share the RTP ports\n") : 0;
+#else
+        return nms_printf(NMSML_ERR, "RTP workers not supported\n");
+#endif
+}
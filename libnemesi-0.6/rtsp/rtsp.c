@@ -134,6 +134,49 @@ rtsp_ctrl *rtsp_init(nms_rtsp_hints * hints)
                 // prebuffer size
                 if (hints->prebuffer_size > 0)
                         rtsp_th->rtp_th->prebuffer_size = hints->prebuffer_size;
+                // playout buffer reorder window
+                if (hints->reorder_window > 0)
+                        rtsp_th->rtp_th->reorder_window = hints->reorder_window;
+                // bufferpool overflow policy
+                switch (hints->overflow_policy) {
+                case RTP_OVF_DROP_NEWEST:
+                case RTP_OVF_DROP_OLDEST:
+                case RTP_OVF_DROP_TO_KEYFRAME:
+                case RTP_OVF_BLOCK:
+                        rtsp_th->rtp_th->overflow_policy = hints->overflow_policy;
+                        break;
+                default:
+                        RET_ERR(NMSML_ERR, "Bufferpool overflow policy not supported!\n");
+                }
+                if (hints->overflow_timeout > 0)
+                        rtsp_th->rtp_th->overflow_timeout = hints->overflow_timeout;
+                // bufferpool memory
+                if (hints->bp_mem_flags & ~(BP_MEM_HUGEPAGES | BP_MEM_MLOCK))
+                        RET_ERR(NMSML_ERR, "Bufferpool memory flags not supported!\n");
+                rtsp_th->rtp_th->bp_mem_flags = hints->bp_mem_flags;
+                if (hints->bp_shared_limit > 0
+                                && bpshared_init(hints->bp_shared_limit,
+                                                 hints->bp_shared_soft,
+                                                 hints->bp_shared_hard))
+                        RET_ERR(NMSML_ERR, "Bufferpool shared budget not valid or already in use!\n");
+                // adaptive playout delay
+                if (hints->playout_delay_min < 0
+                                || hints->playout_delay_max < 0
+                                || (hints->playout_delay_max
+                                    && hints->playout_delay_max < hints->playout_delay_min))
+                        RET_ERR(NMSML_ERR, "Playout delay bounds not valid!\n");
+                rtsp_th->rtp_th->playout_delay_min = hints->playout_delay_min;
+                rtsp_th->rtp_th->playout_delay_max = hints->playout_delay_max;
+                // batched receive
+                if (hints->recv_batch > 0)
+                        rtsp_th->rtp_th->recv_batch =
+                                min(hints->recv_batch, RTP_RECV_BATCH_MAX);
+                // kernel reception times
+                rtsp_th->rtp_th->rx_timestamps = hints->rx_timestamps != 0;
+                // io_uring receive engine
+                rtsp_th->rtp_th->io_uring = hints->io_uring != 0;
+                // coalesced receive
+                rtsp_th->rtp_th->udp_gro = hints->udp_gro != 0;
 
                 //force RTSP protocol
                 switch (hints->pref_rtsp_proto) {
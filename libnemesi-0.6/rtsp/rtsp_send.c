@@ -313,6 +313,14 @@ int send_setup_request(rtsp_thread * rtsp_th)
         rtsp_med->rtp_sess->transport.type = rtsp_th->default_rtp_proto;
         switch (rtsp_med->rtp_sess->transport.type) {
         case UDP:
+                if (rtsp_med->rtp_sess->transport.delivery == unicast
+                                && rtp_mux_active()) {
+                        /* the workers receive for every session on one port pair */
+                        if (rtp_mux_setup(rtsp_med->rtp_sess)
+                                        || set_transport_str(rtsp_med->rtp_sess, &options))
+                                goto err_handle;
+                        break;
+                }
 
 //#warning Finish port to netembryo!!!
                 sprintf(b, "%d", rnd);
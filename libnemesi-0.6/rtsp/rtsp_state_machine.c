@@ -131,39 +131,45 @@ int rtsp_reinit(rtsp_thread * rtsp_th)
 #if 1                // TODO: fix last teardown response wait
         // check for active rtp/rtcp session
         if (sess->media_queue && sess->media_queue->rtp_sess) {
-                if (rtsp_th->rtp_th->rtcp_tid > 0) {
+                if (rtsp_th->rtp_th->worker) {
                         nms_printf(NMSML_DBG1,
-                                   "Sending cancel signal to RTCP Thread (ID: %lu)\n",
-                                   rtsp_th->rtp_th->rtcp_tid);
-                        if ( pthread_cancel(rtsp_th->rtp_th->rtcp_tid) )
-                                nms_printf(NMSML_DBG2,
-                                           "Error while sending cancelation to RTCP Thread.\n");
-                        else {
-                                if ( pthread_join(rtsp_th->rtp_th->rtcp_tid,
-                                                  (void **) &ret) )
-                                        nms_printf(NMSML_ERR, "Could not join RTCP Thread!\n");
-                                else if (ret != PTHREAD_CANCELED)
+                                   "Detaching the RTP sessions from their worker\n");
+                        rtp_worker_detach(rtsp_th->rtp_th);
+                } else {
+                        if (rtsp_th->rtp_th->rtcp_tid > 0) {
+                                nms_printf(NMSML_DBG1,
+                                           "Sending cancel signal to RTCP Thread (ID: %lu)\n",
+                                           rtsp_th->rtp_th->rtcp_tid);
+                                if ( pthread_cancel(rtsp_th->rtp_th->rtcp_tid) )
                                         nms_printf(NMSML_DBG2,
-                                                   "Warning! RTCP Thread joined, but  not canceled!\n");
+                                                   "Error while sending cancelation to RTCP Thread.\n");
+                                else {
+                                        if ( pthread_join(rtsp_th->rtp_th->rtcp_tid,
+                                                          (void **) &ret) )
+                                                nms_printf(NMSML_ERR, "Could not join RTCP Thread!\n");
+                                        else if (ret != PTHREAD_CANCELED)
+                                                nms_printf(NMSML_DBG2,
+                                                           "Warning! RTCP Thread joined, but  not canceled!\n");
+                                }
+                                rtsp_th->rtp_th->rtcp_tid = 0;
                         }
-                        rtsp_th->rtp_th->rtcp_tid = 0;
-                }
-                if (rtsp_th->rtp_th->rtp_tid > 0) {
-                        nms_printf(NMSML_DBG1,
-                                   "Sending cancel signal to RTP Thread (ID: %lu)\n",
-                                   rtsp_th->rtp_th->rtp_tid);
-                        if (pthread_cancel(rtsp_th->rtp_th->rtp_tid) != 0)
-                                nms_printf(NMSML_DBG2,
-                                           "Error while sending cancelation to RTP Thread.\n");
-                        else {
-                                if ( pthread_join(rtsp_th->rtp_th->rtp_tid,
-                                                  (void **) &ret) )
-                                        nms_printf(NMSML_ERR, "Could not join RTP Thread!\n");
-                                else if (ret != PTHREAD_CANCELED)
+                        if (rtsp_th->rtp_th->rtp_tid > 0) {
+                                nms_printf(NMSML_DBG1,
+                                           "Sending cancel signal to RTP Thread (ID: %lu)\n",
+                                           rtsp_th->rtp_th->rtp_tid);
+                                if (pthread_cancel(rtsp_th->rtp_th->rtp_tid) != 0)
                                         nms_printf(NMSML_DBG2,
-                                                   "Warning! RTP Thread joined, but not canceled.\n");
+                                                   "Error while sending cancelation to RTP Thread.\n");
+                                else {
+                                        if ( pthread_join(rtsp_th->rtp_th->rtp_tid,
+                                                          (void **) &ret) )
+                                                nms_printf(NMSML_ERR, "Could not join RTP Thread!\n");
+                                        else if (ret != PTHREAD_CANCELED)
+                                                nms_printf(NMSML_DBG2,
+                                                           "Warning! RTP Thread joined, but not canceled.\n");
+                                }
+                                rtsp_th->rtp_th->rtp_tid = 0;
                         }
-                        rtsp_th->rtp_th->rtp_tid = 0;
                 }
         }
 #endif
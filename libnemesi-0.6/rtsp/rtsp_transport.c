@@ -489,5 +489,16 @@ rtsp_medium *rtsp_med_create(rtsp_thread * t)
                 return NULL;
 
         rtsp_m->rtp_sess->owner = t;
+        rtsp_m->rtp_sess->reorder_window = t->rtp_th->reorder_window;
+        rtsp_m->rtp_sess->overflow_policy = t->rtp_th->overflow_policy;
+        rtsp_m->rtp_sess->overflow_timeout = t->rtp_th->overflow_timeout;
+        rtsp_m->rtp_sess->bp_mem_flags = t->rtp_th->bp_mem_flags;
+        rtsp_m->rtp_sess->playout_delay_min = t->rtp_th->playout_delay_min;
+        rtsp_m->rtp_sess->playout_delay_max = t->rtp_th->playout_delay_max;
+        rtsp_m->rtp_sess->recv_batch = t->rtp_th->recv_batch;
+        rtsp_m->rtp_sess->rx_timestamps = t->rtp_th->rx_timestamps;
+        rtsp_m->rtp_sess->io_uring = t->rtp_th->io_uring;
+        rtsp_m->rtp_sess->udp_gro = t->rtp_th->udp_gro;
+        rtsp_m->rtp_sess->wait = &t->rtp_th->wait;
         return rtsp_m;
 }